@@ -0,0 +1,292 @@
+#include "host_keyer.h"
+
+#include <gtest/gtest.h>
+
+#include <initializer_list>
+
+// Press & release of every listed button, `hold` us apart, starting at `time`.
+// Buttons are released in the order they were pressed.
+static void Chord(HostKeyer &keyer, int64_t time,
+                  std::initializer_list<Button> buttons, int64_t hold = 50000) {
+  for (Button button : buttons) {
+    keyer.Feed({button, time});
+    time += 10000;
+  }
+  time += hold;
+  for (Button button : buttons) {
+    keyer.Feed({button, time});
+    time += 10000;
+  }
+}
+
+static RecordedReport Report(int64_t time, uint8_t modifiers, uint8_t key) {
+  RecordedReport report = {time, {}};
+  report.report.modifiers = modifiers;
+  report.report.keys[0] = key;
+  return report;
+}
+
+TEST(ChordEngineTest, ChordIsSentOnFirstRelease) {
+  HostKeyer keyer;
+  Chord(keyer, 1000000, {INDEX_7, RING_5}); // 'h'
+  keyer.Finish();
+  const int64_t release = 1000000 + 20000 + 50000;
+  EXPECT_EQ(keyer.hid.sent, (std::vector<RecordedReport>{
+                                Report(release, 0, 0x0b),
+                                Report(release, 0, 0),
+                            }));
+}
+
+TEST(ChordEngineTest, BouncingContactsAreIgnored) {
+  HostKeyer keyer;
+  // Press with two bounces, clean release
+  keyer.Feed({INDEX_7, 1000000});
+  keyer.Feed({INDEX_7, 1000200});
+  keyer.Feed({INDEX_7, 1000400});
+  keyer.Feed({RING_5, 1020000});
+  keyer.Feed({INDEX_7, 1100000});
+  // Release with a bounce
+  keyer.Feed({RING_5, 1110000});
+  keyer.Feed({RING_5, 1110100});
+  keyer.Feed({RING_5, 1110200});
+  keyer.Finish();
+  EXPECT_EQ(keyer.hid.sent, (std::vector<RecordedReport>{
+                                Report(1100000, 0, 0x0b),
+                                Report(1100000, 0, 0),
+                            }));
+  EXPECT_EQ(keyer.debouncer.pressed_state, 0);
+  EXPECT_EQ(keyer.event_nanos.size(), 8u);
+}
+
+TEST(ChordEngineTest, LittleFingerHoldsShift) {
+  HostKeyer keyer;
+  keyer.Feed({LITTLE_6, 1000000});
+  Chord(keyer, 1100000, {INDEX_7, RING_5}); // 'H'
+  keyer.Feed({LITTLE_6, 1300000});
+  keyer.Finish();
+  const int64_t release = 1100000 + 20000 + 50000;
+  EXPECT_EQ(keyer.hid.sent, (std::vector<RecordedReport>{
+                                Report(release, 0x02, 0x0b),
+                                Report(release, 0x02, 0),
+                                Report(1300000, 0, 0),
+                            }));
+}
+
+TEST(ChordEngineTest, ArpeggioModifiesNextKey) {
+  HostKeyer keyer;
+  // THUMB_1 then INDEX_3 (>= 80 ms apart) = right Ctrl for the next key
+  keyer.Feed({THUMB_1, 1000000});
+  keyer.Feed({INDEX_3, 1100000});
+  keyer.Feed({INDEX_3, 1150000});
+  keyer.Feed({THUMB_1, 1160000});
+  Chord(keyer, 1500000, {INDEX_7, RING_5});
+  keyer.Finish();
+  const int64_t release = 1500000 + 20000 + 50000;
+  EXPECT_EQ(keyer.hid.sent, (std::vector<RecordedReport>{
+                                Report(1150000, 0x10, 0),
+                                Report(release, 0x10, 0x0b),
+                                Report(release, 0, 0),
+                            }));
+}
+
+TEST(ChordEngineTest, ModifiedKeyIsOneReport) {
+  HostKeyer keyer;
+  Chord(keyer, 1000000, {THUMB_2, MIDDLE_8, RING_5}); // Ctrl + Right
+  keyer.Finish();
+  const int64_t release = 1000000 + 30000 + 50000;
+  EXPECT_EQ(keyer.hid.sent, (std::vector<RecordedReport>{
+                                Report(release, 0x01, 0x4f),
+                                Report(release, 0, 0),
+                            }));
+}
+
+struct RecordingSink : CoalescingHidSink {
+  std::vector<KeyReport> sent;
+  void SendReport(const KeyReport &report) override { sent.push_back(report); }
+};
+
+TEST(CoalescingHidSinkTest, SendsReportsTheHostMustSee) {
+  RecordingSink sink;
+  // Key pressed before a modifier - the host must see it unmodified
+  sink.Press('x');
+  sink.Press(KEY_LEFT_CTRL);
+  sink.Flush();
+  ASSERT_EQ(sink.sent.size(), 2u);
+  EXPECT_EQ(sink.sent[0].modifiers, 0);
+  EXPECT_EQ(sink.sent[0].keys[0], 0x1b);
+  EXPECT_EQ(sink.sent[1].modifiers, 0x01);
+  EXPECT_EQ(sink.sent[1].keys[0], 0x1b);
+
+  // Releases are merged, a re-pressed key is sent twice
+  sink.sent.clear();
+  sink.Release('x');
+  sink.Release(KEY_LEFT_CTRL);
+  sink.Press('x');
+  sink.Release('x');
+  sink.Flush();
+  ASSERT_EQ(sink.sent.size(), 3u);
+  EXPECT_EQ(sink.sent[0].keys[0], 0);
+  EXPECT_EQ(sink.sent[1].keys[0], 0x1b);
+  EXPECT_EQ(sink.sent[2].keys[0], 0);
+
+  // Nothing changed - nothing sent
+  sink.sent.clear();
+  sink.Press('y');
+  sink.Release('y');
+  sink.Flush();
+  sink.Flush();
+  EXPECT_EQ(sink.sent.size(), 2u);
+}
+
+struct ReportedChange {
+  int64_t time;
+  Button button;
+  bool pressed;
+  bool operator==(const ReportedChange &) const = default;
+};
+
+TEST(ButtonDebouncerTest, MissedEdgeIsFixedWhenSettled) {
+  SimClock clock;
+  SimGpio gpio;
+  ButtonDebouncer debouncer;
+  std::vector<ReportedChange> reported;
+  debouncer.OnSetup(clock, gpio, [&](Button button, bool pressed) {
+    reported.push_back({clock.now, button, pressed});
+  });
+  auto edge = [&](int64_t time, Button button) {
+    clock.AdvanceTo(time);
+    gpio.pressed ^= ButtonBit(button);
+    debouncer.OnChange(button);
+  };
+  edge(1000, INDEX_3);   // reported immediately
+  edge(1100, INDEX_3);   // bounce
+  edge(1200, INDEX_3);   // bounce
+  edge(2000, MIDDLE_4);  // other buttons aren't affected
+  edge(4000, INDEX_3);   // too short a press - released within the window
+  clock.AdvanceTo(100000);
+  EXPECT_EQ(reported, (std::vector<ReportedChange>{
+                          {1000, INDEX_3, true},
+                          {2000, MIDDLE_4, true},
+                          {1000 + 4 * ButtonDebouncer::kScanMicroseconds,
+                           INDEX_3, false},
+                      }));
+  EXPECT_EQ(debouncer.pressed_state, ButtonBit(MIDDLE_4));
+  EXPECT_EQ(debouncer.unsettled, 0);
+  // The scans stop once every button settles
+  EXPECT_FALSE(clock.timers[0]->IsActive());
+  EXPECT_EQ(clock.callback_nanos.size(), 4u);
+
+  edge(200000, MIDDLE_4);
+  EXPECT_EQ(reported.back(), (ReportedChange{200000, MIDDLE_4, false}));
+}
+
+TEST(ReplayWakeButtonsTest, TappedChordIsReleased) {
+  std::vector<ReportedChange> reported;
+  auto report = [&](Button button, bool pressed) {
+    reported.push_back({0, button, pressed});
+  };
+  // Released before the debouncer started
+  ReplayWakeButtons(ButtonBit(THUMB_0) | ButtonBit(MIDDLE_8), 0, report);
+  EXPECT_EQ(reported, (std::vector<ReportedChange>{
+                          {0, THUMB_0, true},
+                          {0, MIDDLE_8, true},
+                          {0, THUMB_0, false},
+                          {0, MIDDLE_8, false},
+                      }));
+}
+
+TEST(ReplayWakeButtonsTest, WakingButtonsGoFirst) {
+  std::vector<ReportedChange> reported;
+  auto report = [&](Button button, bool pressed) {
+    reported.push_back({0, button, pressed});
+  };
+  // MIDDLE_4 woke the keyboard up and is still held, INDEX_3 (not a wake pin)
+  // was pressed after it. THUMB_1 was tapped.
+  ReplayWakeButtons(ButtonBit(THUMB_1) | ButtonBit(MIDDLE_4),
+                    ButtonBit(INDEX_3) | ButtonBit(MIDDLE_4), report);
+  EXPECT_EQ(reported, (std::vector<ReportedChange>{
+                          {0, THUMB_1, true},
+                          {0, MIDDLE_4, true},
+                          {0, INDEX_3, true},
+                          {0, THUMB_1, false},
+                      }));
+}
+
+// The scan that `Layer::unique_actions` replaces.
+static ActionId ScanUniqueAction(const Layer &layer, ButtonMask buttons) {
+  ActionId first_found = 0;
+  FingerPosition thumb_current = Thumb(buttons),
+                 index_current = Index(buttons),
+                 middle_current = Middle(buttons),
+                 ring_current = Ring(buttons),
+                 little_current = Little(buttons);
+  for (FingerPosition thumb = 0; thumb <= 3; ++thumb) {
+    if (thumb_current && thumb_current != thumb)
+      continue;
+    for (FingerPosition index = 0; index <= 2; ++index) {
+      if (index_current && index_current != index)
+        continue;
+      for (FingerPosition middle = 0; middle <= 2; ++middle) {
+        if (middle_current && middle_current != middle)
+          continue;
+        for (FingerPosition ring = 0; ring <= 2; ++ring) {
+          if (ring_current && ring_current != ring)
+            continue;
+          for (FingerPosition little = 0; little <= 1; ++little) {
+            if (little_current && little_current != little)
+              continue;
+            if (ActionId found =
+                    layer.chords[thumb][index][middle][ring][little]) {
+              if (first_found) {
+                return 0;
+              }
+              first_found = found;
+            }
+          }
+        }
+      }
+    }
+  }
+  return first_found;
+}
+
+TEST(ChordEngineTest, UniqueActionsMatchScan) {
+  const Layer &layer = kDefaultLayout.base_layer;
+  int unique_count = 0;
+  for (int buttons = 0; buttons < (1 << NUM_BUTTONS); ++buttons) {
+    ASSERT_EQ(layer.unique_actions[buttons], ScanUniqueAction(layer, buttons))
+        << "buttons " << buttons;
+    unique_count += layer.unique_actions[buttons] != 0;
+  }
+  EXPECT_GT(unique_count, 0);
+
+  // Sparse layer where most masks have a single reachable chord
+  Layer sparse = {};
+  const ActionId a = 1, b = 2;
+  sparse.chords[1][0][0][0][0] = a;
+  sparse.chords[1][2][0][0][1] = b;
+  sparse.CompileUniqueActions();
+  for (int buttons = 0; buttons < (1 << NUM_BUTTONS); ++buttons) {
+    ASSERT_EQ(sparse.unique_actions[buttons],
+              ScanUniqueAction(sparse, buttons))
+        << "buttons " << buttons;
+  }
+  EXPECT_EQ(sparse.unique_actions[ButtonBit(THUMB_0)], 0);
+  EXPECT_EQ(sparse.unique_actions[ButtonBit(LITTLE_6)], b);
+  EXPECT_EQ(sparse.unique_actions[ButtonBit(THUMB_1)], 0);
+}
+
+TEST(ChordEngineTest, DefaultLayoutHasShiftVariants) {
+  const Layout &layout = kDefaultLayout;
+  EXPECT_LT(layout.action_count, Layout::kMaxActions);
+  // 'h' and its shifted variant
+  ActionId h = layout.base_layer.chords[0][2][0][1][0];
+  ActionId shift_h = layout.base_layer.chords[0][2][0][1][1];
+  ASSERT_NE(h, 0);
+  ASSERT_NE(shift_h, 0);
+  EXPECT_EQ(layout.actions[h].op, OP_KEY);
+  EXPECT_EQ(layout.actions[shift_h].op, OP_HOLD_MODIFIER);
+  EXPECT_EQ(layout.actions[shift_h].key, KEY_LEFT_SHIFT);
+  EXPECT_EQ(layout.actions[shift_h].next, h);
+  EXPECT_EQ(layout.actions[shift_h + 1].op, OP_RELEASE_HELD_MODIFIER);
+}
@@ -0,0 +1,153 @@
+#include "ChordStats.h"
+#include "host_keyer.h"
+
+#include <gtest/gtest.h>
+
+static void TypeH(HostKeyer &keyer, int64_t time) {
+  keyer.Feed({INDEX_7, time});
+  keyer.Feed({RING_5, time + 10000});
+  keyer.Feed({INDEX_7, time + 60000});
+  keyer.Feed({RING_5, time + 70000});
+}
+
+static uint32_t BigramCount(const ChordStats &stats, ActionId first,
+                            ActionId second) {
+  uint32_t key = uint32_t(first) << 16 | second;
+  for (auto &bigram : stats.bigrams) {
+    if (bigram.key == key) {
+      return bigram.count;
+    }
+  }
+  return 0;
+}
+
+TEST(ChordStatsTest, CountsChordsAndBigrams) {
+  HostKeyer keyer;
+  ChordStats stats;
+  keyer.engine.stats = &stats;
+  TypeH(keyer, 1000000);
+  TypeH(keyer, 1300000);
+  TypeH(keyer, 5000000); // after a pause - typed from rest
+  keyer.Finish();
+
+  ActionId h = kDefaultLayout.base_layer.ChordAction(ButtonBit(INDEX_7) |
+                                                     ButtonBit(RING_5));
+  EXPECT_EQ(stats.executed[h], 3u);
+  EXPECT_EQ(stats.recorded, 3u);
+  EXPECT_EQ(BigramCount(stats, h, h), 1u);
+
+  IBM_Key key;
+  uint8_t flags;
+  ChordStats::Describe(kDefaultLayout, h, key, flags);
+  EXPECT_EQ(key, 'h');
+  EXPECT_EQ(flags, 0);
+  ActionId shifted_h = kDefaultLayout.base_layer.ChordAction(
+      ButtonBit(INDEX_7) | ButtonBit(RING_5) | ButtonBit(LITTLE_6));
+  ChordStats::Describe(kDefaultLayout, shifted_h, key, flags);
+  EXPECT_EQ(key, 'h');
+  EXPECT_EQ(flags, ChordStats::kShifted);
+}
+
+// First action of the layout that types `key` without modifiers.
+static ActionId FindKey(const Layout &layout, IBM_Key key) {
+  for (ActionId id = 1; id < layout.action_count; ++id) {
+    IBM_Key id_key;
+    uint8_t flags;
+    ChordStats::Describe(layout, id, id_key, flags);
+    if (id_key == key && flags == 0) {
+      return id;
+    }
+  }
+  return 0;
+}
+
+TEST(ChordStatsTest, SavedCountsFollowLayoutChanges) {
+  ActionId a = FindKey(kDefaultLayout, 'a');
+  ActionId h = FindKey(kDefaultLayout, 'h');
+  ASSERT_TRUE(a && h);
+  ChordStats stats;
+  stats.Record(h, 0);
+  stats.Record(a, 100000);
+  stats.Record(h, 200000);
+  std::vector<uint8_t> saved = stats.Serialize(kDefaultLayout);
+
+  // Same keys on other chords, with other action IDs
+  static Layout layout;
+  layout.Key('a'); // not started by any chord
+  ActionId new_h = layout.Key('h');
+  ActionId new_a = layout.Key('a');
+  layout.base_layer.chords[1][2][0][0][0] = new_h;
+  layout.base_layer.chords[0][0][1][2][0] = new_a;
+
+  ChordStats loaded;
+  ASSERT_TRUE(loaded.Load(layout, saved.data(), saved.size()));
+  EXPECT_EQ(loaded.executed[new_h], 2u);
+  EXPECT_EQ(loaded.executed[new_a], 1u);
+  EXPECT_EQ(BigramCount(loaded, new_h, new_a), 1u);
+  EXPECT_EQ(BigramCount(loaded, new_a, new_h), 1u);
+  EXPECT_EQ(loaded.Serialize(layout).size(), saved.size());
+
+  EXPECT_FALSE(loaded.Load(layout, saved.data(), saved.size() - 1));
+}
+
+TEST(ChordStatsTest, CollidingActionsKeepTheirCounts) {
+  // Hold & tap of Ctrl - both describe as (KEY_LEFT_CTRL, kArpeggio)
+  ActionId hold = kDefaultLayout.arpeggios[THUMB_1][INDEX_7];
+  ActionId tap = kDefaultLayout.arpeggios[INDEX_7][THUMB_1];
+  ActionId h = FindKey(kDefaultLayout, 'h');
+  ASSERT_TRUE(hold && tap && h && hold != tap);
+  IBM_Key hold_key, tap_key;
+  uint8_t hold_flags, tap_flags;
+  ChordStats::Describe(kDefaultLayout, hold, hold_key, hold_flags);
+  ChordStats::Describe(kDefaultLayout, tap, tap_key, tap_flags);
+  ASSERT_EQ(hold_key, tap_key);
+  ASSERT_EQ(hold_flags, tap_flags);
+
+  ChordStats stats;
+  stats.Record(hold, 0);
+  stats.Record(h, 100000);
+  stats.Record(tap, 200000);
+  stats.Record(tap, 300000);
+  std::vector<uint8_t> saved = stats.Serialize(kDefaultLayout);
+
+  // Same layout (e.g. after a reboot) - nothing is merged
+  ChordStats reloaded;
+  ASSERT_TRUE(reloaded.Load(kDefaultLayout, saved.data(), saved.size()));
+  EXPECT_EQ(reloaded.executed[hold], 1u);
+  EXPECT_EQ(reloaded.executed[tap], 2u);
+  EXPECT_EQ(reloaded.executed[h], 1u);
+  EXPECT_EQ(BigramCount(reloaded, hold, h), 1u);
+  EXPECT_EQ(BigramCount(reloaded, tap, tap), 1u);
+
+  // Changed layout - the ambiguous actions are dropped, the others follow
+  static Layout changed = kDefaultLayout;
+  changed.Key('x');
+  ASSERT_NE(ChordStats::Fingerprint(changed),
+            ChordStats::Fingerprint(kDefaultLayout));
+  ChordStats migrated;
+  ASSERT_TRUE(migrated.Load(changed, saved.data(), saved.size()));
+  EXPECT_EQ(migrated.executed[hold], 0u);
+  EXPECT_EQ(migrated.executed[tap], 0u);
+  EXPECT_EQ(migrated.executed[h], 1u);
+  EXPECT_EQ(BigramCount(migrated, tap, tap), 0u);
+}
+
+TEST(ChordStatsTest, SavesAreBatched) {
+  ChordStats stats;
+  const int64_t minute = 60 * 1000 * 1000;
+  stats.OnSaved(0, 0);
+  EXPECT_FALSE(stats.ShouldSave(60 * minute)); // nothing new
+  for (uint32_t i = 0; i < kChordStatsSaveBatch; ++i) {
+    stats.Record(1, i);
+  }
+  EXPECT_TRUE(stats.ShouldSave(60 * minute));
+  stats.OnSaved(stats.recorded, 61 * minute);
+  stats.Record(1, 0);
+  EXPECT_FALSE(stats.ShouldSave(62 * minute)); // too soon after the last save
+  EXPECT_FALSE(stats.ShouldSave(80 * minute)); // small batch
+  EXPECT_TRUE(stats.ShouldSave(91 * minute));  // but it waited long enough
+  for (uint32_t i = 0; i < kChordStatsSaveBatch; ++i) {
+    stats.Record(1, i);
+  }
+  EXPECT_TRUE(stats.ShouldSave(66 * minute));
+}
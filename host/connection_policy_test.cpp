@@ -0,0 +1,56 @@
+#include "ConnectionPolicy.h"
+#include "host_keyer.h"
+
+#include <gtest/gtest.h>
+
+struct RequestedParams {
+  int64_t time;
+  uint16_t max_interval;
+  bool operator==(const RequestedParams &) const = default;
+};
+
+TEST(ConnectionPolicyTest, FastWhileTypingIdleAfterwards) {
+  SimClock clock;
+  std::vector<RequestedParams> requested;
+  ConnectionPolicy policy(clock, [&](const ConnectionParams &params) {
+    requested.push_back({clock.now, params.max_interval});
+  });
+  policy.idle_micros = 1000000;
+  policy.Setup();
+
+  policy.OnConnected();
+  clock.AdvanceTo(5000000);
+  policy.OnKeyPress();
+  clock.AdvanceTo(5500000);
+  policy.OnKeyPress(); // already fast - nothing requested
+  clock.AdvanceTo(10000000);
+  policy.OnKeyPress();
+  clock.AdvanceTo(20000000);
+
+  EXPECT_EQ(requested, (std::vector<RequestedParams>{
+                           {0, kIdleConnection.max_interval},
+                           {5000000, kTypingConnection.max_interval},
+                           {6500000, kIdleConnection.max_interval},
+                           {10000000, kTypingConnection.max_interval},
+                           {11000000, kIdleConnection.max_interval},
+                       }));
+  // The timer is re-armed once per idle period, not per key press
+  EXPECT_EQ(clock.callback_nanos.size(), 3u);
+}
+
+TEST(ConnectionPolicyTest, ReconnectStartsIdle) {
+  SimClock clock;
+  int requests = 0;
+  ConnectionPolicy policy(clock,
+                          [&](const ConnectionParams &) { ++requests; });
+  policy.Setup();
+  policy.OnKeyPress();
+  policy.OnConnected();
+  EXPECT_FALSE(policy.typing);
+  policy.OnKeyPress();
+  EXPECT_TRUE(policy.typing);
+  EXPECT_EQ(requests, 3);
+
+  policy.OnUpdated(6, 0, 600);
+  EXPECT_EQ(policy.interval, 6);
+}
@@ -0,0 +1,58 @@
+#include "EventRing.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(EventRingTest, FullRingDropsAndCounts) {
+  EventRing<int, 4> ring;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(ring.Push(i));
+  }
+  EXPECT_FALSE(ring.Push(4));
+  EXPECT_FALSE(ring.Push(5));
+  EXPECT_EQ(ring.dropped, 2u);
+  EXPECT_EQ(ring.high_water, 4u);
+
+  int event;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring.Pop(event));
+    EXPECT_EQ(event, i);
+  }
+  EXPECT_FALSE(ring.Pop(event));
+  EXPECT_EQ(ring.Size(), 0u);
+
+  // Indices wrap around
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(ring.Push(i));
+    ASSERT_TRUE(ring.Pop(event));
+    EXPECT_EQ(event, i);
+  }
+  EXPECT_EQ(ring.high_water, 4u);
+}
+
+TEST(EventRingTest, ConcurrentProducerAndConsumer) {
+  EventRing<uint32_t, 64> ring;
+  constexpr uint32_t kEvents = 100000;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < kEvents;) {
+      if (ring.Push(i)) {
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t expected = 0;
+  while (expected < kEvents) {
+    uint32_t event;
+    if (ring.Pop(event)) {
+      ASSERT_EQ(event, expected);
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_LE(ring.high_water, 64u);
+}
@@ -0,0 +1,141 @@
+// Host implementation of the keyer's hardware interfaces (see
+// src/ChordEngine.h).
+//
+// Time is simulated - it only moves when a button event is fed in, and timers
+// fire in deadline order on the way. The HID reports that would be sent over
+// BLE are recorded together with the (simulated) time they were sent at.
+
+#pragma once
+
+#include "ChordEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+struct SimClock;
+
+struct SimTimer : Timer {
+  SimClock &clock;
+  void (*callback)(void *);
+  void *arg;
+  int64_t deadline = -1; // inactive
+
+  SimTimer(SimClock &clock, void (*callback)(void *), void *arg)
+      : clock(clock), callback(callback), arg(arg) {}
+  void Start(int64_t timeout_micros) override;
+  void Stop() override { deadline = -1; }
+  bool IsActive() override { return deadline >= 0; }
+};
+
+struct SimClock : Clock {
+  int64_t now = 0;
+  std::vector<std::unique_ptr<SimTimer>> timers;
+  // Wall time spent in each timer callback (nanoseconds).
+  std::vector<int64_t> callback_nanos;
+
+  int64_t Micros() override { return now; }
+
+  Timer *CreateTimer(const char *, void (*callback)(void *),
+                     void *arg) override {
+    timers.push_back(std::make_unique<SimTimer>(*this, callback, arg));
+    return timers.back().get();
+  }
+
+  // Moves the time forward to `time`, firing the timers that expire on the
+  // way.
+  void AdvanceTo(int64_t time) {
+    while (true) {
+      SimTimer *next = nullptr;
+      for (auto &timer : timers) {
+        if (timer->IsActive() && timer->deadline <= time &&
+            (next == nullptr || timer->deadline < next->deadline)) {
+          next = timer.get();
+        }
+      }
+      if (next == nullptr) {
+        break;
+      }
+      now = next->deadline;
+      next->deadline = -1;
+      auto start = std::chrono::steady_clock::now();
+      next->callback(next->arg);
+      callback_nanos.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+    if (time > now) {
+      now = time;
+    }
+  }
+};
+
+inline void SimTimer::Start(int64_t timeout_micros) {
+  deadline = clock.now + timeout_micros;
+}
+
+// Switch levels implied by the replayed edges.
+struct SimGpio : Gpio {
+  ButtonMask pressed = 0;
+  ButtonMask ReadPressed() override { return pressed; }
+};
+
+struct RecordedReport {
+  int64_t time;
+  KeyReport report;
+
+  bool operator==(const RecordedReport &other) const {
+    return time == other.time && report.modifiers == other.report.modifiers &&
+           std::equal(report.keys, report.keys + 6, other.report.keys);
+  }
+};
+
+// Records every report that would be sent.
+struct ReportRecorder : CoalescingHidSink {
+  Clock &clock;
+  std::vector<RecordedReport> sent;
+
+  ReportRecorder(Clock &clock) : clock(clock) {}
+  void SendReport(const KeyReport &report) override {
+    sent.push_back({clock.Micros(), report});
+  }
+};
+
+// The whole keyer - debouncer, chord engine with the default layout and the
+// simulated hardware.
+struct HostKeyer {
+  SimClock clock;
+  SimGpio gpio;
+  ReportRecorder hid{clock};
+  ChordEngine engine{clock, hid};
+  ButtonDebouncer debouncer;
+  // Wall time spent processing each button edge (nanoseconds).
+  std::vector<int64_t> event_nanos;
+
+  HostKeyer() {
+    debouncer.OnSetup(clock, gpio, [this](Button button, bool down) {
+      if (down) {
+        engine.OnButtonDown(button);
+      } else {
+        engine.OnButtonUp(button);
+      }
+    });
+    engine.Setup();
+  }
+
+  // Same as the interrupt + `loop()` on the device.
+  void Feed(ButtonChange change) {
+    clock.AdvanceTo(change.time);
+    gpio.pressed ^= ButtonBit(change.button);
+    auto start = std::chrono::steady_clock::now();
+    debouncer.OnChange(change.button);
+    event_nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+
+  // Lets the pending timers (debouncer scans) fire.
+  void Finish() { clock.AdvanceTo(clock.now + 1000 * 1000); }
+};
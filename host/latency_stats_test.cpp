@@ -0,0 +1,61 @@
+#include "LatencyStats.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(HistogramTest, PowerOfTwoBuckets) {
+  EXPECT_EQ(Histogram::Bucket(0), 0);
+  EXPECT_EQ(Histogram::Bucket(1), 1);
+  EXPECT_EQ(Histogram::Bucket(2), 2);
+  EXPECT_EQ(Histogram::Bucket(3), 2);
+  EXPECT_EQ(Histogram::Bucket(1000), 10); // [512, 1024)
+  EXPECT_EQ(Histogram::Bucket(UINT32_MAX), Histogram::kBuckets - 1);
+
+  Histogram histogram;
+  EXPECT_EQ(histogram.Quantile(0.5), 0u);
+  for (int i = 0; i < 98; ++i) {
+    histogram.Record(300); // [256, 512)
+  }
+  histogram.Record(5000);  // [4096, 8192)
+  histogram.Record(-1);    // clamped to 0
+  EXPECT_EQ(histogram.Total(), 100u);
+  EXPECT_EQ(histogram.Quantile(0.5), 512u);
+  EXPECT_EQ(histogram.Quantile(0.99), 512u);
+  EXPECT_EQ(histogram.Quantile(1), 8192u);
+}
+
+TEST(LatencyStatsTest, SerializeAndPrint) {
+  LatencyStats stats;
+  stats.edge_to_notify.Record(0x300); // bucket 10
+  stats.edge_to_notify.Record(0x300);
+  stats.edge_queue_depth.Record(1);
+  stats.app_start_to_report.Record(90); // bucket 7
+  stats.reconnect.Record(20);       // bucket 5
+
+  uint8_t out[LatencyStats::kSerializedSize];
+  stats.Serialize(out);
+  EXPECT_EQ(out[0], LatencyStats::kFormatVersion);
+  EXPECT_EQ(out[1], LatencyStats::kHistograms);
+  EXPECT_EQ(out[2], Histogram::kBuckets);
+  auto count = [&](int histogram, int bucket) {
+    const uint8_t *p = out + 3 + (histogram * Histogram::kBuckets + bucket) * 4;
+    return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+  };
+  EXPECT_EQ(count(0, 10), 0);
+  EXPECT_EQ(count(1, 10), 2);
+  EXPECT_EQ(count(2, 1), 1);
+  EXPECT_EQ(count(3, 7), 1);
+  EXPECT_EQ(count(4, 5), 1);
+
+  std::string printed;
+  stats.Print([&](const char *format, auto... args) {
+    char line[128];
+    snprintf(line, sizeof(line), format, args...);
+    printed += line;
+  });
+  EXPECT_NE(printed.find("edge->notify us  n=2 p50<1024"), std::string::npos)
+      << printed;
+  EXPECT_NE(printed.find("app->report ms   n=1 p50<128"), std::string::npos)
+      << printed;
+}
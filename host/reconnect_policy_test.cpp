@@ -0,0 +1,66 @@
+#include "ReconnectPolicy.h"
+#include "host_keyer.h"
+
+#include <gtest/gtest.h>
+
+struct AdvertisingChange {
+  int64_t time;
+  AdvertisingMode mode;
+  bool operator==(const AdvertisingChange &) const = default;
+};
+
+TEST(ReconnectPolicyTest, DirectedThenFastThenSlow) {
+  SimClock clock;
+  std::vector<AdvertisingChange> changes;
+  Histogram reconnect_millis;
+  ReconnectPolicy policy(clock, [&](AdvertisingMode mode) {
+    changes.push_back({clock.now, mode});
+  });
+  policy.reconnect_millis = &reconnect_millis;
+  policy.Setup();
+
+  // Boot without a bonded host
+  policy.OnDisconnected(false);
+  clock.AdvanceTo(2000000);
+  policy.OnConnected();
+  EXPECT_EQ(reconnect_millis.Total(), 0u); // not a reconnection
+
+  // The link drops - the host is tried first
+  clock.AdvanceTo(10000000);
+  policy.OnDisconnected(true);
+  clock.AdvanceTo(60000000);
+  EXPECT_EQ(policy.mode, ADVERTISING_SLOW);
+  EXPECT_EQ(changes, (std::vector<AdvertisingChange>{
+                         {0, ADVERTISING_FAST},
+                         {10000000, ADVERTISING_DIRECTED},
+                         {11280000, ADVERTISING_FAST},
+                         {41280000, ADVERTISING_SLOW},
+                     }));
+
+  policy.OnConnected();
+  EXPECT_EQ(policy.mode, ADVERTISING_OFF);
+  EXPECT_EQ(reconnect_millis.Total(), 1u);
+  EXPECT_EQ(reconnect_millis.Quantile(1), 65536u); // 50 s
+}
+
+TEST(ReconnectPolicyTest, QuickReconnection) {
+  SimClock clock;
+  Histogram reconnect_millis;
+  int advertised = 0;
+  ReconnectPolicy policy(clock, [&](AdvertisingMode) { ++advertised; });
+  policy.reconnect_millis = &reconnect_millis;
+  policy.Setup();
+  policy.OnDisconnected(true);
+  policy.OnConnected();
+
+  clock.AdvanceTo(5000000);
+  policy.OnDisconnected(true);
+  // A failed attempt (pairing didn't complete) doesn't restart the clock
+  clock.AdvanceTo(5010000);
+  policy.OnDisconnected(true);
+  clock.AdvanceTo(5030000);
+  policy.OnConnected();
+  clock.AdvanceTo(60000000);
+  EXPECT_EQ(advertised, 3);
+  EXPECT_EQ(reconnect_millis.Quantile(1), 32u); // 30 ms
+}
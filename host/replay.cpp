@@ -0,0 +1,178 @@
+// Replays a button trace through the chord engine and prints the HID reports
+// it sends.
+//
+// Usage: ./replay [--expect REPORTS] [--repeat N] [--stats] TRACE
+//
+// TRACE has one button edge per line: "<time in us> <button>", where the
+// button is a number (0-9) or its name (e.g. INDEX_3). Lines starting with #
+// are ignored.
+//
+// Every report is printed as "<time in us> <modifiers> <6 keys>" (bytes in
+// hex). With --expect, the reports are compared to the ones in the given file
+// (same format) and the exit code tells whether they match. --stats prints the
+// time spent processing each button edge & timer callback, --repeat replays
+// the trace N times to get more samples.
+
+#include "host_keyer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static bool ParseButton(const std::string &name, Button &button) {
+  for (int i = 0; i < NUM_BUTTONS; ++i) {
+    if (name == ButtonToStr(i) || name == std::to_string(i)) {
+      button = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool LoadTrace(const char *path, std::vector<ButtonChange> &trace) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  std::string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    long long time;
+    std::string name;
+    Button button;
+    if (!(fields >> time >> name) || !ParseButton(name, button)) {
+      fprintf(stderr, "%s:%d: expected \"<time> <button>\"\n", path,
+              line_number);
+      return false;
+    }
+    trace.push_back(ButtonChange{button, time});
+  }
+  return true;
+}
+
+static std::string FormatReport(const RecordedReport &sent) {
+  char buf[64];
+  const uint8_t *keys = sent.report.keys;
+  snprintf(buf, sizeof(buf), "%lld %02x %02x %02x %02x %02x %02x %02x",
+           (long long)sent.time, sent.report.modifiers, keys[0], keys[1],
+           keys[2], keys[3], keys[4], keys[5]);
+  return buf;
+}
+
+static bool LoadReports(const char *path, std::vector<std::string> &reports) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line[0] != '#') {
+      reports.push_back(line);
+    }
+  }
+  return true;
+}
+
+static void PrintStats(const char *name, std::vector<int64_t> nanos) {
+  if (nanos.empty()) {
+    return;
+  }
+  std::sort(nanos.begin(), nanos.end());
+  auto percentile = [&](double p) {
+    return (long long)nanos[std::min(nanos.size() - 1,
+                                     size_t(p * (nanos.size() - 1) + 0.5))];
+  };
+  fprintf(stderr,
+          "%-16s %8zu samples  min %6lld ns  median %6lld ns  p99 %6lld ns  "
+          "max %6lld ns\n",
+          name, nanos.size(), (long long)nanos.front(), percentile(0.5),
+          percentile(0.99), (long long)nanos.back());
+}
+
+int main(int argc, char **argv) {
+  const char *trace_path = nullptr;
+  const char *expect_path = nullptr;
+  int repeat = 1;
+  bool stats = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc) {
+      expect_path = argv[++i];
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (trace_path == nullptr) {
+      trace_path = argv[i];
+    } else {
+      trace_path = nullptr;
+      break;
+    }
+  }
+  if (trace_path == nullptr) {
+    fprintf(stderr,
+            "Usage: %s [--expect REPORTS] [--repeat N] [--stats] TRACE\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::vector<ButtonChange> trace;
+  if (!LoadTrace(trace_path, trace)) {
+    return 2;
+  }
+
+  std::vector<std::string> reports;
+  std::vector<int64_t> event_nanos, callback_nanos;
+  for (int r = 0; r < repeat; ++r) {
+    HostKeyer keyer;
+    for (const ButtonChange &change : trace) {
+      keyer.Feed(change);
+    }
+    keyer.Finish();
+    event_nanos.insert(event_nanos.end(), keyer.event_nanos.begin(),
+                       keyer.event_nanos.end());
+    callback_nanos.insert(callback_nanos.end(),
+                          keyer.clock.callback_nanos.begin(),
+                          keyer.clock.callback_nanos.end());
+    if (r == 0) {
+      for (const RecordedReport &sent : keyer.hid.sent) {
+        reports.push_back(FormatReport(sent));
+      }
+    }
+  }
+
+  if (stats) {
+    PrintStats("button edges", event_nanos);
+    PrintStats("timer callbacks", callback_nanos);
+  }
+
+  if (expect_path == nullptr) {
+    for (const std::string &report : reports) {
+      printf("%s\n", report.c_str());
+    }
+    return 0;
+  }
+  std::vector<std::string> expected;
+  if (!LoadReports(expect_path, expected)) {
+    return 2;
+  }
+  for (size_t i = 0; i < std::max(reports.size(), expected.size()); ++i) {
+    const char *got = i < reports.size() ? reports[i].c_str() : "(none)";
+    const char *want = i < expected.size() ? expected[i].c_str() : "(none)";
+    if (strcmp(got, want) != 0) {
+      fprintf(stderr, "Report %zu: expected \"%s\", got \"%s\"\n", i + 1, want,
+              got);
+      return 1;
+    }
+  }
+  printf("%zu reports match %s\n", reports.size(), expect_path);
+  return 0;
+}
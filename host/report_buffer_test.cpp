@@ -0,0 +1,42 @@
+#include "ReportBuffer.h"
+
+#include <gtest/gtest.h>
+
+static KeyReport Report(uint8_t key) { return {0, 0, {key, 0, 0, 0, 0, 0}}; }
+
+TEST(ReportBufferTest, KeepsOrderAndExpires) {
+  ReportBuffer buffer;
+  buffer.expiry_micros = 1000000;
+  buffer.Push(Report(4), 0);
+  buffer.Push(Report(0), 100000);
+  buffer.Push(Report(5), 800000);
+  buffer.Push(Report(0), 900000);
+
+  KeyReport report;
+  // The first keystroke is too old by now
+  ASSERT_TRUE(buffer.Pop(report, 1150000));
+  EXPECT_EQ(report.keys[0], 5);
+  EXPECT_EQ(buffer.expired, 2u);
+  ASSERT_TRUE(buffer.Pop(report, 1150000));
+  EXPECT_EQ(report.keys[0], 0);
+  EXPECT_FALSE(buffer.Pop(report, 1150000));
+
+  buffer.Push(Report(6), 5000000);
+  buffer.Expire(6000001);
+  EXPECT_TRUE(buffer.Empty());
+}
+
+TEST(ReportBufferTest, FullBufferKeepsTheFinalState) {
+  ReportBuffer buffer;
+  for (size_t i = 0; i < ReportBuffer::kCapacity + 10; ++i) {
+    buffer.Push(Report(i % 2 ? 0 : 4 + i % 20), i);
+  }
+  EXPECT_EQ(buffer.Size(), ReportBuffer::kCapacity);
+  EXPECT_EQ(buffer.overwritten, 10u);
+
+  KeyReport report;
+  for (size_t i = 0; i < ReportBuffer::kCapacity; ++i) {
+    ASSERT_TRUE(buffer.Pop(report, 1000));
+  }
+  EXPECT_EQ(report.keys[0], 0); // all keys released
+}
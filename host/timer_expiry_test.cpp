@@ -0,0 +1,80 @@
+#include "TimerExpiry.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(TimerExpiryTest, FiresOnce) {
+  TimerExpiry expiry;
+  EXPECT_FALSE(expiry.IsActive());
+  expiry.Arm(100);
+  EXPECT_TRUE(expiry.IsActive());
+  EXPECT_FALSE(expiry.TakeExpired(100)); // not reported yet
+
+  expiry.Expire();
+  EXPECT_TRUE(expiry.IsActive()); // callback still pending
+  EXPECT_TRUE(expiry.TakeExpired(100));
+  EXPECT_FALSE(expiry.IsActive());
+  EXPECT_FALSE(expiry.TakeExpired(200));
+}
+
+TEST(TimerExpiryTest, StopWhileExpiryPending) {
+  TimerExpiry expiry;
+  expiry.Arm(100);
+  expiry.Expire(); // dispatched before the stop
+  expiry.Disarm();
+  EXPECT_FALSE(expiry.IsActive());
+  EXPECT_FALSE(expiry.TakeExpired(200));
+}
+
+TEST(TimerExpiryTest, ExpiryDispatchedAfterStop) {
+  TimerExpiry expiry;
+  expiry.Arm(100);
+  expiry.Disarm();
+  expiry.Expire(); // esp_timer_stop raced with the dispatch
+  EXPECT_FALSE(expiry.TakeExpired(200));
+}
+
+TEST(TimerExpiryTest, RestartWhileExpiryPending) {
+  TimerExpiry expiry;
+  expiry.Arm(100);
+  expiry.Expire();
+  expiry.Arm(300);
+  EXPECT_FALSE(expiry.TakeExpired(150)); // belongs to the first generation
+  EXPECT_TRUE(expiry.IsActive());
+
+  expiry.Expire();
+  EXPECT_TRUE(expiry.TakeExpired(300));
+}
+
+TEST(TimerExpiryTest, LateDispatchSeesRestart) {
+  TimerExpiry expiry;
+  expiry.Arm(100);
+  expiry.Arm(300);
+  expiry.Expire(); // the first expiration read the new generation
+  EXPECT_FALSE(expiry.TakeExpired(150));
+  EXPECT_TRUE(expiry.IsActive());
+
+  expiry.Expire();
+  EXPECT_TRUE(expiry.TakeExpired(300));
+}
+
+TEST(TimerExpiryTest, ConcurrentStops) {
+  // Expirations from another thread never fire a stopped timer.
+  TimerExpiry expiry;
+  std::atomic<bool> done{false};
+  std::thread dispatcher([&] {
+    while (!done) {
+      expiry.Expire();
+    }
+  });
+  int fired = 0;
+  for (int i = 0; i < 100000; ++i) {
+    expiry.Arm(i);
+    expiry.Disarm();
+    fired += expiry.TakeExpired(i);
+  }
+  done = true;
+  dispatcher.join();
+  EXPECT_EQ(fired, 0);
+}
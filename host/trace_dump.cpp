@@ -0,0 +1,141 @@
+// Decodes a trace dump of the keyboard (see src/TraceRecorder.h) into a
+// timeline.
+//
+// Usage: ./trace_dump [--replay] DUMP
+//
+// Every event is printed as "<time in us> <+us since the previous event>
+// <event>". Actions are described with the default layout, so the dump should
+// come from firmware built with the same Layout.cpp. With --replay, only the
+// interrupt edges are printed, in the TRACE format of ./replay, which runs
+// them through the debouncer & engine on the PC (the buttons should be
+// released at the start of the dump).
+
+#include "ChordStats.h"
+#include "TraceRecorder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+static std::string ButtonsToStr(ButtonMask buttons) {
+  std::string names;
+  for (Button i = 0; i < NUM_BUTTONS; ++i) {
+    if (buttons & ButtonBit(i)) {
+      if (!names.empty()) {
+        names += '+';
+      }
+      names += ButtonToStr(i);
+    }
+  }
+  return names.empty() ? "-" : names;
+}
+
+static const char *DecisionToStr(uint8_t decision) {
+  switch (decision) {
+  case DECISION_UNIQUE:
+    return "UNIQUE";
+  case DECISION_ARPEGGIO:
+    return "ARPEGGIO";
+  case DECISION_CHORD:
+    return "CHORD";
+  case DECISION_AUTOSTART:
+    return "AUTOSTART";
+  case DECISION_NO_CHORD:
+    return "NO_CHORD";
+  }
+  return "?";
+}
+
+static std::string FormatEvent(const TraceEvent &event) {
+  char buf[128];
+  const uint8_t *data = event.data;
+  switch (event.type) {
+  case TRACE_EDGE:
+    snprintf(buf, sizeof(buf), "edge      %s", ButtonToStr(event.arg));
+    break;
+  case TRACE_DEBOUNCED:
+    snprintf(buf, sizeof(buf), "debounced %s %s", ButtonToStr(event.arg),
+             data[0] ? "down" : "up");
+    break;
+  case TRACE_DECISION: {
+    ActionId id = data[0] | data[1] << 8;
+    ButtonMask buttons = data[2] | data[3] << 8;
+    std::string action = "-";
+    if (id && id < kDefaultLayout.action_count) {
+      IBM_Key key;
+      uint8_t flags;
+      ChordStats::Describe(kDefaultLayout, id, key, flags);
+      action = std::string(IBM_KeyToStr(key)) + " (action " +
+               std::to_string(id) + ")";
+      if (flags & ChordStats::kShifted) {
+        action = "Shift+" + action;
+      }
+    }
+    snprintf(buf, sizeof(buf), "%-9s %s %s", DecisionToStr(event.arg),
+             ButtonsToStr(buttons).c_str(), action.c_str());
+    break;
+  }
+  case TRACE_REPORT:
+    snprintf(buf, sizeof(buf), "report    %02x %02x %02x %02x %02x %02x %02x",
+             event.arg, data[0], data[1], data[2], data[3], data[4], data[5]);
+    break;
+  default:
+    snprintf(buf, sizeof(buf), "unknown event %d", event.type);
+    break;
+  }
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  const char *dump_path = nullptr;
+  bool replay = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--replay") == 0) {
+      replay = true;
+    } else if (dump_path == nullptr) {
+      dump_path = argv[i];
+    } else {
+      dump_path = nullptr;
+      break;
+    }
+  }
+  if (dump_path == nullptr) {
+    fprintf(stderr, "Usage: %s [--replay] DUMP\n", argv[0]);
+    return 2;
+  }
+
+  std::ifstream file(dump_path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Can't open %s\n", dump_path);
+    return 2;
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  std::vector<TraceEvent> events;
+  uint32_t recorded;
+  if (!TraceRecorder::ParseDump(data.data(), data.size(), events, recorded)) {
+    fprintf(stderr, "%s isn't a trace dump\n", dump_path);
+    return 2;
+  }
+
+  if (replay) {
+    printf("# Button edges from %s\n", dump_path);
+    for (const TraceEvent &event : events) {
+      if (event.type == TRACE_EDGE) {
+        printf("%lld %s\n", (long long)event.time, ButtonToStr(event.arg));
+      }
+    }
+    return 0;
+  }
+  printf("# %zu events (%u recorded since boot)\n", events.size(),
+         (unsigned)recorded);
+  int64_t previous = events.empty() ? 0 : events[0].time;
+  for (const TraceEvent &event : events) {
+    printf("%12lld %+9lld  %s\n", (long long)event.time,
+           (long long)(event.time - previous), FormatEvent(event).c_str());
+    previous = event.time;
+  }
+  return 0;
+}
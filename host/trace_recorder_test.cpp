@@ -0,0 +1,64 @@
+#include "TraceRecorder.h"
+#include "host_keyer.h"
+
+#include <gtest/gtest.h>
+
+TEST(TraceRecorderTest, RecordsEngineDecisions) {
+  TraceEvent buffer[64];
+  TraceRecorder trace;
+  trace.Attach(buffer, 64);
+  HostKeyer keyer;
+  keyer.engine.trace = &trace;
+  keyer.Feed({INDEX_7, 1000000});
+  keyer.Feed({RING_5, 1010000});
+  keyer.Feed({INDEX_7, 1060000});
+  keyer.Feed({RING_5, 1070000});
+  keyer.Finish();
+
+  ASSERT_EQ(trace.written, 1u);
+  const TraceEvent &event = buffer[0];
+  EXPECT_EQ(event.type, TRACE_DECISION);
+  EXPECT_EQ(event.arg, DECISION_CHORD);
+  EXPECT_EQ(event.time, 1060000);
+  ActionId h = kDefaultLayout.base_layer.ChordAction(ButtonBit(INDEX_7) |
+                                                     ButtonBit(RING_5));
+  EXPECT_EQ(event.data[0] | event.data[1] << 8, h);
+  EXPECT_EQ(event.data[2] | event.data[3] << 8,
+            ButtonBit(INDEX_7) | ButtonBit(RING_5));
+}
+
+TEST(TraceRecorderTest, DumpsTheNewestEvents) {
+  TraceEvent buffer[8];
+  TraceRecorder trace;
+  trace.Attach(buffer, 8);
+  for (int i = 0; i < 20; ++i) {
+    trace.Edge(i * 1000, i % NUM_BUTTONS);
+  }
+  trace.Report(20000, {2, 0, {4, 5, 0, 0, 0, 0}});
+
+  trace.Pause();
+  trace.Edge(30000, THUMB_0); // ignored while paused
+  std::vector<uint8_t> dump;
+  uint8_t chunk[37];
+  while (size_t size = trace.ReadDump(dump.size(), chunk, sizeof(chunk))) {
+    dump.insert(dump.end(), chunk, chunk + size);
+  }
+  EXPECT_EQ(dump.size(), trace.DumpSize());
+  trace.Resume();
+
+  std::vector<TraceEvent> events;
+  uint32_t recorded;
+  ASSERT_TRUE(TraceRecorder::ParseDump(dump.data(), dump.size(), events,
+                                       recorded));
+  EXPECT_EQ(recorded, 21u);
+  ASSERT_EQ(events.size(), 7u);
+  EXPECT_EQ(events[0].type, TRACE_EDGE);
+  EXPECT_EQ(events[0].time, 14000);
+  EXPECT_EQ(events[0].arg, 4);
+  EXPECT_EQ(events[6].type, TRACE_REPORT);
+  EXPECT_EQ(events[6].arg, 2);
+  EXPECT_EQ(events[6].data[1], 5);
+
+  EXPECT_FALSE(TraceRecorder::ParseDump(dump.data(), dump.size() - 1, events,
+                                        recorded));
+}
@@ -0,0 +1,119 @@
+// Dense alphabet for the simulator.
+//
+// Corpora are UTF-8 but the simulator wants to index its tables with small
+// integers. An `Alphabet` assigns each code point that matters a dense ID
+// (0..255) and `encode` turns the text into a sequence of those IDs. The
+// tables indexed by IDs only have as many entries as there are distinct
+// characters (usually 64-128) and non-ASCII characters cost the same as
+// ASCII ones.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using SymbolId = uint8_t;
+constexpr int MAX_SYMBOLS = 256;
+
+// ID shared by all the characters that are not in the alphabet.
+constexpr SymbolId OTHER_SYMBOL = 0;
+
+// Used for bytes that are not valid UTF-8.
+constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+// Decodes the first code point of `text` and removes it from `text`.
+inline char32_t decode_utf8(std::string_view &text) {
+  unsigned char lead = text[0];
+  int length = lead < 0x80           ? 1
+               : (lead >> 5) == 0x6  ? 2
+               : (lead >> 4) == 0xE  ? 3
+               : (lead >> 3) == 0x1E ? 4
+                                     : 0;
+  if (length == 0 || static_cast<size_t>(length) > text.size()) {
+    text.remove_prefix(1);
+    return REPLACEMENT_CHARACTER;
+  }
+  char32_t code_point = length == 1 ? lead : lead & (0x7F >> length);
+  for (int i = 1; i < length; ++i) {
+    unsigned char continuation = text[i];
+    if ((continuation >> 6) != 0x2) {
+      text.remove_prefix(1);
+      return REPLACEMENT_CHARACTER;
+    }
+    code_point = (code_point << 6) | (continuation & 0x3F);
+  }
+  text.remove_prefix(length);
+  return code_point;
+}
+
+struct Alphabet {
+  // Indexed by ID. Entry 0 (OTHER_SYMBOL) doesn't correspond to any character.
+  std::vector<char32_t> code_points = {0};
+
+  // Adds `code_point` to the alphabet (if it's not there yet) and returns its
+  // ID. Returns OTHER_SYMBOL if the alphabet is full.
+  SymbolId add(char32_t code_point) {
+    SymbolId id = find(code_point);
+    if (id != OTHER_SYMBOL || code_points.size() >= MAX_SYMBOLS) {
+      return id;
+    }
+    id = code_points.size();
+    code_points.push_back(code_point);
+    if (code_point < 128) {
+      ascii[code_point] = id;
+    } else {
+      others[code_point] = id;
+    }
+    return id;
+  }
+
+  SymbolId find(char32_t code_point) const {
+    if (code_point < 128) {
+      return ascii[code_point];
+    }
+    auto it = others.find(code_point);
+    return it == others.end() ? OTHER_SYMBOL : it->second;
+  }
+
+  int size() const { return code_points.size(); }
+
+private:
+  SymbolId ascii[128] = {};
+  std::unordered_map<char32_t, SymbolId> others;
+};
+
+// Alphabet of all the characters in `text`, most frequent first. If there are
+// more than 255 distinct characters, the rarest ones become OTHER_SYMBOL.
+inline Alphabet corpus_alphabet(std::string_view text) {
+  std::unordered_map<char32_t, uint64_t> counts;
+  while (!text.empty()) {
+    ++counts[decode_utf8(text)];
+  }
+  std::vector<std::pair<uint64_t, char32_t>> by_frequency;
+  for (auto [code_point, count] : counts) {
+    by_frequency.push_back({count, code_point});
+  }
+  std::sort(by_frequency.begin(), by_frequency.end(),
+            [](const auto &a, const auto &b) {
+              return a.first != b.first ? a.first > b.first
+                                        : a.second < b.second;
+            });
+  Alphabet alphabet;
+  for (auto [count, code_point] : by_frequency) {
+    alphabet.add(code_point);
+  }
+  return alphabet;
+}
+
+inline std::vector<SymbolId> encode(std::string_view text,
+                                    const Alphabet &alphabet) {
+  std::vector<SymbolId> ids;
+  ids.reserve(text.size());
+  while (!text.empty()) {
+    ids.push_back(alphabet.find(decode_utf8(text)));
+  }
+  return ids;
+}
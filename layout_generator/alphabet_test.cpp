@@ -0,0 +1,61 @@
+#include "alphabet.cpp"
+#include "fingers.cpp"
+
+#include <gtest/gtest.h>
+
+TEST(AlphabetTest, DecodeUtf8) {
+  std::string_view text = "a\xC5\x82\xE2\x82\xAC\xF0\x9F\x8E\xB9\xFF";
+  EXPECT_EQ(decode_utf8(text), U'a');
+  EXPECT_EQ(decode_utf8(text), U'ł');
+  EXPECT_EQ(decode_utf8(text), U'€');
+  EXPECT_EQ(decode_utf8(text), U'🎹');
+  EXPECT_EQ(decode_utf8(text), REPLACEMENT_CHARACTER);
+  EXPECT_TRUE(text.empty());
+
+  // Truncated sequence
+  text = "\xC5";
+  EXPECT_EQ(decode_utf8(text), REPLACEMENT_CHARACTER);
+  EXPECT_TRUE(text.empty());
+}
+
+TEST(AlphabetTest, MostFrequentFirst) {
+  Alphabet alphabet = corpus_alphabet("bąąb ą");
+  ASSERT_EQ(alphabet.size(), 4);
+  EXPECT_EQ(alphabet.code_points[1], U'ą');
+  EXPECT_EQ(alphabet.code_points[2], U'b');
+  EXPECT_EQ(alphabet.code_points[3], U' ');
+  EXPECT_EQ(encode("ąbx", alphabet),
+            (std::vector<SymbolId>{1, 2, OTHER_SYMBOL}));
+}
+
+TEST(AlphabetTest, FullAlphabet) {
+  Alphabet alphabet;
+  for (char32_t code_point = 0x100; code_point < 0x300; ++code_point) {
+    alphabet.add(code_point);
+  }
+  EXPECT_EQ(alphabet.size(), MAX_SYMBOLS);
+  EXPECT_EQ(alphabet.add(U'a'), OTHER_SYMBOL);
+  EXPECT_EQ(alphabet.find(0x100), 1);
+}
+
+TEST(AlphabetTest, DenseIdsScoreLikeBytes) {
+  std::vector<Fingers> byte_map[256];
+  byte_map['a'].push_back(Fingers::FromChord("0100"));
+  byte_map['b'].push_back(Fingers::FromChord("0110"));
+  byte_map['c'].push_back(Fingers::FromChord("2000"));
+  const char *text = "abcab cba\ncc";
+
+  Alphabet alphabet = corpus_alphabet(text);
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  for (char c : {'a', 'b', 'c'}) {
+    key_map[alphabet.find(c)] = byte_map[static_cast<unsigned char>(c)];
+  }
+  std::vector<SymbolId> ids = encode(text, alphabet);
+  EXPECT_EQ(type_symbols(ids.data(), ids.size(), key_map),
+            type_text(text, byte_map));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
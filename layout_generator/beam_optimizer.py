@@ -4,16 +4,23 @@ Beam search optimizer for chording keyboard layouts.
 
 Uses beam search to explore the layout space, keeping the top N candidates
 at each iteration.
+
+With --daemon the candidates are scored by a running scoring_daemon.py, which
+keeps the corpus loaded and remembers the costs of layouts it has seen.
 """
 
+import argparse
 import glob
 from typing import Dict, Set
 from multiprocessing import Pool, cpu_count
 
+from chord_stats import CHORD_STATS_SUFFIX, load_chord_stats
 from qwerty_analysis import QwertyKeys
 import keyer_simulator_native
+from compare_layouts import print_comparison
 from layout import load_layout, save_layout
 from mutator import mutate_layout
+from scoring_daemon import ScoringClient, add_daemon_argument
 
 
 def load_corpus(pattern: str = "corpus/*", qwerty_compatible: bool = True) -> str:
@@ -31,6 +38,10 @@ def load_corpus(pattern: str = "corpus/*", qwerty_compatible: bool = True) -> st
     files = glob.glob(pattern, recursive=True)
 
     for filepath in files:
+        if filepath.endswith(CHORD_STATS_SUFFIX):
+            # Already in QWERTY symbols
+            corpus.append(load_chord_stats(filepath))
+            continue
         try:
             with open(filepath, "r", encoding="utf-8", errors="ignore") as f:
                 content = f.read()
@@ -108,6 +119,10 @@ def get_layout_hash(layout: Dict[str, str]) -> str:
 
 def main():
     """Main beam search optimization."""
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    add_daemon_argument(parser)
+    args = parser.parse_args()
+
     print("Chording Keyboard Layout Beam Optimizer")
     print("=" * 60)
 
@@ -138,19 +153,48 @@ def main():
     # Beam search parameters
     beam_width = 1000
     max_iterations = 5000
+    # Fraction of the corpus used to score the candidates (see build_coreset in
+    # keyer_simulator.cpp). 0 scores them on the full corpus. New bests are
+    # always re-scored on the full corpus before they're saved.
+    coreset_ratio = 0
+    # The daemon only knows the full corpus
+    if args.daemon and coreset_ratio:
+        parser.error("--daemon scores on the full corpus, set coreset_ratio = 0")
 
     print("\n" + "=" * 60)
     print("Running beam search optimization...")
     print(f"Beam width: {beam_width}, Max iterations: {max_iterations}")
 
     num_workers = cpu_count()
-    print(f"Parallel workers: {num_workers} cores")
+    client = None
+    if args.daemon:
+        client = ScoringClient(args.daemon)
+        print(f"Scoring on the daemon at {args.daemon}")
+    else:
+        print(f"Parallel workers: {num_workers} cores")
+
+    # Encoded once so that the workers don't have to decode UTF-8 every time
+    compiled_corpus = keyer_simulator_native.compile_corpus(corpus)
+    scoring_corpus = compiled_corpus
+    search_score = initial_score
+    if coreset_ratio:
+        key_map = {char: [chord] for char, chord in initial_layout.items()}
+        scoring_corpus, report = keyer_simulator_native.build_coreset(
+            key_map, compiled_corpus, ratio=coreset_ratio
+        )
+        print(
+            f"Coreset: {report['size']} characters, rank correlation "
+            f"{report['neighbour_correlation']:.4f} (neighbours) / "
+            f"{report['random_correlation']:.4f} (random), mean error "
+            f"{report['mean_relative_error'] * 100:.2f}%"
+        )
+        search_score = evaluate_layout(initial_layout, scoring_corpus)
 
     # Initialize beam with the initial layout
-    beam = [(initial_layout, initial_score)]
+    beam = [(initial_layout, search_score)]
 
     global_best_layout = initial_layout
-    global_best_score = initial_score
+    global_best_score = search_score
 
     visited_layouts: Set[str] = set()
     visited_layouts.add(get_layout_hash(initial_layout))
@@ -185,24 +229,26 @@ def main():
             print(f"No new candidates found at iteration {iteration + 1}")
             break
 
-        # Prepare arguments for parallel evaluation
-        eval_args = [(variant, corpus) for variant in new_variants]
-
         # Evaluate variants in parallel
         all_candidates = []
-        total_variants = len(eval_args)
-        with Pool(processes=num_workers) as pool:
-            for idx, (variant, score) in enumerate(
-                pool.imap_unordered(evaluate_layout_wrapper, eval_args), 1
-            ):
-                all_candidates.append((variant, score))
-                # Update progress in-place
-                print(
-                    f"\r  Evaluating: {idx}/{total_variants} ({100 * idx // total_variants}%)",
-                    end="",
-                    flush=True,
-                )
-        print()  # Newline after progress complete
+        if client:
+            print(f"  Evaluating: {len(new_variants)} on the daemon")
+            all_candidates = list(zip(new_variants, client.score(new_variants)))
+        else:
+            eval_args = [(variant, scoring_corpus) for variant in new_variants]
+            total_variants = len(eval_args)
+            with Pool(processes=num_workers) as pool:
+                for idx, (variant, score) in enumerate(
+                    pool.imap_unordered(evaluate_layout_wrapper, eval_args), 1
+                ):
+                    all_candidates.append((variant, score))
+                    # Update progress in-place
+                    print(
+                        f"\r  Evaluating: {idx}/{total_variants} ({100 * idx // total_variants}%)",
+                        end="",
+                        flush=True,
+                    )
+            print()  # Newline after progress complete
 
         # Sort all candidates by score
         all_candidates.sort(key=lambda x: x[1])
@@ -219,13 +265,18 @@ def main():
             )
 
             # Save immediately
+            full_score = global_best_score
+            if coreset_ratio:
+                full_score = evaluate_layout(global_best_layout, compiled_corpus)
+                print(f"  Full corpus score: {full_score:.1f}ms")
             save_layout(
                 layout=global_best_layout,
-                score=global_best_score,
+                score=full_score,
                 corpus_length=len(corpus),
                 generation=iteration + 1,
                 filepath="beam_best.txt",
             )
+            print_comparison(initial_layout, global_best_layout, compiled_corpus, top=5)
 
         print(
             f"Iteration {iteration + 1}: Evaluated {len(all_candidates)} candidates, "
@@ -233,7 +284,7 @@ def main():
         )
 
     best_layout = global_best_layout
-    best_score = global_best_score
+    best_score = evaluate_layout(best_layout, compiled_corpus)
 
     # Print results
     print("\n" + "=" * 60)
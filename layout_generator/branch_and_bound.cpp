@@ -0,0 +1,400 @@
+// Exact search over the chords of the most frequent characters.
+//
+// A handful of characters (space, e, t, a, ...) account for most of the
+// layout cost. With the rest of the layout held in place, branch and bound can
+// try every assignment of chords to those characters and prove which one is
+// optimal (for the bigram QAP cost from qap.cpp).
+//
+// Characters are assigned in order of frequency. The lower bound of a partial
+// assignment is the exact cost of the assigned part plus a Gilmore-Lawler
+// bound for the rest: every unassigned character is charged its interactions
+// with the fixed & assigned characters exactly and its interactions with the
+// other unassigned characters at the cheapest transition from its chord. A
+// linear assignment over these charges keeps unassigned characters on distinct
+// chords.
+
+#pragma once
+
+#include "qap.cpp"
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+struct BranchAndBoundOptions {
+  // 0 = one thread per core
+  int threads = 0;
+  // Stop after this many seconds (0 = run until optimality is proven).
+  double time_limit_s = 0;
+};
+
+struct BranchAndBoundResult {
+  // Best solution found. Equal to the initial one if nothing better exists.
+  QapSolution best;
+  // False if the search was stopped by the time limit.
+  bool proven_optimal = false;
+  uint64_t nodes = 0;
+};
+
+// Minimum cost assignment of rows to distinct columns (rows <= columns).
+// Hungarian algorithm with potentials, O(rows^2 * columns).
+static int64_t linear_assignment(const std::vector<int64_t> &cost, int rows,
+                                 int columns) {
+  if (rows == 0) {
+    return 0;
+  }
+  constexpr int64_t INF = INT64_MAX / 4;
+  std::vector<int64_t> u(rows + 1), v(columns + 1), min_slack(columns + 1);
+  std::vector<int> row_of(columns + 1), way(columns + 1);
+  std::vector<bool> used(columns + 1);
+  for (int row = 1; row <= rows; ++row) {
+    row_of[0] = row;
+    int column = 0;
+    std::fill(min_slack.begin(), min_slack.end(), INF);
+    std::fill(used.begin(), used.end(), false);
+    do {
+      used[column] = true;
+      int current_row = row_of[column], next = 0;
+      int64_t delta = INF;
+      for (int j = 1; j <= columns; ++j) {
+        if (used[j]) {
+          continue;
+        }
+        int64_t slack = cost[(current_row - 1) * columns + j - 1] -
+                        u[current_row] - v[j];
+        if (slack < min_slack[j]) {
+          min_slack[j] = slack;
+          way[j] = column;
+        }
+        if (min_slack[j] < delta) {
+          delta = min_slack[j];
+          next = j;
+        }
+      }
+      for (int j = 0; j <= columns; ++j) {
+        if (used[j]) {
+          u[row_of[j]] += delta;
+          v[j] -= delta;
+        } else {
+          min_slack[j] -= delta;
+        }
+      }
+      column = next;
+    } while (row_of[column] != 0);
+    do {
+      int previous = way[column];
+      row_of[column] = row_of[previous];
+      column = previous;
+    } while (column);
+  }
+  return -v[0];
+}
+
+class BranchAndBound {
+public:
+  // `core` lists the symbols to enumerate. All other symbols stay where they
+  // are in `initial`.
+  BranchAndBound(const QapProblem &problem, const std::vector<int> &initial,
+                 const std::vector<int> &core)
+      : problem(problem), initial(initial), core(core), k(core.size()) {
+    const TransitionTable &t = problem.transitions;
+    std::vector<bool> in_core(problem.num_symbols());
+    for (int s : core) {
+      in_core[s] = true;
+    }
+    std::vector<bool> taken(problem.num_locations());
+    for (int s = 0; s < problem.num_symbols(); ++s) {
+      if (!in_core[s]) {
+        taken[initial[s]] = true;
+      }
+    }
+    for (int l = 0; l < problem.num_locations(); ++l) {
+      if (!taken[l]) {
+        free_locations.push_back(l);
+      }
+    }
+    m = free_locations.size();
+
+    // Cheapest transition out of each free location into another one
+    min_out.resize(m, UINT32_MAX);
+    for (int a = 0; a < m; ++a) {
+      for (int b = 0; b < m; ++b) {
+        if (a != b) {
+          min_out[a] = std::min(min_out[a],
+                                t(free_locations[a], free_locations[b]));
+        }
+      }
+      if (m == 1) {
+        min_out[a] = 0;
+      }
+    }
+
+    // Everything that depends on a single core symbol's location
+    linear.resize(k * m);
+    for (int i = 0; i < k; ++i) {
+      int u = core[i];
+      for (int a = 0; a < m; ++a) {
+        int l = free_locations[a];
+        int64_t cost = problem.counts.start[u] * t.from_rest[l] +
+                       problem.counts(u, u) * t(l, l);
+        for (int s = 0; s < problem.num_symbols(); ++s) {
+          if (!in_core[s]) {
+            cost += problem.counts(u, s) * t(l, initial[s]) +
+                    problem.counts(s, u) * t(initial[s], l);
+          }
+        }
+        linear[i * m + a] = cost;
+      }
+    }
+    weight.resize(k * k);
+    for (int i = 0; i < k; ++i) {
+      for (int j = 0; j < k; ++j) {
+        weight[i * k + j] = i == j ? 0 : problem.counts(core[i], core[j]);
+      }
+    }
+
+    // Cost of the non-core part = total - core part
+    std::vector<int> initial_core(k);
+    for (int i = 0; i < k; ++i) {
+      initial_core[i] = std::find(free_locations.begin(), free_locations.end(),
+                                  initial[core[i]]) -
+                        free_locations.begin();
+    }
+    int64_t core_cost = 0;
+    for (int i = 0; i < k; ++i) {
+      core_cost += linear[i * m + initial_core[i]];
+      for (int j = 0; j < k; ++j) {
+        core_cost += weight[i * k + j] *
+                     t(free_locations[initial_core[i]],
+                       free_locations[initial_core[j]]);
+      }
+    }
+    base_cost = problem.cost(initial) - core_cost;
+  }
+
+  BranchAndBoundResult run(const BranchAndBoundOptions &options) {
+    start_time = std::chrono::steady_clock::now();
+    time_limit_s = options.time_limit_s;
+    best_location_of = initial;
+    best_cost = problem.cost(initial);
+
+    // Tasks = assignments of the first two core symbols, best bound first
+    std::vector<int64_t> root(k * m);
+    init_charges(root);
+    int split = std::min(k, 2);
+    std::vector<std::vector<int>> tasks = {{}};
+    for (int depth = 0; depth < split; ++depth) {
+      std::vector<std::vector<int>> next;
+      for (const std::vector<int> &task : tasks) {
+        for (int a = 0; a < m; ++a) {
+          if (std::find(task.begin(), task.end(), a) == task.end()) {
+            next.push_back(task);
+            next.back().push_back(a);
+          }
+        }
+      }
+      tasks = std::move(next);
+    }
+    std::vector<std::pair<int64_t, size_t>> order;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      order.push_back({partial_cost(tasks[i]), i});
+    }
+    std::sort(order.begin(), order.end());
+
+    std::atomic<size_t> next_task = 0;
+    auto worker = [&]() {
+      uint64_t nodes = 0;
+      std::vector<std::vector<int64_t>> charges(k + 1,
+                                                std::vector<int64_t>(k * m));
+      std::vector<int> assigned;
+      for (size_t i; (i = next_task++) < order.size() && !stopped;) {
+        const std::vector<int> &task = tasks[order[i].second];
+        charges[0] = root;
+        assigned.clear();
+        std::bitset<256> used;
+        int64_t partial = 0;
+        for (int a : task) {
+          partial += assign(charges[assigned.size()],
+                            charges[assigned.size() + 1], assigned, a);
+          used[a] = true;
+        }
+        search(charges, assigned, used, partial, nodes);
+      }
+      total_nodes += nodes;
+    };
+    int threads = options.threads > 0
+                      ? options.threads
+                      : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; ++i) {
+      pool.emplace_back(worker);
+    }
+    for (std::thread &thread : pool) {
+      thread.join();
+    }
+
+    BranchAndBoundResult result;
+    result.best = {best_location_of, static_cast<uint64_t>(best_cost.load())};
+    result.proven_optimal = !stopped;
+    result.nodes = total_nodes;
+    return result;
+  }
+
+private:
+  const QapProblem &problem;
+  const std::vector<int> &initial;
+  const std::vector<int> &core;
+  const int k;
+  int m;
+  std::vector<int> free_locations;
+  std::vector<uint32_t> min_out;
+  // [core index * m + free location index]
+  std::vector<int64_t> linear;
+  // [core index * k + core index]
+  std::vector<int64_t> weight;
+  int64_t base_cost;
+
+  std::atomic<int64_t> best_cost;
+  std::mutex best_mutex;
+  std::vector<int> best_location_of;
+  std::atomic<bool> stopped = false;
+  std::atomic<uint64_t> total_nodes = 0;
+  std::chrono::steady_clock::time_point start_time;
+  double time_limit_s;
+
+  uint32_t transition(int a, int b) const {
+    return problem.transitions(free_locations[a], free_locations[b]);
+  }
+
+  // Charges of the unassigned symbols with nothing assigned yet.
+  void init_charges(std::vector<int64_t> &charges) const {
+    for (int i = 0; i < k; ++i) {
+      int64_t others = 0;
+      for (int j = 0; j < k; ++j) {
+        others += weight[i * k + j];
+      }
+      for (int a = 0; a < m; ++a) {
+        charges[i * m + a] = linear[i * m + a] + others * min_out[a];
+      }
+    }
+  }
+
+  // Assigns the next core symbol to `a`. Updates the charges of the remaining
+  // symbols and returns the cost of the newly assigned symbol.
+  int64_t assign(const std::vector<int64_t> &charges,
+                 std::vector<int64_t> &next, std::vector<int> &assigned,
+                 int a) const {
+    const int d = assigned.size();
+    int64_t cost = linear[d * m + a];
+    for (int j = 0; j < d; ++j) {
+      cost += weight[d * k + j] * transition(a, assigned[j]) +
+              weight[j * k + d] * transition(assigned[j], a);
+    }
+    for (int i = d + 1; i < k; ++i) {
+      const int64_t out = weight[i * k + d], in = weight[d * k + i];
+      for (int b = 0; b < m; ++b) {
+        // The (i, d) term is now known exactly. The (d, i) term used to be
+        // charged to d, which is no longer part of the bound.
+        next[i * m + b] = charges[i * m + b] + out * transition(b, a) +
+                          in * transition(a, b) -
+                          out * static_cast<int64_t>(min_out[b]);
+      }
+    }
+    assigned.push_back(a);
+    return cost;
+  }
+
+  int64_t partial_cost(const std::vector<int> &locations) const {
+    int64_t cost = 0;
+    for (size_t i = 0; i < locations.size(); ++i) {
+      cost += linear[i * m + locations[i]];
+      for (size_t j = 0; j < i; ++j) {
+        cost += weight[i * k + j] * transition(locations[i], locations[j]) +
+                weight[j * k + i] * transition(locations[j], locations[i]);
+      }
+    }
+    return cost;
+  }
+
+  int64_t lower_bound(const std::vector<int64_t> &charges, int d,
+                      const std::bitset<256> &used) const {
+    std::vector<int> columns;
+    for (int a = 0; a < m; ++a) {
+      if (!used[a]) {
+        columns.push_back(a);
+      }
+    }
+    const int rows = k - d;
+    std::vector<int64_t> matrix(rows * columns.size());
+    for (int r = 0; r < rows; ++r) {
+      for (size_t c = 0; c < columns.size(); ++c) {
+        matrix[r * columns.size() + c] = charges[(d + r) * m + columns[c]];
+      }
+    }
+    return linear_assignment(matrix, rows, columns.size());
+  }
+
+  void record(const std::vector<int> &assigned, int64_t partial) {
+    int64_t cost = base_cost + partial;
+    std::lock_guard<std::mutex> lock(best_mutex);
+    if (cost >= best_cost) {
+      return;
+    }
+    best_cost = cost;
+    for (int i = 0; i < k; ++i) {
+      best_location_of[core[i]] = free_locations[assigned[i]];
+    }
+  }
+
+  void search(std::vector<std::vector<int64_t>> &charges,
+              std::vector<int> &assigned, std::bitset<256> &used,
+              int64_t partial, uint64_t &nodes) {
+    if (stopped) {
+      return;
+    }
+    if (++nodes % 4096 == 0 && time_limit_s > 0 &&
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start_time)
+                .count() > time_limit_s) {
+      stopped = true;
+      return;
+    }
+    const int d = assigned.size();
+    if (d == k) {
+      record(assigned, partial);
+      return;
+    }
+    if (base_cost + partial + lower_bound(charges[d], d, used) >= best_cost) {
+      return;
+    }
+    // Most promising chords first
+    std::vector<std::pair<int64_t, int>> candidates;
+    for (int a = 0; a < m; ++a) {
+      if (!used[a]) {
+        candidates.push_back({charges[d][d * m + a], a});
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (auto [charge, a] : candidates) {
+      if (base_cost + partial + charge >= best_cost) {
+        break; // charges are admissible for the symbol alone
+      }
+      int64_t cost = assign(charges[d], charges[d + 1], assigned, a);
+      used[a] = true;
+      search(charges, assigned, used, partial + cost, nodes);
+      used[a] = false;
+      assigned.pop_back();
+    }
+  }
+};
+
+// Finds the optimal locations of the `core` symbols with the other symbols
+// held in place.
+inline BranchAndBoundResult
+branch_and_bound(const QapProblem &problem, const std::vector<int> &initial,
+                 const std::vector<int> &core,
+                 const BranchAndBoundOptions &options = {}) {
+  return BranchAndBound(problem, initial, core).run(options);
+}
@@ -0,0 +1,80 @@
+#include "branch_and_bound.cpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+class BranchAndBoundTest : public ::testing::Test {
+protected:
+  std::vector<Fingers> chords = {
+      Fingers::FromChord("0100"), Fingers::FromChord("0110"),
+      Fingers::FromChord("2000"), Fingers::FromChord("0011"),
+      Fingers::FromChord("1010"), Fingers::FromChord("0201"),
+      Fingers::FromChord("3100"), Fingers::FromChord("0120")};
+  int16_t symbol_of[256];
+
+  void SetUp() override {
+    std::fill(std::begin(symbol_of), std::end(symbol_of), -1);
+    for (int i = 0; i < 5; ++i) {
+      symbol_of['a' + i] = i;
+    }
+  }
+
+  std::string random_text(unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string text;
+    for (int i = 0; i < 300; ++i) {
+      // Skewed towards the first letters
+      text += 'a' + std::min<int>(rng() % 6, rng() % 6) % 5;
+    }
+    return text;
+  }
+};
+
+TEST_F(BranchAndBoundTest, LinearAssignment) {
+  // Rows pick distinct columns - the cheapest total is 1 + 2 + 3
+  std::vector<int64_t> cost = {1, 5, 9, 4,  //
+                               1, 2, 9, 9,  //
+                               1, 9, 9, 3};
+  EXPECT_EQ(linear_assignment(cost, 3, 4), 6);
+}
+
+TEST_F(BranchAndBoundTest, MatchesBruteForce) {
+  TransitionTable transitions(chords);
+  for (unsigned seed = 0; seed < 5; ++seed) {
+    std::string text = random_text(seed);
+    BigramCounts counts(text.c_str(), symbol_of, 5);
+    QapProblem problem{transitions, counts, std::vector<bool>(5)};
+    std::vector<int> initial = {0, 1, 2, 3, 4};
+    // Symbol 4 stays on chord 4
+    std::vector<int> core = {0, 1, 2, 3};
+
+    uint64_t optimum = UINT64_MAX;
+    std::vector<int> location_of = initial;
+    std::vector<int> candidates = {0, 1, 2, 3, 5, 6, 7};
+    for (int a : candidates)
+      for (int b : candidates)
+        for (int c : candidates)
+          for (int d : candidates) {
+            if (a == b || a == c || a == d || b == c || b == d || c == d) {
+              continue;
+            }
+            location_of = {a, b, c, d, 4};
+            optimum = std::min(optimum, problem.cost(location_of));
+          }
+
+    BranchAndBoundOptions options;
+    options.threads = 2;
+    BranchAndBoundResult result =
+        branch_and_bound(problem, initial, core, options);
+    EXPECT_TRUE(result.proven_optimal);
+    EXPECT_EQ(result.best.cost, optimum);
+    EXPECT_EQ(problem.cost(result.best.location_of), optimum);
+    EXPECT_EQ(result.best.location_of[4], 4);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,106 @@
+// Command line tool that fits FINGER_TRAVEL_COST_MS and FINGER_PRESS_COST_MS
+// to recorded chord traces (see calibration.cpp for the trace format).
+//
+// Usage: ./calibrate [--max-interval MS] TRACE...
+//
+// The fitted constants are printed in a form that can be pasted directly into
+// fingers.cpp.
+
+#include "calibration.cpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static const char *kFingerNames[5] = {"Thumb", "Index", "Middle", "Ring",
+                                      "Pinky"};
+
+static void print_params(const std::array<double, NUM_PARAMS> &params) {
+  printf("constexpr uint32_t FINGER_TRAVEL_COST_MS[5] = {\n");
+  for (int finger = 0; finger < 5; ++finger) {
+    long value = finger < NUM_FINGERS
+                     ? std::lround(params[TRAVEL_PARAM + finger])
+                     : FINGER_TRAVEL_COST_MS[finger];
+    printf("    %ld%s // %s\n", value, finger < 4 ? "," : "",
+           kFingerNames[finger]);
+  }
+  printf("};\n\n");
+  printf("constexpr uint32_t FINGER_PRESS_COST_MS[5][MAX_BUTTONS] = {\n");
+  for (int finger = 0; finger < 5; ++finger) {
+    printf("    {");
+    for (int row = 0; row < MAX_BUTTONS; ++row) {
+      long value =
+          finger < NUM_FINGERS
+              ? std::lround(params[PRESS_PARAM + finger * MAX_BUTTONS + row])
+              : FINGER_PRESS_COST_MS[finger][row];
+      // Buttons that don't exist stay at 0
+      if (FINGER_PRESS_COST_MS[finger][row] == 0) {
+        value = 0;
+      }
+      printf("%s%ld", row ? ", " : "", value);
+    }
+    printf("}%s // %s\n", finger < 4 ? "," : " ", kFingerNames[finger]);
+  }
+  printf("};\n");
+}
+
+int main(int argc, char **argv) {
+  double max_interval_ms = 2000;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--max-interval") == 0 && i + 1 < argc) {
+      max_interval_ms = atof(argv[++i]);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "Usage: %s [--max-interval MS] TRACE...\n", argv[0]);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  Trace trace;
+  for (const char *path : paths) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "Could not read %s\n", path);
+      return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    parse_trace(contents.str(), max_interval_ms, trace);
+  }
+  auto parsed = std::chrono::steady_clock::now();
+
+  printf("Intervals: %zu (%zu distinct transitions)\n",
+         trace.interval_ms.size(), trace.features.size());
+  printf("Pauses longer than %.0fms: %zu\n", max_interval_ms, trace.pauses);
+  if (trace.skipped_lines) {
+    printf("Skipped malformed lines: %zu\n", trace.skipped_lines);
+  }
+  if (trace.interval_ms.empty()) {
+    return 1;
+  }
+
+  FitOptions baseline_options;
+  baseline_options.max_iterations = 0;
+  Fit baseline = fit_costs(trace, baseline_options);
+  Fit fit = fit_costs(trace);
+  auto fitted = std::chrono::steady_clock::now();
+
+  printf("Current constants: RMS error %.1fms\n", baseline.rms_ms);
+  printf("Fitted constants:  RMS error %.1fms (%zu outliers rejected, %d "
+         "iterations)\n",
+         fit.rms_ms, fit.outliers, fit.iterations);
+  printf("Per-chord overhead (not simulated): %.1fms\n",
+         fit.params[INTERCEPT_PARAM]);
+  printf("Parsing took %.2fs, fitting took %.2fs\n\n",
+         std::chrono::duration<double>(parsed - start).count(),
+         std::chrono::duration<double>(fitted - parsed).count());
+
+  print_params(fit.params);
+  return 0;
+}
@@ -0,0 +1,336 @@
+// Fits the cost constants from fingers.cpp to recorded typing.
+//
+// The input is a trace - a text file where each line holds a timestamp (in
+// milliseconds) and the chord that was typed at that moment:
+//
+//   1712.5 0110
+//   1873.0 2000
+//
+// Every transition cost in `Fingers::transition_to` is a sum of
+// FINGER_TRAVEL_COST_MS and FINGER_PRESS_COST_MS entries, so the time between
+// two chords is a linear function of those constants (plus some constant
+// overhead that doesn't depend on the chords). This makes it possible to find
+// the constants with (robust) least squares.
+
+#pragma once
+
+#include "fingers.cpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Layout of the fitted parameter vector
+constexpr int TRAVEL_PARAM = 0;           // + finger
+constexpr int PRESS_PARAM = NUM_FINGERS;  // + finger * MAX_BUTTONS + row
+constexpr int INTERCEPT_PARAM = PRESS_PARAM + NUM_FINGERS * MAX_BUTTONS;
+constexpr int NUM_PARAMS = INTERCEPT_PARAM + 1;
+
+// How many times each cost constant contributes to a transition. The
+// intercept is implicit (always 1).
+using Features = std::array<uint8_t, INTERCEPT_PARAM>;
+
+// Collects the cost components of `Fingers::transition_to` as features.
+struct CostFeatures {
+  Features x = {};
+
+  void travel(int finger, int distance) { x[TRAVEL_PARAM + finger] += distance; }
+
+  void press(int finger, int row) {
+    x[PRESS_PARAM + finger * MAX_BUTTONS + row] += 1;
+  }
+
+  void re_press(int finger, int row) {
+    x[PRESS_PARAM + finger * MAX_BUTTONS + row] += 2;
+  }
+};
+
+struct Trace {
+  // Distinct feature vectors that appear in the trace. Most transitions repeat
+  // so this is much smaller than the number of events.
+  std::vector<Features> features;
+  // One entry per interval - index into `features` & the measured duration.
+  std::vector<uint32_t> feature_idx;
+  std::vector<float> interval_ms;
+  // Lines that couldn't be parsed.
+  size_t skipped_lines = 0;
+  // Gaps longer than `max_interval_ms` (the typist took a break).
+  size_t pauses = 0;
+};
+
+// Parses trace lines from `text` and appends the intervals to `trace`.
+// Intervals longer than `max_interval_ms` are treated as pauses - the fingers
+// return to their rest position and the interval is not used for fitting.
+// Empty lines and lines starting with '#' are ignored.
+void parse_trace(std::string_view text, double max_interval_ms, Trace &trace) {
+  std::unordered_map<std::string, uint32_t> feature_ids;
+  for (uint32_t i = 0; i < trace.features.size(); ++i) {
+    const Features &x = trace.features[i];
+    feature_ids.emplace(std::string(x.begin(), x.end()), i);
+  }
+
+  Fingers fingers = {};
+  double last_time = 0;
+  bool have_last = false;
+
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    std::string_view line = text.substr(0, eol);
+    text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos || line[start] == '#') {
+      continue;
+    }
+    line.remove_prefix(start);
+
+    double time;
+    auto [time_end, ec] =
+        std::from_chars(line.data(), line.data() + line.size(), time);
+    if (ec != std::errc()) {
+      ++trace.skipped_lines;
+      continue;
+    }
+    line.remove_prefix(time_end - line.data());
+    start = line.find_first_not_of(" \t,");
+    if (start == std::string_view::npos ||
+        line.size() - start < static_cast<size_t>(NUM_FINGERS)) {
+      ++trace.skipped_lines;
+      continue;
+    }
+    char chord_str[NUM_FINGERS + 1] = {};
+    bool valid = true;
+    for (int i = 0; i < NUM_FINGERS; ++i) {
+      chord_str[i] = line[start + i];
+      int row = chord_str[i] - '0' - 1;
+      // Buttons that the finger doesn't have cost nothing to press
+      valid &= row >= -1 && row < MAX_BUTTONS &&
+               (row < 0 || FINGER_PRESS_COST_MS[i][row] != 0);
+    }
+    if (!valid) {
+      ++trace.skipped_lines;
+      continue;
+    }
+    Fingers target = Fingers::FromChord(chord_str);
+
+    if (!have_last || time - last_time > max_interval_ms ||
+        time < last_time) {
+      if (have_last) {
+        ++trace.pauses;
+      }
+      fingers = {};
+      fingers.transition_to(target);
+    } else {
+      CostFeatures features;
+      fingers.transition_to(target, features);
+      auto [it, inserted] = feature_ids.emplace(
+          std::string(features.x.begin(), features.x.end()),
+          static_cast<uint32_t>(trace.features.size()));
+      if (inserted) {
+        trace.features.push_back(features.x);
+      }
+      trace.feature_idx.push_back(it->second);
+      trace.interval_ms.push_back(static_cast<float>(time - last_time));
+    }
+    last_time = time;
+    have_last = true;
+  }
+}
+
+// The constants currently used by the simulator (intercept = 0).
+std::array<double, NUM_PARAMS> current_params() {
+  std::array<double, NUM_PARAMS> params = {};
+  for (int finger = 0; finger < NUM_FINGERS; ++finger) {
+    params[TRAVEL_PARAM + finger] = FINGER_TRAVEL_COST_MS[finger];
+    for (int row = 0; row < MAX_BUTTONS; ++row) {
+      params[PRESS_PARAM + finger * MAX_BUTTONS + row] =
+          FINGER_PRESS_COST_MS[finger][row];
+    }
+  }
+  return params;
+}
+
+struct FitOptions {
+  // Residuals beyond this many (robust) standard deviations are rejected.
+  double outlier_sigmas = 3.0;
+  // Residuals beyond this many standard deviations get Huber down-weighting.
+  double huber_sigmas = 1.345;
+  // Pulls every parameter towards its current value with the weight of this
+  // many observations. Keeps the constants that the trace says nothing about
+  // (e.g. buttons that were never pressed) at their hand-picked values.
+  double prior_weight = 10.0;
+  // Zero only evaluates the current constants (with a fitted intercept).
+  int max_iterations = 50;
+};
+
+struct Fit {
+  std::array<double, NUM_PARAMS> params;
+  size_t inliers = 0;
+  size_t outliers = 0;
+  // Root mean square error on the inliers.
+  double rms_ms = 0;
+  // Number of reweighting rounds that were run.
+  int iterations = 0;
+};
+
+// Median of `values` (reorders them).
+static double median(std::vector<float> &values) {
+  if (values.empty()) {
+    return 0;
+  }
+  auto middle = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), middle, values.end());
+  return *middle;
+}
+
+// Solves `a * x = b` in place (Gaussian elimination with partial pivoting).
+static bool solve(std::array<std::array<double, NUM_PARAMS>, NUM_PARAMS> &a,
+                  std::array<double, NUM_PARAMS> &b) {
+  for (int col = 0; col < NUM_PARAMS; ++col) {
+    int pivot = col;
+    for (int row = col + 1; row < NUM_PARAMS; ++row) {
+      if (std::fabs(a[row][col]) > std::fabs(a[pivot][col])) {
+        pivot = row;
+      }
+    }
+    if (std::fabs(a[pivot][col]) < 1e-12) {
+      return false;
+    }
+    std::swap(a[col], a[pivot]);
+    std::swap(b[col], b[pivot]);
+    for (int row = col + 1; row < NUM_PARAMS; ++row) {
+      double factor = a[row][col] / a[col][col];
+      for (int k = col; k < NUM_PARAMS; ++k) {
+        a[row][k] -= factor * a[col][k];
+      }
+      b[row] -= factor * b[col];
+    }
+  }
+  for (int row = NUM_PARAMS - 1; row >= 0; --row) {
+    for (int k = row + 1; k < NUM_PARAMS; ++k) {
+      b[row] -= a[row][k] * b[k];
+    }
+    b[row] /= a[row][row];
+  }
+  return true;
+}
+
+// Iteratively reweighted least squares with Huber weights. Outliers (typos,
+// hesitation) are re-detected in every iteration using the median absolute
+// deviation of the residuals.
+Fit fit_costs(const Trace &trace, const FitOptions &options = {}) {
+  const std::array<double, NUM_PARAMS> prior = current_params();
+  Fit fit;
+  fit.params = prior;
+  const size_t num_events = trace.interval_ms.size();
+  const size_t num_features = trace.features.size();
+  if (num_events == 0) {
+    return fit;
+  }
+
+  // Start with the intercept that fits the current constants best.
+  std::vector<float> residuals(num_events);
+  std::vector<double> prediction(num_features);
+  auto predict = [&]() {
+    for (size_t g = 0; g < num_features; ++g) {
+      double sum = fit.params[INTERCEPT_PARAM];
+      for (int p = 0; p < INTERCEPT_PARAM; ++p) {
+        sum += fit.params[p] * trace.features[g][p];
+      }
+      prediction[g] = sum;
+    }
+    for (size_t i = 0; i < num_events; ++i) {
+      residuals[i] = trace.interval_ms[i] - prediction[trace.feature_idx[i]];
+    }
+  };
+  predict();
+  {
+    std::vector<float> sorted = residuals;
+    fit.params[INTERCEPT_PARAM] = median(sorted);
+  }
+
+  std::vector<double> weight_sum(num_features);
+  std::vector<double> weighted_y(num_features);
+  std::vector<float> deviations(num_events);
+
+  for (bool converged = false;; ++fit.iterations) {
+    predict();
+
+    deviations = residuals;
+    double center = median(deviations);
+    for (float &d : deviations) {
+      d = std::fabs(d - center);
+    }
+    double sigma = std::max(1.4826 * median(deviations), 1.0);
+    double outlier_limit = options.outlier_sigmas * sigma;
+    double huber_limit = options.huber_sigmas * sigma;
+
+    std::fill(weight_sum.begin(), weight_sum.end(), 0);
+    std::fill(weighted_y.begin(), weighted_y.end(), 0);
+    fit.inliers = fit.outliers = 0;
+    double squared_error = 0;
+    for (size_t i = 0; i < num_events; ++i) {
+      double r = std::fabs(residuals[i]);
+      if (r > outlier_limit) {
+        ++fit.outliers;
+        continue;
+      }
+      ++fit.inliers;
+      squared_error += r * r;
+      double w = r <= huber_limit ? 1.0 : huber_limit / r;
+      weight_sum[trace.feature_idx[i]] += w;
+      weighted_y[trace.feature_idx[i]] += w * trace.interval_ms[i];
+    }
+    fit.rms_ms = fit.inliers ? std::sqrt(squared_error / fit.inliers) : 0;
+    if (converged || fit.iterations >= options.max_iterations) {
+      break;
+    }
+
+    // Normal equations with a ridge pulling towards the prior
+    std::array<std::array<double, NUM_PARAMS>, NUM_PARAMS> a = {};
+    std::array<double, NUM_PARAMS> b = {};
+    for (size_t g = 0; g < num_features; ++g) {
+      if (weight_sum[g] == 0) {
+        continue;
+      }
+      double x[NUM_PARAMS];
+      for (int p = 0; p < INTERCEPT_PARAM; ++p) {
+        x[p] = trace.features[g][p];
+      }
+      x[INTERCEPT_PARAM] = 1;
+      for (int p = 0; p < NUM_PARAMS; ++p) {
+        if (x[p] == 0) {
+          continue;
+        }
+        for (int q = 0; q < NUM_PARAMS; ++q) {
+          a[p][q] += weight_sum[g] * x[p] * x[q];
+        }
+        b[p] += weighted_y[g] * x[p];
+      }
+    }
+    for (int p = 0; p < INTERCEPT_PARAM; ++p) {
+      a[p][p] += options.prior_weight;
+      b[p] += options.prior_weight * prior[p];
+    }
+    // The intercept is only weakly regularized (towards its current value)
+    a[INTERCEPT_PARAM][INTERCEPT_PARAM] += 1e-6;
+    b[INTERCEPT_PARAM] += 1e-6 * fit.params[INTERCEPT_PARAM];
+
+    if (!solve(a, b)) {
+      break;
+    }
+
+    double max_change = 0;
+    for (int p = 0; p < NUM_PARAMS; ++p) {
+      // Negative costs would break the optimizers
+      double value = p == INTERCEPT_PARAM ? b[p] : std::max(b[p], 0.0);
+      max_change = std::max(max_change, std::fabs(value - fit.params[p]));
+      fit.params[p] = value;
+    }
+    converged = max_change < 0.01;
+  }
+  return fit;
+}
@@ -0,0 +1,86 @@
+#include "calibration.cpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+// Produces a trace typed by a "hand" whose costs are `params`.
+static std::string synthesize_trace(const std::array<double, NUM_PARAMS> &params,
+                                    int num_chords, double outlier_ratio,
+                                    unsigned seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0, 5);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  const char *chords[] = {"0100", "0110", "2000", "2100", "0011",
+                          "1010", "0201", "3100", "0120", "1001"};
+  std::string trace;
+  Fingers fingers = {};
+  double time = 1000;
+  for (int i = 0; i < num_chords; ++i) {
+    const char *chord = chords[rng() % std::size(chords)];
+    CostFeatures features;
+    fingers.transition_to(Fingers::FromChord(chord), features);
+    double interval = params[INTERCEPT_PARAM];
+    for (int p = 0; p < INTERCEPT_PARAM; ++p) {
+      interval += params[p] * features.x[p];
+    }
+    interval += noise(rng);
+    if (uniform(rng) < outlier_ratio) {
+      interval += 300 + 600 * uniform(rng); // hesitation
+    }
+    time += interval;
+    trace += std::to_string(time) + " " + chord + "\n";
+  }
+  return trace;
+}
+
+TEST(CalibrationTest, ParseTrace) {
+  Trace trace;
+  parse_trace("# comment\n"
+              "100 0100\n"
+              "250.5 0110\n"
+              "garbage\n"
+              "5000 2000\n"
+              "5100 21000\n"
+              "5200 0300\n"  // the index finger has 2 buttons
+              "5300 0003\n", // and so does the ring finger
+              2000, trace);
+  EXPECT_EQ(trace.interval_ms.size(), 2u);
+  EXPECT_FLOAT_EQ(trace.interval_ms[0], 150.5);
+  EXPECT_FLOAT_EQ(trace.interval_ms[1], 100);
+  EXPECT_EQ(trace.pauses, 1u);
+  EXPECT_EQ(trace.skipped_lines, 3u);
+}
+
+TEST(CalibrationTest, RecoversCosts) {
+  std::array<double, NUM_PARAMS> truth = current_params();
+  truth[TRAVEL_PARAM + 1] = 70;               // faster index finger
+  truth[PRESS_PARAM + 0 * MAX_BUTTONS + 1] = 90; // slower thumb
+  truth[INTERCEPT_PARAM] = 60;
+
+  Trace trace;
+  parse_trace(synthesize_trace(truth, 20000, 0.05, 1), 2000, trace);
+  Fit fit = fit_costs(trace);
+
+  EXPECT_NEAR(fit.params[TRAVEL_PARAM + 1], 70, 3);
+  EXPECT_NEAR(fit.params[PRESS_PARAM + 0 * MAX_BUTTONS + 1], 90, 3);
+  EXPECT_NEAR(fit.params[INTERCEPT_PARAM], 60, 3);
+  // Hesitations shouldn't pull the fit
+  EXPECT_GT(fit.outliers, 500u);
+  EXPECT_LT(fit.rms_ms, 10);
+}
+
+TEST(CalibrationTest, UnobservedCostsStayPut) {
+  Trace trace;
+  parse_trace(synthesize_trace(current_params(), 2000, 0, 2), 2000, trace);
+  Fit fit = fit_costs(trace);
+  // The ring finger never presses its second button in the synthetic trace
+  EXPECT_NEAR(fit.params[PRESS_PARAM + 3 * MAX_BUTTONS + 1],
+              FINGER_PRESS_COST_MS[3][1], 1e-6);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
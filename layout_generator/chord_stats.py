@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Loader for the chord usage statistics recorded by the keyboard.
+
+The firmware counts how often each action is executed and how often one action
+follows another (see src/ChordStats.h). Files exported in that format (with the
+`.chordstats` suffix) can be dropped into `corpus/` - `load_corpus` turns them
+into a synthetic text with exactly the same character bigrams and starts from
+the rest position, so every optimizer can use them like any other corpus.
+
+The text is built from Eulerian trails of the bigram graph. It is not what was
+typed, only a sequence with the same transition histogram.
+"""
+
+import struct
+import sys
+from collections import Counter, defaultdict
+from typing import Dict, List, Optional, Tuple
+
+CHORD_STATS_SUFFIX = ".chordstats"
+FORMAT_VERSION = 2
+
+# Action flags (ChordStats::kArpeggio etc.)
+ARPEGGIO = 1
+SHIFTED = 2
+MODIFIED = 4
+
+# Separates the trails. The character has no chord, so the simulator puts the
+# fingers back to the rest position when it sees it.
+SEPARATOR = "\x1e"
+
+# Firmware keys (src/HidReport.h) that stand for corpus symbols other than
+# printable ASCII. Right Alt is the "T" of QwertyKeys.
+SPECIAL_KEYS = {0x0A: "\n", 0x09: "\t", 0xB0: "\n", 0xB3: "\t", 0x86: "T"}
+
+
+def key_symbol(key: int, flags: int) -> Optional[str]:
+    """
+    Corpus symbol typed by an action.
+
+    Shift is dropped (like QwertyKeys does for the corpus). Actions with other
+    modifiers and keys that aren't in the corpus (arrows, Backspace, ...) have
+    no symbol.
+    """
+    if flags & MODIFIED:
+        return None
+    if key in SPECIAL_KEYS:
+        return SPECIAL_KEYS[key]
+    if 0x20 <= key < 0x7F:
+        return chr(key)
+    return None
+
+
+def parse_chord_stats(
+    data: bytes,
+) -> Tuple[Dict[int, Tuple[int, int, int]], List[Tuple[int, int, int]]]:
+    """
+    Parse the output of ChordStats::Serialize.
+
+    Returns:
+        ({action_id: (key, flags, count)}, [(first_id, second_id, count)])
+    """
+    version, _capacity, dropped = struct.unpack_from("<BHI", data)
+    if version not in (1, FORMAT_VERSION):
+        raise ValueError(f"Unsupported chord stats version {version}")
+    offset = struct.calcsize("<BHI")
+    if version >= 2:
+        offset += 4  # layout fingerprint
+    (action_count,) = struct.unpack_from("<H", data, offset)
+    offset += 2
+    actions = {}
+    for _ in range(action_count):
+        action_id, key, flags, count = struct.unpack_from("<HBBI", data, offset)
+        actions[action_id] = (key, flags, count)
+        offset += 8
+    (bigram_count,) = struct.unpack_from("<H", data, offset)
+    offset += 2
+    bigrams = []
+    for _ in range(bigram_count):
+        bigrams.append(struct.unpack_from("<HHI", data, offset))
+        offset += 8
+    if dropped:
+        print(f"Warning: {dropped} bigrams didn't fit in the keyboard's table")
+    return actions, bigrams
+
+
+def transition_histogram(
+    data: bytes,
+) -> Tuple[Counter, Counter]:
+    """
+    Symbol bigram counts and counts of symbols typed from the rest position.
+    """
+    actions, bigrams = parse_chord_stats(data)
+    symbol_of = {
+        action_id: key_symbol(key, flags)
+        for action_id, (key, flags, _count) in actions.items()
+    }
+    pairs = Counter()
+    incoming = Counter()
+    for first, second, count in bigrams:
+        a, b = symbol_of.get(first), symbol_of.get(second)
+        if a is not None and b is not None:
+            pairs[a, b] += count
+            incoming[b] += count
+    starts = Counter()
+    for action_id, (_key, _flags, count) in actions.items():
+        if symbol_of[action_id] is not None:
+            starts[symbol_of[action_id]] += count
+    # Whatever wasn't reached from another symbol was typed from rest
+    for symbol in list(starts):
+        starts[symbol] = max(0, starts[symbol] - incoming[symbol])
+    return pairs, +starts
+
+
+def _circuit(edges: Dict[str, Counter], origin: str) -> List[str]:
+    """Eulerian circuit through the remaining edges (Hierholzer)."""
+    stack, circuit = [origin], []
+    while stack:
+        targets = edges[stack[-1]]
+        if targets:
+            target = next(iter(targets))
+            targets[target] -= 1
+            if not targets[target]:
+                del targets[target]
+            stack.append(target)
+        else:
+            circuit.append(stack.pop())
+    circuit.reverse()
+    return circuit
+
+
+def histogram_text(pairs: Counter, starts: Counter) -> str:
+    """
+    Text with the given bigram counts whose trails start at `starts`.
+    """
+    edges = defaultdict(Counter)
+    balance = Counter()  # outgoing - incoming edges of every symbol
+    for (a, b), count in pairs.items():
+        edges[a][b] += count
+        balance[a] += count
+        balance[b] -= count
+    for symbol, count in starts.items():
+        balance[symbol] -= count
+    for symbol, surplus in balance.items():
+        if surplus > 0:
+            # More bigrams leave the symbol than reach it (counts that didn't
+            # fit on the device) - start the missing trails at it
+            edges[SEPARATOR][symbol] += surplus
+        elif surplus < 0:
+            edges[symbol][SEPARATOR] -= surplus
+    for symbol, count in starts.items():
+        edges[SEPARATOR][symbol] += count
+
+    text = []
+    for origin in [SEPARATOR] + list(edges):
+        while edges[origin]:
+            circuit = _circuit(edges, origin)
+            if origin != SEPARATOR:
+                text.append(SEPARATOR)
+            text.append("".join(circuit))
+    return "".join(text)
+
+
+def load_chord_stats(filepath: str) -> str:
+    """
+    Load an exported chord stats file as corpus text.
+
+    Args:
+        filepath: File with the output of ChordStats::Serialize
+
+    Returns:
+        Text with the same symbol bigrams as the recorded typing
+    """
+    with open(filepath, "rb") as f:
+        data = f.read()
+    return histogram_text(*transition_histogram(data))
+
+
+if __name__ == "__main__":
+    for path in sys.argv[1:]:
+        pairs, starts = transition_histogram(open(path, "rb").read())
+        print(f"{path}: {sum(pairs.values())} bigrams, {sum(starts.values())} starts")
+        for (a, b), count in pairs.most_common(20):
+            print(f"  {a!r:6} -> {b!r:6} {count}")
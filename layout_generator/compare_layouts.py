@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""
+Explain the cost difference between two layouts.
+
+Types the corpus with both layouts (keyer_simulator_native.compare_layouts)
+and prints the bigrams and transition kinds whose cost changed the most.
+
+    ./compare_layouts.py best_layout.txt beam_best.txt [--top 20]
+"""
+
+import argparse
+from typing import Dict
+
+import keyer_simulator_native
+from layout import load_layout
+from planner import load_corpus
+
+
+def print_comparison(
+    before: Dict[str, str], after: Dict[str, str], corpus, top: int = 10
+):
+    """
+    Print where `after` gains or loses time compared to `before`.
+
+    Args:
+        before: Reference layout (char -> chord mapping)
+        after: Layout to explain (char -> chord mapping)
+        corpus: Text, compiled corpus or coreset
+        top: Number of bigrams to list
+    """
+    comparison = keyer_simulator_native.compare_layouts(
+        {char: [chord] for char, chord in before.items()},
+        {char: [chord] for char, chord in after.items()},
+        corpus,
+        top=top,
+    )
+    cost_before, cost_after = comparison["cost"]
+    print(
+        f"  Cost {cost_before}ms -> {cost_after}ms "
+        f"({cost_after - cost_before:+d}ms)"
+    )
+    print(f"  {'kind':10} {'count':>12} {'cost':>14} {'per transition':>16}")
+    for kind, (count_a, cost_a, count_b, cost_b) in comparison["kinds"].items():
+        per_a = cost_a / count_a if count_a else 0
+        per_b = cost_b / count_b if count_b else 0
+        print(
+            f"  {kind:10} {count_b - count_a:+12.0f} {cost_b - cost_a:+14.0f} "
+            f"{per_a:7.1f} -> {per_b:5.1f}"
+        )
+    print(f"  {'bigram':10} {'count':>12} {'cost':>14} {'per bigram':>16}")
+    for bigram, count, cost_a, cost_b in comparison["bigrams"]:
+        print(
+            f"  {bigram!r:10} {count:12.0f} {cost_b - cost_a:+14.0f} "
+            f"{cost_a / count:7.1f} -> {cost_b / count:5.1f}"
+        )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    parser.add_argument("before", help="reference layout file")
+    parser.add_argument("after", help="layout file to explain")
+    parser.add_argument("--corpus", default="corpus/*", help="corpus pattern")
+    parser.add_argument("--top", type=int, default=20, help="bigrams to list")
+    args = parser.parse_args()
+
+    corpus = load_corpus(args.corpus, qwerty_compatible=True)
+    print(f"{args.before} -> {args.after}")
+    print_comparison(
+        load_layout(args.before),
+        load_layout(args.after),
+        keyer_simulator_native.compile_corpus(corpus),
+        args.top,
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+// Where does the cost difference between two layouts come from?
+//
+// Both layouts type the same text and a `TransitionProfile` records the cost
+// of every bigram and of every kind of transition (see `TransitionKind`).
+// Bigrams are (previous, next) pairs of symbols. Transitions that start from
+// the rest position (beginning of the text, after an unknown character) are
+// recorded as (OTHER_SYMBOL, next).
+
+#pragma once
+
+#include "alphabet.cpp"
+#include "fingers.cpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Mirrors the cases of `Fingers::transition_to`.
+enum TransitionKind {
+  // Nothing was held down.
+  FROM_REST,
+  // A held finger moved to another button, which finished the previous chord.
+  SLIDE,
+  // Some fingers were released while others were pressed.
+  ROLL,
+  // A finger had to be released and pressed again.
+  RE_PRESS,
+  NUM_TRANSITION_KINDS
+};
+
+constexpr const char *TRANSITION_KIND_NAMES[NUM_TRANSITION_KINDS] = {
+    "rest", "slide", "roll", "re-press"};
+
+inline TransitionKind classify_transition(const Fingers &from,
+                                          const Fingers &chord) {
+  if (from.is_all_released()) {
+    return FROM_REST;
+  }
+  for (int finger = 0; finger < NUM_FINGERS; ++finger) {
+    if (from.is_pressed(finger) && chord.is_pressed(finger) &&
+        from.get(finger) != chord.get(finger)) {
+      return SLIDE;
+    }
+  }
+  if ((from.pressed & ~chord.pressed) && (chord.pressed & ~from.pressed)) {
+    return ROLL;
+  }
+  return RE_PRESS;
+}
+
+// Observer for `type_symbols_observed`. Counts and costs are multiplied by
+// `weight` (for coresets).
+struct TransitionProfile {
+  double weight = 1;
+  // Indexed by previous * MAX_SYMBOLS + next.
+  std::vector<double> bigram_count =
+      std::vector<double>(MAX_SYMBOLS * MAX_SYMBOLS);
+  std::vector<double> bigram_cost =
+      std::vector<double>(MAX_SYMBOLS * MAX_SYMBOLS);
+  double kind_count[NUM_TRANSITION_KINDS] = {};
+  double kind_cost[NUM_TRANSITION_KINDS] = {};
+
+  void operator()(int previous, int symbol, uint32_t cost, const Fingers &from,
+                  const Fingers &chord) {
+    int bigram =
+        (previous < 0 ? OTHER_SYMBOL : previous) * MAX_SYMBOLS + symbol;
+    bigram_count[bigram] += weight;
+    bigram_cost[bigram] += weight * cost;
+    TransitionKind kind = classify_transition(from, chord);
+    kind_count[kind] += weight;
+    kind_cost[kind] += weight * cost;
+  }
+};
+
+struct BigramDifference {
+  SymbolId previous;
+  SymbolId next;
+  // The larger of the two counts - they only differ if one of the layouts
+  // can't type some of the characters.
+  double count;
+  double cost_a;
+  double cost_b;
+};
+
+// The `top` bigrams whose total cost differs the most between the two
+// profiles, largest absolute difference first.
+inline std::vector<BigramDifference>
+largest_differences(const TransitionProfile &a, const TransitionProfile &b,
+                    size_t top) {
+  std::vector<BigramDifference> differences;
+  for (int i = 0; i < MAX_SYMBOLS * MAX_SYMBOLS; ++i) {
+    if (a.bigram_cost[i] != b.bigram_cost[i]) {
+      differences.push_back({SymbolId(i / MAX_SYMBOLS),
+                             SymbolId(i % MAX_SYMBOLS),
+                             std::max(a.bigram_count[i], b.bigram_count[i]),
+                             a.bigram_cost[i], b.bigram_cost[i]});
+    }
+  }
+  top = std::min(top, differences.size());
+  std::partial_sort(differences.begin(), differences.begin() + top,
+                    differences.end(),
+                    [](const BigramDifference &x, const BigramDifference &y) {
+                      return std::fabs(x.cost_b - x.cost_a) >
+                             std::fabs(y.cost_b - y.cost_a);
+                    });
+  differences.resize(top);
+  return differences;
+}
@@ -0,0 +1,64 @@
+#include "comparison.cpp"
+
+#include <gtest/gtest.h>
+
+TEST(ClassifyTransitionTest, Kinds) {
+  Fingers rest = {};
+  EXPECT_EQ(classify_transition(rest, Fingers::FromChord("0100")), FROM_REST);
+
+  Fingers held = {};
+  held.transition_to(Fingers::FromChord("0100"));
+  EXPECT_EQ(classify_transition(held, Fingers::FromChord("0200")), SLIDE);
+  EXPECT_EQ(classify_transition(held, Fingers::FromChord("0010")), ROLL);
+  EXPECT_EQ(classify_transition(held, Fingers::FromChord("0110")), RE_PRESS);
+  EXPECT_EQ(classify_transition(held, Fingers::FromChord("0100")), RE_PRESS);
+}
+
+TEST(TransitionProfileTest, AddsUpToTheCost) {
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  key_map[1].push_back(Fingers::FromChord("0100"));
+  key_map[2].push_back(Fingers::FromChord("0010"));
+  key_map[3].push_back(Fingers::FromChord("0200"));
+  const SymbolId text[] = {1, 2, 1, 3, 0, 2, 2, 1};
+
+  TransitionProfile profile;
+  uint64_t cost =
+      type_symbols_observed(text, std::size(text), key_map, profile);
+  double bigram_total = 0, kind_total = 0, count = 0;
+  for (int i = 0; i < MAX_SYMBOLS * MAX_SYMBOLS; ++i) {
+    bigram_total += profile.bigram_cost[i];
+    count += profile.bigram_count[i];
+  }
+  for (int kind = 0; kind < NUM_TRANSITION_KINDS; ++kind) {
+    kind_total += profile.kind_cost[kind];
+  }
+  EXPECT_DOUBLE_EQ(bigram_total, cost);
+  EXPECT_DOUBLE_EQ(kind_total, cost);
+  EXPECT_DOUBLE_EQ(count, 7);
+  // The text starts with 1 and 2 follows the unknown symbol
+  EXPECT_DOUBLE_EQ(profile.bigram_count[OTHER_SYMBOL * MAX_SYMBOLS + 1], 1);
+  EXPECT_DOUBLE_EQ(profile.bigram_count[OTHER_SYMBOL * MAX_SYMBOLS + 2], 1);
+  EXPECT_DOUBLE_EQ(profile.bigram_count[2 * MAX_SYMBOLS + 1], 2);
+  EXPECT_DOUBLE_EQ(profile.kind_count[FROM_REST], 2);
+  EXPECT_DOUBLE_EQ(profile.kind_count[SLIDE], 1);
+}
+
+TEST(LargestDifferencesTest, SortedByAbsoluteDifference) {
+  TransitionProfile a, b;
+  a.bigram_cost[1 * MAX_SYMBOLS + 2] = 100;
+  b.bigram_cost[1 * MAX_SYMBOLS + 2] = 150;
+  a.bigram_cost[2 * MAX_SYMBOLS + 1] = 300;
+  b.bigram_cost[2 * MAX_SYMBOLS + 1] = 200;
+  a.bigram_cost[3 * MAX_SYMBOLS + 3] = 10;
+  b.bigram_cost[3 * MAX_SYMBOLS + 3] = 10;
+  a.bigram_count[2 * MAX_SYMBOLS + 1] = 4;
+
+  std::vector<BigramDifference> top = largest_differences(a, b, 5);
+  ASSERT_EQ(top.size(), 2u);
+  EXPECT_EQ(top[0].previous, 2);
+  EXPECT_EQ(top[0].next, 1);
+  EXPECT_DOUBLE_EQ(top[0].count, 4);
+  EXPECT_DOUBLE_EQ(top[0].cost_b - top[0].cost_a, -100);
+  EXPECT_EQ(top[1].previous, 1);
+  EXPECT_EQ(largest_differences(a, b, 1).size(), 1u);
+}
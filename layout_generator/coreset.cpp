@@ -0,0 +1,191 @@
+// Small weighted stand-in for a large corpus.
+//
+// Most of a big corpus is redundant when the goal is to rank layouts. A
+// coreset keeps a small sample of fixed-size text windows, each with a weight,
+// so that the weighted cost of the windows estimates the cost of the whole
+// corpus.
+//
+// Windows are stratified by how expensive they are to type with a reference
+// layout: they are sorted by cost per character, split into equally sized
+// strata and one window is drawn from each stratum. Each window stands in for
+// its whole stratum. The weighted cost only approximates the full cost: every
+// window is typed from the rest position, so the finger state carried across
+// window boundaries is lost, and the shorter last window is scaled up like the
+// others. What the optimizers need is the ranking of layouts, which
+// `evaluate_coreset` checks against the full corpus. The stratification keeps
+// the error low for layouts that are similar to the reference (which is what
+// the optimizers explore).
+
+#pragma once
+
+#include "alphabet.cpp"
+#include "fingers.cpp"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+struct Coreset {
+  // Selected windows, concatenated. Every window is typed starting from the
+  // rest position.
+  std::vector<SymbolId> ids;
+  // Window `i` is ids[starts[i] .. starts[i + 1]).
+  std::vector<uint32_t> starts = {0};
+  std::vector<double> weights;
+
+  size_t num_windows() const { return weights.size(); }
+};
+
+// Weighted cost of typing the windows. `type` is `type_symbols` or one of its
+// variants.
+template <typename KeyMap, typename Type>
+double weighted_cost(const SymbolId *ids, const uint32_t *starts,
+                     const double *weights, size_t num_windows,
+                     const KeyMap *key_map, Type type) {
+  double total = 0;
+  for (size_t i = 0; i < num_windows; ++i) {
+    total += weights[i] * type(ids + starts[i], starts[i + 1] - starts[i],
+                               key_map);
+  }
+  return total;
+}
+
+inline double coreset_cost(const Coreset &coreset,
+                           const std::vector<Fingers> *key_map) {
+  return weighted_cost(coreset.ids.data(), coreset.starts.data(),
+                       coreset.weights.data(), coreset.num_windows(), key_map,
+                       type_symbols);
+}
+
+// Picks about `ratio` of the corpus in windows of `window` symbols.
+inline Coreset select_coreset(const SymbolId *ids, size_t size,
+                              const std::vector<Fingers> *reference,
+                              double ratio, int window, unsigned seed) {
+  std::mt19937 rng(seed);
+  const size_t num_windows = (size + window - 1) / window;
+  auto window_size = [&](size_t w) {
+    return std::min<size_t>(window, size - w * window);
+  };
+
+  std::vector<double> cost_per_symbol(num_windows);
+  for (size_t w = 0; w < num_windows; ++w) {
+    cost_per_symbol[w] =
+        double(type_symbols(ids + w * window, window_size(w), reference)) /
+        window_size(w);
+  }
+  std::vector<uint32_t> order(num_windows);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return cost_per_symbol[a] < cost_per_symbol[b];
+  });
+
+  Coreset coreset;
+  const size_t num_strata = std::clamp<size_t>(
+      std::llround(num_windows * ratio), 1, std::max<size_t>(num_windows, 1));
+  for (size_t stratum = 0; stratum < num_strata && num_windows; ++stratum) {
+    size_t begin = stratum * num_windows / num_strata;
+    size_t end = (stratum + 1) * num_windows / num_strata;
+    size_t stratum_symbols = 0;
+    for (size_t i = begin; i < end; ++i) {
+      stratum_symbols += window_size(order[i]);
+    }
+    uint32_t w = order[begin + rng() % (end - begin)];
+    coreset.ids.insert(coreset.ids.end(), ids + w * window,
+                       ids + w * window + window_size(w));
+    coreset.starts.push_back(coreset.ids.size());
+    coreset.weights.push_back(double(stratum_symbols) / window_size(w));
+  }
+  return coreset;
+}
+
+// Spearman's rank correlation (ties get their average rank).
+inline double rank_correlation(const std::vector<double> &a,
+                               const std::vector<double> &b) {
+  auto ranks = [](const std::vector<double> &values) {
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t x, size_t y) { return values[x] < values[y]; });
+    std::vector<double> rank(values.size());
+    for (size_t i = 0; i < order.size();) {
+      size_t j = i;
+      while (j < order.size() && values[order[j]] == values[order[i]]) {
+        ++j;
+      }
+      for (size_t k = i; k < j; ++k) {
+        rank[order[k]] = (i + j - 1) / 2.0;
+      }
+      i = j;
+    }
+    return rank;
+  };
+  std::vector<double> ra = ranks(a), rb = ranks(b);
+  const double n = a.size();
+  const double mean = (n - 1) / 2;
+  double cov = 0, var_a = 0, var_b = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    cov += (ra[i] - mean) * (rb[i] - mean);
+    var_a += (ra[i] - mean) * (ra[i] - mean);
+    var_b += (rb[i] - mean) * (rb[i] - mean);
+  }
+  return var_a > 0 && var_b > 0 ? cov / std::sqrt(var_a * var_b) : 1;
+}
+
+struct CoresetReport {
+  // Rank correlation between the full & coreset costs.
+  double random_correlation = 0;     // shuffled layouts
+  double neighbour_correlation = 0;  // reference with 1-3 swapped characters
+  double mean_relative_error = 0;
+  double max_relative_error = 0;
+  int layouts = 0;
+};
+
+// Compares full-corpus and coreset costs of `num_layouts` random layouts and
+// `num_layouts` neighbours of the reference layout.
+inline CoresetReport evaluate_coreset(const SymbolId *ids, size_t size,
+                                      const Coreset &coreset,
+                                      const std::vector<Fingers> *reference,
+                                      int num_layouts, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<int> symbols;
+  for (int s = 0; s < MAX_SYMBOLS; ++s) {
+    if (!reference[s].empty()) {
+      symbols.push_back(s);
+    }
+  }
+  CoresetReport report;
+  if (symbols.size() < 2) {
+    return report;
+  }
+  std::vector<double> full[2], estimate[2];
+  for (int kind = 0; kind < 2; ++kind) {
+    for (int i = 0; i < num_layouts; ++i) {
+      std::vector<Fingers> key_map[MAX_SYMBOLS];
+      for (int s : symbols) {
+        key_map[s] = reference[s];
+      }
+      if (kind == 0) {
+        for (size_t j = symbols.size() - 1; j > 0; --j) {
+          std::swap(key_map[symbols[j]], key_map[symbols[rng() % (j + 1)]]);
+        }
+      } else {
+        for (int swaps = 1 + rng() % 3; swaps > 0; --swaps) {
+          std::swap(key_map[symbols[rng() % symbols.size()]],
+                    key_map[symbols[rng() % symbols.size()]]);
+        }
+      }
+      double exact = type_symbols(ids, size, key_map);
+      double approximate = coreset_cost(coreset, key_map);
+      full[kind].push_back(exact);
+      estimate[kind].push_back(approximate);
+      double error = exact > 0 ? std::fabs(approximate - exact) / exact : 0;
+      report.mean_relative_error += error;
+      report.max_relative_error = std::max(report.max_relative_error, error);
+      ++report.layouts;
+    }
+  }
+  report.mean_relative_error /= report.layouts;
+  report.random_correlation = rank_correlation(full[0], estimate[0]);
+  report.neighbour_correlation = rank_correlation(full[1], estimate[1]);
+  return report;
+}
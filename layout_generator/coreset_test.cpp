@@ -0,0 +1,66 @@
+#include "coreset.cpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+static std::vector<SymbolId> random_text(size_t size, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<SymbolId> ids(size);
+  for (SymbolId &id : ids) {
+    // Skewed towards the low IDs, 0 (unknown) now and then
+    id = std::min(rng() % 8, rng() % 8);
+  }
+  return ids;
+}
+
+class CoresetTest : public ::testing::Test {
+protected:
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+
+  void SetUp() override {
+    const char *chords[] = {"0100", "0110", "2000", "0011",
+                            "1010", "0201", "3100"};
+    for (int i = 0; i < 7; ++i) {
+      key_map[i + 1].push_back(Fingers::FromChord(chords[i]));
+    }
+  }
+};
+
+TEST(RankCorrelationTest, Basics) {
+  EXPECT_DOUBLE_EQ(rank_correlation({1, 2, 3, 4}, {10, 20, 30, 40}), 1);
+  EXPECT_DOUBLE_EQ(rank_correlation({1, 2, 3, 4}, {4, 3, 2, 1}), -1);
+  // Monotonic but not linear
+  EXPECT_DOUBLE_EQ(rank_correlation({1, 2, 3, 4}, {1, 8, 27, 64}), 1);
+}
+
+TEST_F(CoresetTest, FullRatioKeepsEverything) {
+  std::vector<SymbolId> ids = random_text(1000, 1);
+  Coreset coreset = select_coreset(ids.data(), ids.size(), key_map, 1, 64, 0);
+  EXPECT_EQ(coreset.num_windows(), 16u);
+  EXPECT_EQ(coreset.ids.size(), ids.size());
+  for (double weight : coreset.weights) {
+    EXPECT_DOUBLE_EQ(weight, 1);
+  }
+}
+
+TEST_F(CoresetTest, TracksFullCost) {
+  std::vector<SymbolId> ids = random_text(200000, 2);
+  Coreset coreset =
+      select_coreset(ids.data(), ids.size(), key_map, 0.02, 128, 0);
+  EXPECT_LT(coreset.ids.size(), ids.size() / 40);
+
+  double full = type_symbols(ids.data(), ids.size(), key_map);
+  EXPECT_NEAR(coreset_cost(coreset, key_map), full, full * 0.01);
+
+  CoresetReport report =
+      evaluate_coreset(ids.data(), ids.size(), coreset, key_map, 30, 0);
+  EXPECT_EQ(report.layouts, 60);
+  EXPECT_GT(report.random_correlation, 0.95);
+  EXPECT_LT(report.mean_relative_error, 0.01);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
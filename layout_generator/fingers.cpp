@@ -1,9 +1,13 @@
+#pragma once
+
 #include <bit>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <limits>
+#include <utility>
 #include <vector>
 
 constexpr bool DEBUG = false;
@@ -46,6 +50,22 @@ constexpr Bitmask MASK_ALL = (1 << NUM_FINGERS) - 1;
 constexpr Bitmask MASK_THUMB = 1 << 0;
 constexpr Bitmask MASK_NON_THUMB = MASK_ALL & ~MASK_THUMB;
 
+// Adds up the cost of a transition (in milliseconds).
+struct CostSum {
+  uint32_t cost = 0;
+
+  void travel(int finger, int distance) {
+    cost += FINGER_TRAVEL_COST_MS[finger] * distance;
+  }
+
+  void press(int finger, int row) { cost += FINGER_PRESS_COST_MS[finger][row]; }
+
+  // Extra penalty for releasing a finger that's going to be pressed again.
+  void re_press(int finger, int row) {
+    cost += FINGER_PRESS_COST_MS[finger][row] * 2;
+  }
+};
+
 struct Fingers {
   // A bitmask that says whether finger i is pressed down.
   Bitmask pressed = 0;
@@ -90,7 +110,15 @@ struct Fingers {
   // The returned cost includes a potential cost associated with re-pressing
   // some finger to trigger the target chord.
   uint32_t transition_to(const Fingers &target) {
-    uint32_t cost = 0;
+    CostSum sum;
+    transition_to(target, sum);
+    return sum.cost;
+  }
+
+  // Same as above but reports every component of the cost to `costs` (see
+  // `CostSum` for the interface).
+  template <typename Costs>
+  void transition_to(const Fingers &target, Costs &costs) {
     bool re_press_needed = pressed != 0;
 
     // Move the fingers to their target positions
@@ -114,7 +142,7 @@ struct Fingers {
           printf("  Finger %d moving from %d to %d\n", finger_to_move,
                  current_position, target_position);
         }
-        cost += FINGER_TRAVEL_COST_MS[finger_to_move] * abs(distance);
+        costs.travel(finger_to_move, abs(distance));
       }
     }
 
@@ -162,7 +190,7 @@ struct Fingers {
         // Extra penalty for releasing a finger that's going to be pressed
         // again. This is the part that makes the generated layouts use the
         // "finger-walking" chords.
-        cost += best_re_press_cost * 2;
+        costs.re_press(best_re_press_finger, get(best_re_press_finger));
       }
     }
 
@@ -179,31 +207,48 @@ struct Fingers {
         printf("  Finger %d at %d pressing down\n", finger_to_press,
                target.get(finger_to_press));
       }
-      cost +=
-          FINGER_PRESS_COST_MS[finger_to_press][target.get(finger_to_press)];
+      costs.press(finger_to_press, target.get(finger_to_press));
     }
-
-    return cost;
   }
 };
 
-uint64_t type_text(const char *text, const std::vector<Fingers> key_map[256]) {
+// Receives every transition made by `type_symbols_observed`. `previous` is -1
+// when the fingers started from the rest position. `from` is the state of the
+// fingers before the transition and `chord` is the chord that was picked.
+struct IgnoreTransitions {
+  void operator()(int /*previous*/, int /*symbol*/, uint32_t /*cost*/,
+                  const Fingers & /*from*/, const Fingers & /*chord*/) {}
+};
+
+// Types a sequence of symbols. `key_map` is indexed by the symbols - either
+// raw bytes or dense alphabet IDs (see alphabet.cpp).
+template <typename Observer>
+uint64_t type_symbols_observed(const uint8_t *symbols, size_t size,
+                               const std::vector<Fingers> *key_map,
+                               Observer &observer) {
   Fingers fingers = {};
   uint64_t total_cost = 0;
+  int previous = -1;
 
-  while (*text) {
-    unsigned char idx = static_cast<unsigned char>(*text++);
-    const std::vector<Fingers> &available_chords = key_map[idx];
+  for (const uint8_t *end = symbols + size; symbols != end; ++symbols) {
+    const std::vector<Fingers> &available_chords = key_map[*symbols];
 
     if (available_chords.empty()) {
       // Unknown key - let's reset the finger position back to default
       fingers = {};
-    } else if (available_chords.size() == 1) {
-      total_cost += fingers.transition_to(available_chords[0]);
+      previous = -1;
+      continue;
+    }
+
+    const Fingers from = fingers;
+    const Fingers *chord = &available_chords[0];
+    uint32_t min_cost;
+    if (available_chords.size() == 1) {
+      min_cost = fingers.transition_to(available_chords[0]);
     } else {
 
       // Try all available chords and pick the best one
-      uint32_t min_cost = UINT32_MAX;
+      min_cost = UINT32_MAX;
       Fingers best_fingers;
 
       for (const Fingers &target : available_chords) {
@@ -216,14 +261,242 @@ uint64_t type_text(const char *text, const std::vector<Fingers> key_map[256]) {
         if (cost < min_cost) {
           min_cost = cost;
           best_fingers = target_fingers;
+          chord = &target;
         }
       }
 
       // Apply best transition
       fingers = best_fingers;
+    }
+    total_cost += min_cost;
+    observer(previous, *symbols, min_cost, from, *chord);
+    previous = *symbols;
+  }
+
+  return total_cost;
+}
+
+uint64_t type_symbols(const uint8_t *symbols, size_t size,
+                      const std::vector<Fingers> *key_map) {
+  IgnoreTransitions ignore;
+  return type_symbols_observed(symbols, size, key_map, ignore);
+}
+
+uint64_t type_text(const char *text, const std::vector<Fingers> key_map[256]) {
+  return type_symbols(reinterpret_cast<const uint8_t *>(text), strlen(text),
+                      key_map);
+}
+
+// Firmware timing
+// ---------------
+//
+// `type_text` only measures how long it takes the fingers to reach each chord.
+// The firmware (src/ChordEngine.cpp) adds its own delays on top of that:
+//
+// - A chord is sent as soon as it's pressed only if `FindUniqueAction()` can
+//   reach exactly one action from the buttons that are down. Otherwise the
+//   firmware waits until the first finger is released.
+// - Every chord gets a shifted twin on the pinky. As long as the pinky is not
+//   pressed, both of them are reachable so nothing is unique at press time.
+// - Arpeggios can only start once all buttons are up. The second button must
+//   come at least kArpeggioMinSpacingMillis after the first one and the
+//   arpeggio fires when one of them is released.
+
+constexpr uint32_t ARPEGGIO_MIN_SPACING_MS = 80; // kArpeggioMinSpacingMillis
+constexpr uint32_t ARPEGGIO_MAX_HOLD_MS = 240;   // kArpeggioMaxHoldMillis
+
+// Releasing a finger is assumed to take as long as pressing it (the same
+// assumption is behind the re-press penalty in `transition_to`).
+constexpr uint32_t release_cost(int finger, int row) {
+  return FINGER_PRESS_COST_MS[finger][row];
+}
+
+constexpr uint32_t max_release_cost() {
+  uint32_t max_cost = 0;
+  for (int finger = 0; finger < NUM_FINGERS; ++finger) {
+    for (int row = 0; row < MAX_BUTTONS; ++row) {
+      if (release_cost(finger, row) > max_cost) {
+        max_cost = release_cost(finger, row);
+      }
+    }
+  }
+  return max_cost;
+}
+
+// Otherwise some of the arpeggios would time out before being released.
+static_assert(max_release_cost() <= ARPEGGIO_MAX_HOLD_MS);
+
+// Dense code for a chord - two bits per finger (0 = not pressed).
+using ChordCode = uint8_t;
+static_assert(NUM_FINGERS * 2 <= 8);
+
+inline ChordCode chord_code(const Fingers &chord) {
+  ChordCode code = 0;
+  for (int i = 0; i < NUM_FINGERS; ++i) {
+    if (chord.is_pressed(i)) {
+      code |= (chord.get(i) + 1) << (2 * i);
+    }
+  }
+  return code;
+}
+
+// Time between the last finger reaching `chord` and the first one leaving it.
+inline uint32_t release_latency(const Fingers &chord) {
+  uint32_t best = 0;
+  Bitmask fingers = chord.pressed;
+  while (fingers) {
+    int finger = std::countr_zero(fingers);
+    fingers &= ~(1 << finger);
+    uint32_t cost = release_cost(finger, chord.get(finger));
+    if (best == 0 || cost < best) {
+      best = cost;
+    }
+  }
+  return best;
+}
+
+// A chord (or an arpeggio) as the firmware resolves it.
+struct FirmwareChord {
+  // First button of an arpeggio. Nothing is pressed for regular chords.
+  Fingers first;
+  // The chord to press (or the second button of an arpeggio).
+  Fingers target;
+  // Delay between reaching `target` and the firmware sending the key.
+  uint32_t fire_latency;
+
+  bool is_arpeggio() const { return first.pressed != 0; }
+};
+
+// Returns true if `FindUniqueAction()` would fire `chord` right when it's
+// pressed. `layout` should contain every chord that has an action assigned.
+// With `shift_layer` every chord is assumed to also have a shifted variant on
+// the pinky (like the "Add Shifts" loop in the firmware does).
+inline bool is_press_time_unique(const Fingers &chord,
+                                 const std::vector<Fingers> &layout,
+                                 bool shift_layer) {
+  if (shift_layer) {
+    // The pinky is not simulated, so it's never pressed.
+    return false;
+  }
+  int reachable = 0;
+  for (const Fingers &other : layout) {
+    if ((other.pressed & chord.pressed) != chord.pressed) {
+      continue;
+    }
+    bool same_rows = true;
+    Bitmask fingers = chord.pressed;
+    while (fingers) {
+      int finger = std::countr_zero(fingers);
+      fingers &= ~(1 << finger);
+      same_rows &= other.get(finger) == chord.get(finger);
+    }
+    if (same_rows && ++reachable > 1) {
+      return false;
+    }
+  }
+  return reachable == 1;
+}
+
+// Two single-button chords, pressed one after another.
+using Arpeggio = std::pair<Fingers, Fingers>;
+
+// Resolves the chords of a layout into `FirmwareChord`s. The result can be
+// used with `type_text_firmware`. `reserved` lists chords that have an action
+// in the firmware but don't type any of the characters from the corpus.
+inline void compile_firmware_layout(const std::vector<Fingers> key_map[256],
+                                    const std::vector<Arpeggio> arpeggios[256],
+                                    const std::vector<Fingers> &reserved,
+                                    bool shift_layer,
+                                    std::vector<FirmwareChord> out[256]) {
+  std::vector<Fingers> layout = reserved;
+  for (int i = 0; i < 256; ++i) {
+    layout.insert(layout.end(), key_map[i].begin(), key_map[i].end());
+  }
+  bool unique[256] = {};
+  for (const Fingers &chord : layout) {
+    unique[chord_code(chord)] =
+        is_press_time_unique(chord, layout, shift_layer);
+  }
+  for (int i = 0; i < 256; ++i) {
+    out[i].clear();
+    for (const Fingers &chord : key_map[i]) {
+      out[i].push_back(FirmwareChord{
+          .first = {},
+          .target = chord,
+          .fire_latency =
+              unique[chord_code(chord)] ? 0 : release_latency(chord),
+      });
+    }
+    for (const auto &[first, second] : arpeggios[i]) {
+      Fingers both = second;
+      int finger = std::countr_zero(first.pressed);
+      both.press_idx(finger);
+      both.set(finger, first.get(finger));
+      out[i].push_back(FirmwareChord{
+          .first = first,
+          .target = second,
+          .fire_latency = release_latency(both),
+      });
+    }
+  }
+}
+
+// Cost of entering `chord` from `fingers`, including the time the firmware
+// needs to decide to send it.
+inline uint32_t firmware_transition(Fingers &fingers,
+                                    const FirmwareChord &chord) {
+  if (!chord.is_arpeggio()) {
+    return fingers.transition_to(chord.target) + chord.fire_latency;
+  }
+  // Releasing the current chord is what allows the arpeggio to start.
+  fingers.release_mask(fingers.pressed);
+  uint32_t cost = fingers.transition_to(chord.first);
+  // The first button stays down while the second one is pressed.
+  Bitmask first = fingers.pressed;
+  fingers.release_mask(first);
+  uint32_t second = fingers.transition_to(chord.target);
+  fingers.press_mask(first);
+  cost += second > ARPEGGIO_MIN_SPACING_MS ? second : ARPEGGIO_MIN_SPACING_MS;
+  return cost + chord.fire_latency;
+}
+
+// Same as `type_symbols` but follows the firmware's rules about when the keys
+// are actually sent.
+uint64_t type_symbols_firmware(const uint8_t *symbols, size_t size,
+                               const std::vector<FirmwareChord> *key_map) {
+  Fingers fingers = {};
+  uint64_t total_cost = 0;
+
+  for (const uint8_t *end = symbols + size; symbols != end; ++symbols) {
+    const std::vector<FirmwareChord> &available_chords = key_map[*symbols];
+
+    if (available_chords.empty()) {
+      fingers = {};
+    } else if (available_chords.size() == 1) {
+      total_cost += firmware_transition(fingers, available_chords[0]);
+    } else {
+      uint32_t min_cost = UINT32_MAX;
+      Fingers best_fingers;
+
+      for (const FirmwareChord &target : available_chords) {
+        Fingers target_fingers = fingers;
+        uint32_t cost = firmware_transition(target_fingers, target);
+        if (cost < min_cost) {
+          min_cost = cost;
+          best_fingers = target_fingers;
+        }
+      }
+
+      fingers = best_fingers;
       total_cost += min_cost;
     }
   }
 
   return total_cost;
 }
+
+uint64_t type_text_firmware(const char *text,
+                            const std::vector<FirmwareChord> key_map[256]) {
+  return type_symbols_firmware(reinterpret_cast<const uint8_t *>(text),
+                               strlen(text), key_map);
+}
@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+"""
+Island model optimizer for chording keyboard layouts.
+
+Runs several independent optimizers ("islands") as separate processes. Each
+island keeps its own current layout and every few seconds sends its best one
+to the next island in a ring. Messages travel over Unix datagram sockets and
+are never waited for - a busy island simply picks up immigrants the next time
+it checks its mailbox. There is no global barrier, so the islands scale with
+the number of cores and slow islands don't hold back the fast ones.
+
+Islands can run different algorithms:
+    - "qap" - tabu search on the bigram QAP (see qap.cpp), re-scored exactly
+    - "anneal" - simulated annealing over the single-swap mutations
+
+The coordinator (main process) only listens for improvements and saves the
+best layout to islands_best.txt.
+
+With --daemon the annealing islands score their candidates on a running
+scoring_daemon.py, whose cache is shared by all islands.
+"""
+
+import argparse
+import json
+import math
+import os
+import random
+import socket
+import tempfile
+import time
+from multiprocessing import Process, cpu_count
+from typing import Dict, List, Optional, Tuple
+
+import keyer_simulator_native
+from beam_optimizer import load_corpus, evaluate_layout
+from layout import load_layout, save_layout
+from mutator import sample_mutations
+from planner import (
+    FORCED_ASSIGNMENTS,
+    generate_all_possible_chords,
+    remove_reserved_chords,
+)
+from scoring_daemon import ScoringClient, add_daemon_argument
+
+# Seconds between sending the best layout to the neighbouring island
+MIGRATION_INTERVAL = 10.0
+
+# Upper bound of a single message (a layout is ~2 KB of JSON)
+MAX_MESSAGE_SIZE = 65536
+
+
+class Mailbox:
+    """
+    Non-blocking Unix datagram socket of one island (or the coordinator).
+
+    Messages are (cost, layout) pairs encoded as JSON. Sending never blocks -
+    if the receiver's queue is full the message is dropped.
+    """
+
+    def __init__(self, directory: str, name: str):
+        self.directory = directory
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        self.sock.bind(os.path.join(directory, name))
+        self.sock.setblocking(False)
+
+    def send(self, name: str, cost: float, layout: Dict[str, str], sender: int):
+        message = json.dumps({"cost": cost, "layout": layout, "from": sender})
+        try:
+            self.sock.sendto(message.encode(), os.path.join(self.directory, name))
+        except (BlockingIOError, FileNotFoundError, ConnectionRefusedError):
+            pass
+
+    def receive(self, timeout: Optional[float] = None) -> List[dict]:
+        """Return all pending messages, waiting up to `timeout` for the first one."""
+        messages = []
+        if timeout is not None:
+            self.sock.settimeout(timeout)
+        try:
+            while True:
+                data = self.sock.recv(MAX_MESSAGE_SIZE)
+                messages.append(json.loads(data))
+                self.sock.setblocking(False)
+        except (BlockingIOError, socket.timeout):
+            pass
+        self.sock.setblocking(False)
+        return messages
+
+
+class Island:
+    """Shared state & migration logic of a single island."""
+
+    def __init__(
+        self,
+        index: int,
+        num_islands: int,
+        mailbox_dir: str,
+        corpus: Tuple[str, bytes],
+        layout: Dict[str, str],
+        cost: float,
+    ):
+        self.index = index
+        self.num_islands = num_islands
+        self.mailbox = Mailbox(mailbox_dir, f"island-{index}")
+        self.corpus = corpus
+        self.rng = random.Random(index)
+        self.layout = layout
+        self.cost = cost
+        self.best_layout = layout
+        self.best_cost = cost
+        self.last_migration = time.time()
+
+    def offer(self, layout: Dict[str, str], cost: float) -> bool:
+        """Record a new current layout. Returns True if it's the island's best."""
+        self.layout = layout
+        self.cost = cost
+        if cost >= self.best_cost:
+            return False
+        self.best_layout = layout
+        self.best_cost = cost
+        self.mailbox.send("coordinator", cost, layout, self.index)
+        return True
+
+    def migrate(self):
+        """Exchange elites with the neighbours (without waiting for them)."""
+        for message in self.mailbox.receive():
+            if message["cost"] < self.best_cost:
+                self.offer(message["layout"], message["cost"])
+        if time.time() - self.last_migration >= MIGRATION_INTERVAL:
+            neighbour = (self.index + 1) % self.num_islands
+            self.mailbox.send(
+                f"island-{neighbour}", self.best_cost, self.best_layout, self.index
+            )
+            self.last_migration = time.time()
+
+
+def run_qap_island(island: Island, all_chords: List[str], iterations: int = 2000):
+    """Repeated tabu search rounds, each starting from the island's best layout."""
+    fixed = "".join(FORCED_ASSIGNMENTS)
+    round_idx = 0
+    while True:
+        island.migrate()
+        results = keyer_simulator_native.optimize_qap(
+            island.best_layout,
+            all_chords,
+            fixed,
+            island.corpus,
+            iterations=iterations,
+            top_k=5,
+            seed=island.index * 1000003 + round_idx,
+        )
+        exact, _, layout = results[0]
+        island.offer(layout, exact)
+        round_idx += 1
+
+
+def run_anneal_island(
+    island: Island, temperature: float = 0.002, daemon: Optional[str] = None
+):
+    """
+    Simulated annealing over single-swap mutations.
+
+    `temperature` is relative to the current cost - a move that makes the layout
+    0.2% worse is accepted with probability 1/e. The temperature decays slowly
+    and is reset whenever an immigrant replaces the current layout.
+
+    Proposals favour moving the characters that cost the most in the current
+    layout (see score_layout_attributed) - swapping two cheap characters rarely
+    helps.
+
+    `daemon` is the socket of a scoring_daemon.py to score the candidates on.
+    """
+    client = ScoringClient(daemon) if daemon else None
+    relative_temperature = temperature
+    attributed_layout = None
+    while True:
+        previous_best = island.best_cost
+        island.migrate()
+        if island.best_cost < previous_best:
+            relative_temperature = temperature
+
+        if island.layout is not attributed_layout:
+            attributed_layout = island.layout
+            _, per_char = keyer_simulator_native.score_layout_attributed(
+                {char: [chord] for char, chord in island.layout.items()},
+                island.corpus,
+            )
+            attribution = {
+                char: incoming + outgoing
+                for char, (incoming, outgoing) in per_char.items()
+            }
+        candidates = sample_mutations(island.layout, attribution, 200, island.rng)
+        if not candidates:
+            return
+        for candidate in candidates:
+            if client:
+                cost = client.score([candidate])[0]
+            else:
+                cost = evaluate_layout(candidate, island.corpus)
+            delta = cost - island.cost
+            threshold = relative_temperature * island.cost
+            if delta < 0 or (
+                threshold > 0 and island.rng.random() < math.exp(-delta / threshold)
+            ):
+                island.offer(candidate, cost)
+                break
+        relative_temperature *= 0.99
+
+
+def island_main(
+    index: int,
+    num_islands: int,
+    algorithm: str,
+    mailbox_dir: str,
+    corpus: Tuple[str, bytes],
+    layout: Dict[str, str],
+    cost: float,
+    all_chords: List[str],
+    daemon: Optional[str],
+):
+    island = Island(index, num_islands, mailbox_dir, corpus, layout, cost)
+    if algorithm == "qap":
+        run_qap_island(island, all_chords)
+    elif algorithm == "anneal":
+        run_anneal_island(island, daemon=daemon)
+    else:
+        raise ValueError(f"Unknown island algorithm: {algorithm}")
+
+
+def main():
+    """Start the islands and collect their results."""
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    add_daemon_argument(parser)
+    args = parser.parse_args()
+
+    print("Chording Keyboard Layout Island Optimizer")
+    print("=" * 60)
+
+    print("\nLoading corpus...")
+    corpus = load_corpus("corpus/*", qwerty_compatible=True)
+    print(f"Loaded corpus: {len(corpus)} characters")
+
+    print("\nLoading initial layout from best_layout.txt...")
+    initial_layout = load_layout("best_layout.txt")
+    initial_score = evaluate_layout(initial_layout, corpus, verbose=True)
+    compiled_corpus = keyer_simulator_native.compile_corpus(corpus)
+
+    all_chords = generate_all_possible_chords(4)
+    remove_reserved_chords(all_chords)
+
+    # Half of the islands run each algorithm
+    num_islands = max(2, cpu_count())
+    algorithms = ["qap" if i % 2 == 0 else "anneal" for i in range(num_islands)]
+    print(f"\nStarting {num_islands} islands: {', '.join(algorithms)}")
+    print(f"Migration interval: {MIGRATION_INTERVAL:.0f}s")
+
+    best_layout = initial_layout
+    best_score = initial_score
+    with tempfile.TemporaryDirectory(prefix="keyer-islands-") as mailbox_dir:
+        coordinator = Mailbox(mailbox_dir, "coordinator")
+        islands = [
+            Process(
+                target=island_main,
+                args=(
+                    i,
+                    num_islands,
+                    algorithms[i],
+                    mailbox_dir,
+                    compiled_corpus,
+                    initial_layout,
+                    initial_score,
+                    all_chords,
+                    args.daemon,
+                ),
+                daemon=True,
+            )
+            for i in range(num_islands)
+        ]
+        for island in islands:
+            island.start()
+
+        start = time.time()
+        try:
+            while any(island.is_alive() for island in islands):
+                for message in coordinator.receive(timeout=1.0):
+                    if message["cost"] >= best_score:
+                        continue
+                    best_layout = message["layout"]
+                    best_score = message["cost"]
+                    island_idx = message["from"]
+                    print(
+                        f"[{time.time() - start:7.1f}s] Island {island_idx} "
+                        f"({algorithms[island_idx]}): new best {best_score:.1f}ms"
+                    )
+                    save_layout(
+                        layout=best_layout,
+                        score=best_score,
+                        corpus_length=len(corpus),
+                        generation=0,
+                        filepath="islands_best.txt",
+                    )
+        except KeyboardInterrupt:
+            print("\nStopping islands...")
+        finally:
+            for island in islands:
+                island.terminate()
+            for island in islands:
+                island.join()
+
+    print("\n" + "=" * 60)
+    print("Optimization Results:")
+    print(f"Best score: {best_score:.1f}ms")
+    print(f"Improvement: {initial_score - best_score:.1f}ms")
+    print(f"Improvement %: {(initial_score - best_score) / initial_score * 100:.2f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,41 +1,162 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
 // Include the core Fingers logic
+#include "alphabet.cpp"
 #include "fingers.cpp"
+#include "branch_and_bound.cpp"
+#include "comparison.cpp"
+#include "coreset.cpp"
+#include "qap.cpp"
 
-// Python wrapper functions
-static PyObject *score_layout(PyObject *self, PyObject *args) {
-  PyObject *key_map_obj;
-  const char *text;
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <thread>
 
-  if (!PyArg_ParseTuple(args, "Os", &key_map_obj, &text)) {
-    return NULL;
+// Text to be typed, encoded with a dense alphabet. Either a plain str (the
+// alphabet is then built from the layout's characters), a corpus prepared by
+// `compile_corpus` (the alphabet comes with the corpus) or a coreset from
+// `build_coreset` (a compiled corpus split into weighted windows).
+struct Corpus {
+  Alphabet alphabet;
+  bool compiled = false;
+  const SymbolId *ids = nullptr;
+  size_t size = 0;
+  // Backing storage for `ids` when the text is a str.
+  std::vector<SymbolId> encoded;
+  std::string_view text;
+  // Coreset windows (see coreset.cpp). `weights` is null for plain corpora.
+  const uint32_t *starts = nullptr;
+  const double *weights = nullptr;
+  size_t num_windows = 0;
+};
+
+// Cost of typing the whole corpus. `type` is `type_symbols` or one of its
+// variants.
+template <typename KeyMap, typename Type>
+static uint64_t type_corpus(const Corpus &corpus, const KeyMap *key_map,
+                            Type type) {
+  if (corpus.weights == nullptr) {
+    return type(corpus.ids, corpus.size, key_map);
+  }
+  return std::llround(weighted_cost(corpus.ids, corpus.starts, corpus.weights,
+                                    corpus.num_windows, key_map, type));
+}
+
+// Reads the text argument. `finish_corpus` must be called after the layout
+// was parsed (it may add characters to the alphabet).
+static bool parse_corpus(PyObject *corpus_obj, Corpus &corpus) {
+  if (PyUnicode_Check(corpus_obj)) {
+    Py_ssize_t size;
+    const char *text = PyUnicode_AsUTF8AndSize(corpus_obj, &size);
+    if (text == NULL) {
+      return false;
+    }
+    corpus.text = std::string_view(text, size);
+    return true;
+  }
+  PyObject *alphabet_obj, *ids_obj, *starts_obj = NULL, *weights_obj = NULL;
+  if (!PyTuple_Check(corpus_obj) ||
+      !PyArg_ParseTuple(corpus_obj, "UO!|O!O!", &alphabet_obj, &PyBytes_Type,
+                        &ids_obj, &PyBytes_Type, &starts_obj, &PyBytes_Type,
+                        &weights_obj)) {
+    PyErr_SetString(PyExc_TypeError,
+                    "Text must be a str or a corpus from compile_corpus");
+    return false;
+  }
+  for (Py_ssize_t i = 1; i < PyUnicode_GetLength(alphabet_obj); ++i) {
+    if (corpus.alphabet.add(PyUnicode_ReadChar(alphabet_obj, i)) != i) {
+      PyErr_SetString(PyExc_ValueError, "Malformed corpus alphabet");
+      return false;
+    }
+  }
+  corpus.compiled = true;
+  corpus.ids = reinterpret_cast<const SymbolId *>(PyBytes_AS_STRING(ids_obj));
+  corpus.size = PyBytes_GET_SIZE(ids_obj);
+  if (weights_obj) {
+    corpus.starts =
+        reinterpret_cast<const uint32_t *>(PyBytes_AS_STRING(starts_obj));
+    corpus.weights =
+        reinterpret_cast<const double *>(PyBytes_AS_STRING(weights_obj));
+    corpus.num_windows = PyBytes_GET_SIZE(weights_obj) / sizeof(double);
+    bool valid = PyBytes_GET_SIZE(starts_obj) ==
+                     static_cast<Py_ssize_t>((corpus.num_windows + 1) *
+                                             sizeof(uint32_t)) &&
+                 corpus.starts[0] == 0;
+    for (size_t i = 0; valid && i < corpus.num_windows; ++i) {
+      valid = corpus.starts[i] <= corpus.starts[i + 1] &&
+              corpus.starts[i + 1] <= corpus.size;
+    }
+    if (!valid) {
+      PyErr_SetString(PyExc_ValueError, "Malformed coreset");
+      return false;
+    }
+  }
+  return true;
+}
+
+static void finish_corpus(Corpus &corpus) {
+  if (!corpus.compiled) {
+    corpus.encoded = encode(corpus.text, corpus.alphabet);
+    corpus.ids = corpus.encoded.data();
+    corpus.size = corpus.encoded.size();
+  }
+}
+
+// Returns the ID of a single-character Python string. Characters that don't
+// appear in a compiled corpus get OTHER_SYMBOL. Returns -1 with a Python
+// exception set on error.
+static int symbol_of_key(PyObject *key, Corpus &corpus) {
+  if (!PyUnicode_Check(key) || PyUnicode_GetLength(key) != 1) {
+    PyErr_SetString(PyExc_ValueError, "Key must be a single character");
+    return -1;
+  }
+  char32_t code_point = PyUnicode_ReadChar(key, 0);
+  if (corpus.compiled) {
+    return corpus.alphabet.find(code_point);
+  }
+  SymbolId id = corpus.alphabet.add(code_point);
+  if (id == OTHER_SYMBOL) {
+    PyErr_SetString(PyExc_ValueError, "Too many characters in the layout");
+    return -1;
+  }
+  return id;
+}
+
+static PyObject *symbol_to_str(const Corpus &corpus, SymbolId id) {
+  return PyUnicode_FromOrdinal(corpus.alphabet.code_points[id]);
+}
+
+// Converts a Python dict of {char: [chord, ...]} into an array indexed by
+// symbol ID. Chords written as "XXXX>YYYY" are arpeggios - they're only
+// accepted when `arpeggios` is given. Returns false with a Python exception set
+// on error.
+static bool parse_key_map(PyObject *key_map_obj, Corpus &corpus,
+                          std::vector<Fingers> key_map[MAX_SYMBOLS],
+                          std::vector<Arpeggio> *arpeggios = nullptr) {
+  if (!PyDict_Check(key_map_obj)) {
+    PyErr_SetString(PyExc_TypeError, "Key map must be a dict");
+    return false;
   }
 
-  // Convert Python dict to C++ array (indexed by character code)
-  std::vector<Fingers> key_map[256];
   PyObject *key, *value;
   Py_ssize_t pos = 0;
 
   while (PyDict_Next(key_map_obj, &pos, &key, &value)) {
-    // Get character key
-    if (!PyUnicode_Check(key)) {
-      PyErr_SetString(PyExc_TypeError, "Key must be a string");
-      return NULL;
+    int id = symbol_of_key(key, corpus);
+    if (id < 0) {
+      return false;
     }
 
-    Py_ssize_t key_size;
-    const char *key_str = PyUnicode_AsUTF8AndSize(key, &key_size);
-    if (key_size != 1) {
-      PyErr_SetString(PyExc_ValueError, "Key must be a single character");
-      return NULL;
-    }
-    unsigned char ch = static_cast<unsigned char>(key_str[0]);
-
     // Get all chords from list
     if (!PyList_Check(value)) {
       PyErr_SetString(PyExc_TypeError, "Value must be a list");
-      return NULL;
+      return false;
+    }
+    if (id == OTHER_SYMBOL) {
+      continue; // never typed
     }
 
     Py_ssize_t num_chords = PyList_Size(value);
@@ -44,24 +165,684 @@ static PyObject *score_layout(PyObject *self, PyObject *args) {
       PyObject *chord_obj = PyList_GetItem(value, i);
       if (!PyUnicode_Check(chord_obj)) {
         PyErr_SetString(PyExc_TypeError, "Chord must be a string");
-        return NULL;
+        return false;
       }
 
       const char *chord_str = PyUnicode_AsUTF8(chord_obj);
-      key_map[ch].push_back(Fingers::FromChord(chord_str));
+      if (const char *second = strchr(chord_str, '>')) {
+        if (arpeggios == nullptr) {
+          PyErr_SetString(PyExc_ValueError,
+                          "Arpeggios are only supported in firmware mode");
+          return false;
+        }
+        Fingers first_button = Fingers::FromChord(chord_str);
+        Fingers second_button = Fingers::FromChord(second + 1);
+        if (std::popcount(first_button.pressed) != 1 ||
+            std::popcount(second_button.pressed) != 1) {
+          PyErr_SetString(PyExc_ValueError,
+                          "Arpeggio must consist of two single-button chords");
+          return false;
+        }
+        arpeggios[id].push_back({first_button, second_button});
+      } else {
+        key_map[id].push_back(Fingers::FromChord(chord_str));
+      }
     }
   }
+  return true;
+}
+
+// Packs a vector into bytes. Unlike "y#", an empty vector gives b"" rather
+// than None (its data() may be NULL).
+template <typename T>
+static PyObject *bytes_from(const std::vector<T> &values) {
+  return PyBytes_FromStringAndSize(
+      values.empty() ? "" : reinterpret_cast<const char *>(values.data()),
+      (Py_ssize_t)(values.size() * sizeof(T)));
+}
+
+// Python wrapper functions
+static PyObject *compile_corpus(PyObject *self, PyObject *args) {
+  const char *text;
+  Py_ssize_t size;
+
+  if (!PyArg_ParseTuple(args, "s#", &text, &size)) {
+    return NULL;
+  }
+
+  Alphabet alphabet;
+  std::vector<SymbolId> ids;
+  Py_BEGIN_ALLOW_THREADS;
+  alphabet = corpus_alphabet(std::string_view(text, size));
+  ids = encode(std::string_view(text, size), alphabet);
+  Py_END_ALLOW_THREADS;
+
+  PyObject *alphabet_str =
+      PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, alphabet.code_points.data(),
+                                alphabet.code_points.size());
+  if (alphabet_str == NULL) {
+    return NULL;
+  }
+  return Py_BuildValue("(NN)", alphabet_str, bytes_from(ids));
+}
+
+static PyObject *score_layout(PyObject *self, PyObject *args) {
+  PyObject *key_map_obj, *corpus_obj;
+
+  if (!PyArg_ParseTuple(args, "OO", &key_map_obj, &corpus_obj)) {
+    return NULL;
+  }
+
+  Corpus corpus;
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  if (!parse_corpus(corpus_obj, corpus) ||
+      !parse_key_map(key_map_obj, corpus, key_map)) {
+    return NULL;
+  }
+  finish_corpus(corpus);
 
   // Run simulation
-  uint64_t cost = type_text(text, key_map);
+  uint64_t cost = type_corpus(corpus, key_map, type_symbols);
 
   return PyLong_FromUnsignedLongLong(cost);
 }
 
+// Splits the cost of every transition between the characters on both ends.
+struct CostAttribution {
+  double weight = 1;
+  // Cost of reaching the character's chord.
+  double incoming[MAX_SYMBOLS] = {};
+  // Cost of leaving the character's chord for the next one.
+  double outgoing[MAX_SYMBOLS] = {};
+
+  void operator()(int previous, int symbol, uint32_t cost, const Fingers &,
+                  const Fingers &) {
+    incoming[symbol] += weight * cost;
+    if (previous >= 0) {
+      outgoing[previous] += weight * cost;
+    }
+  }
+};
+
+static PyObject *score_layout_attributed(PyObject *self, PyObject *args) {
+  PyObject *key_map_obj, *corpus_obj;
+
+  if (!PyArg_ParseTuple(args, "OO", &key_map_obj, &corpus_obj)) {
+    return NULL;
+  }
+
+  Corpus corpus;
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  if (!parse_corpus(corpus_obj, corpus) ||
+      !parse_key_map(key_map_obj, corpus, key_map)) {
+    return NULL;
+  }
+  finish_corpus(corpus);
+
+  CostAttribution attribution;
+  double cost = 0;
+  if (corpus.weights == nullptr) {
+    cost = type_symbols_observed(corpus.ids, corpus.size, key_map, attribution);
+  } else {
+    for (size_t i = 0; i < corpus.num_windows; ++i) {
+      attribution.weight = corpus.weights[i];
+      cost += corpus.weights[i] *
+              type_symbols_observed(corpus.ids + corpus.starts[i],
+                                    corpus.starts[i + 1] - corpus.starts[i],
+                                    key_map, attribution);
+    }
+  }
+
+  PyObject *per_char = PyDict_New();
+  for (int i = 1; i < corpus.alphabet.size(); ++i) {
+    if (key_map[i].empty()) {
+      continue;
+    }
+    PyObject *key = symbol_to_str(corpus, i);
+    PyObject *value = Py_BuildValue("(dd)", attribution.incoming[i],
+                                    attribution.outgoing[i]);
+    PyDict_SetItem(per_char, key, value);
+    Py_DECREF(key);
+    Py_DECREF(value);
+  }
+  return Py_BuildValue("(KN)", (unsigned long long)std::llround(cost),
+                       per_char);
+}
+
+// Types the corpus with both layouts (on two threads) and reports where the
+// costs differ.
+static PyObject *compare_layouts(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  static const char *kwlist[] = {"a", "b", "text", "top", NULL};
+  PyObject *key_map_a_obj, *key_map_b_obj, *corpus_obj;
+  Py_ssize_t top = 20;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|n",
+                                   const_cast<char **>(kwlist), &key_map_a_obj,
+                                   &key_map_b_obj, &corpus_obj, &top)) {
+    return NULL;
+  }
+
+  Corpus corpus;
+  std::vector<Fingers> key_map[2][MAX_SYMBOLS];
+  if (!parse_corpus(corpus_obj, corpus) ||
+      !parse_key_map(key_map_a_obj, corpus, key_map[0]) ||
+      !parse_key_map(key_map_b_obj, corpus, key_map[1])) {
+    return NULL;
+  }
+  finish_corpus(corpus);
+
+  // ~1 MB each, keep them off the stack
+  std::vector<TransitionProfile> profiles(2);
+  double costs[2] = {};
+  std::vector<BigramDifference> differences;
+  Py_BEGIN_ALLOW_THREADS;
+  auto profile = [&](int i) {
+    if (corpus.weights == nullptr) {
+      costs[i] = type_symbols_observed(corpus.ids, corpus.size, key_map[i],
+                                       profiles[i]);
+      return;
+    }
+    for (size_t w = 0; w < corpus.num_windows; ++w) {
+      profiles[i].weight = corpus.weights[w];
+      costs[i] += corpus.weights[w] *
+                  type_symbols_observed(corpus.ids + corpus.starts[w],
+                                        corpus.starts[w + 1] - corpus.starts[w],
+                                        key_map[i], profiles[i]);
+    }
+  };
+  std::thread thread(profile, 1);
+  profile(0);
+  thread.join();
+  differences = largest_differences(profiles[0], profiles[1],
+                                    std::max<Py_ssize_t>(top, 0));
+  Py_END_ALLOW_THREADS;
+
+  PyObject *bigrams = PyList_New(differences.size());
+  for (size_t i = 0; i < differences.size(); ++i) {
+    const BigramDifference &d = differences[i];
+    char32_t bigram[2] = {corpus.alphabet.code_points[d.previous],
+                          corpus.alphabet.code_points[d.next]};
+    bool from_rest = d.previous == OTHER_SYMBOL;
+    PyObject *bigram_str = PyUnicode_FromKindAndData(
+        PyUnicode_4BYTE_KIND, bigram + from_rest, 2 - from_rest);
+    PyList_SET_ITEM(bigrams, i,
+                    Py_BuildValue("(Nddd)", bigram_str, d.count, d.cost_a,
+                                  d.cost_b));
+  }
+  PyObject *kinds = PyDict_New();
+  for (int kind = 0; kind < NUM_TRANSITION_KINDS; ++kind) {
+    PyObject *value = Py_BuildValue(
+        "(dddd)", profiles[0].kind_count[kind], profiles[0].kind_cost[kind],
+        profiles[1].kind_count[kind], profiles[1].kind_cost[kind]);
+    PyDict_SetItemString(kinds, TRANSITION_KIND_NAMES[kind], value);
+    Py_DECREF(value);
+  }
+  return Py_BuildValue("{s:(KK),s:N,s:N}", "cost",
+                       (unsigned long long)std::llround(costs[0]),
+                       (unsigned long long)std::llround(costs[1]), "bigrams",
+                       bigrams, "kinds", kinds);
+}
+
+// Scores many layouts against the same text on a pool of native threads.
+static PyObject *score_layouts(PyObject *self, PyObject *args) {
+  PyObject *key_maps_obj, *corpus_obj;
+  int threads = 0;
+
+  if (!PyArg_ParseTuple(args, "O!O|i", &PyList_Type, &key_maps_obj,
+                        &corpus_obj, &threads)) {
+    return NULL;
+  }
+
+  Corpus corpus;
+  if (!parse_corpus(corpus_obj, corpus)) {
+    return NULL;
+  }
+  const Py_ssize_t num_layouts = PyList_Size(key_maps_obj);
+  using KeyMap = std::array<std::vector<Fingers>, MAX_SYMBOLS>;
+  std::vector<KeyMap> key_maps(num_layouts);
+  for (Py_ssize_t i = 0; i < num_layouts; ++i) {
+    if (!parse_key_map(PyList_GetItem(key_maps_obj, i), corpus,
+                       key_maps[i].data())) {
+      return NULL;
+    }
+  }
+  finish_corpus(corpus);
+
+  std::vector<uint64_t> costs(num_layouts);
+  Py_BEGIN_ALLOW_THREADS;
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min<Py_ssize_t>(threads, num_layouts);
+  std::atomic<Py_ssize_t> next = 0;
+  auto worker = [&]() {
+    for (Py_ssize_t i; (i = next++) < num_layouts;) {
+      costs[i] = type_corpus(corpus, key_maps[i].data(), type_symbols);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+  Py_END_ALLOW_THREADS;
+
+  PyObject *result = PyList_New(num_layouts);
+  for (Py_ssize_t i = 0; i < num_layouts; ++i) {
+    PyList_SET_ITEM(result, i, PyLong_FromUnsignedLongLong(costs[i]));
+  }
+  return result;
+}
+
+static PyObject *score_layout_firmware(PyObject *self, PyObject *args) {
+  PyObject *key_map_obj, *corpus_obj;
+  PyObject *reserved_obj = NULL;
+  int shift_layer = 1;
+
+  if (!PyArg_ParseTuple(args, "OO|Op", &key_map_obj, &corpus_obj,
+                        &reserved_obj, &shift_layer)) {
+    return NULL;
+  }
+
+  Corpus corpus;
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  std::vector<Arpeggio> arpeggios[MAX_SYMBOLS];
+  if (!parse_corpus(corpus_obj, corpus) ||
+      !parse_key_map(key_map_obj, corpus, key_map, arpeggios)) {
+    return NULL;
+  }
+  finish_corpus(corpus);
+
+  std::vector<Fingers> reserved;
+  if (reserved_obj && reserved_obj != Py_None) {
+    if (!PyList_Check(reserved_obj)) {
+      PyErr_SetString(PyExc_TypeError, "Reserved chords must be a list");
+      return NULL;
+    }
+    for (Py_ssize_t i = 0; i < PyList_Size(reserved_obj); i++) {
+      PyObject *chord_obj = PyList_GetItem(reserved_obj, i);
+      if (!PyUnicode_Check(chord_obj)) {
+        PyErr_SetString(PyExc_TypeError, "Chord must be a string");
+        return NULL;
+      }
+      reserved.push_back(Fingers::FromChord(PyUnicode_AsUTF8(chord_obj)));
+    }
+  }
+
+  std::vector<FirmwareChord> firmware_map[MAX_SYMBOLS];
+  compile_firmware_layout(key_map, arpeggios, reserved, shift_layer,
+                          firmware_map);
+
+  uint64_t cost = type_corpus(corpus, firmware_map, type_symbols_firmware);
+
+  // Report which characters are sent at press time
+  PyObject *unique = PyList_New(0);
+  for (int i = 0; i < corpus.alphabet.size(); ++i) {
+    for (const FirmwareChord &chord : firmware_map[i]) {
+      if (!chord.is_arpeggio() && chord.fire_latency == 0) {
+        PyObject *str = symbol_to_str(corpus, i);
+        PyList_Append(unique, str);
+        Py_DECREF(str);
+        break;
+      }
+    }
+  }
+
+  return Py_BuildValue("(KN)", (unsigned long long)cost, unique);
+}
+
+// Reads a {char: chord} dict (one chord per character). Characters that never
+// appear in a compiled corpus are left out.
+static bool parse_layout(PyObject *layout_obj, Corpus &corpus,
+                         std::vector<SymbolId> &symbols,
+                         std::vector<Fingers> &chords) {
+  if (!PyDict_Check(layout_obj)) {
+    PyErr_SetString(PyExc_TypeError, "Layout must be a dict");
+    return false;
+  }
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  while (PyDict_Next(layout_obj, &pos, &key, &value)) {
+    int id = symbol_of_key(key, corpus);
+    if (id < 0) {
+      return false;
+    }
+    if (!PyUnicode_Check(value)) {
+      PyErr_SetString(PyExc_TypeError, "Chord must be a string");
+      return false;
+    }
+    if (id == OTHER_SYMBOL) {
+      continue;
+    }
+    symbols.push_back(id);
+    chords.push_back(Fingers::FromChord(PyUnicode_AsUTF8(value)));
+  }
+  return true;
+}
+
+static PyObject *chord_to_str(const Fingers &chord) {
+  char str[NUM_FINGERS];
+  for (int i = 0; i < NUM_FINGERS; ++i) {
+    str[i] = chord.is_pressed(i) ? '1' + chord.get(i) : '0';
+  }
+  return PyUnicode_FromStringAndSize(str, NUM_FINGERS);
+}
+
+// Layout & corpus converted into a QAP (see qap.cpp).
+struct QapInput {
+  Corpus corpus;
+  // Alphabet ID of each QAP symbol
+  std::vector<SymbolId> symbols;
+  std::vector<Fingers> locations;
+  std::vector<int> initial;
+  std::vector<bool> fixed;
+  int16_t symbol_of[MAX_SYMBOLS];
+};
+
+// Locations are the allowed chords + the chords already used by the layout.
+static bool parse_qap(PyObject *layout_obj, PyObject *chords_obj,
+                      PyObject *fixed_obj, PyObject *corpus_obj,
+                      QapInput &input) {
+  std::vector<Fingers> initial_chords;
+  if (!parse_corpus(corpus_obj, input.corpus) ||
+      !parse_layout(layout_obj, input.corpus, input.symbols, initial_chords)) {
+    return false;
+  }
+  finish_corpus(input.corpus);
+  if (input.corpus.weights) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Coresets are not supported - use the full corpus");
+    return false;
+  }
+  if (!PyList_Check(chords_obj)) {
+    PyErr_SetString(PyExc_TypeError, "Chords must be a list");
+    return false;
+  }
+
+  int location_of_code[256];
+  std::fill(std::begin(location_of_code), std::end(location_of_code), -1);
+  auto add_location = [&](const Fingers &chord) {
+    int &location = location_of_code[chord_code(chord)];
+    if (location < 0) {
+      location = input.locations.size();
+      input.locations.push_back(chord);
+    }
+    return location;
+  };
+  for (const Fingers &chord : initial_chords) {
+    if (location_of_code[chord_code(chord)] >= 0) {
+      PyErr_SetString(PyExc_ValueError, "Layout assigns a chord twice");
+      return false;
+    }
+    input.initial.push_back(add_location(chord));
+  }
+  for (Py_ssize_t i = 0; i < PyList_Size(chords_obj); i++) {
+    PyObject *chord_obj = PyList_GetItem(chords_obj, i);
+    if (!PyUnicode_Check(chord_obj)) {
+      PyErr_SetString(PyExc_TypeError, "Chord must be a string");
+      return false;
+    }
+    add_location(Fingers::FromChord(PyUnicode_AsUTF8(chord_obj)));
+  }
+
+  std::fill(std::begin(input.symbol_of), std::end(input.symbol_of), -1);
+  input.fixed.resize(input.symbols.size());
+  for (size_t s = 0; s < input.symbols.size(); ++s) {
+    input.symbol_of[input.symbols[s]] = s;
+  }
+  for (Py_ssize_t i = 0; i < PyUnicode_GetLength(fixed_obj); ++i) {
+    SymbolId id = input.corpus.alphabet.find(PyUnicode_ReadChar(fixed_obj, i));
+    if (id != OTHER_SYMBOL && input.symbol_of[id] >= 0) {
+      input.fixed[input.symbol_of[id]] = true;
+    }
+  }
+  return true;
+}
+
+// Exact cost of a QAP solution.
+static uint64_t score_qap_solution(const QapInput &input,
+                                   const std::vector<int> &location_of) {
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  for (size_t s = 0; s < input.symbols.size(); ++s) {
+    key_map[input.symbols[s]].push_back(input.locations[location_of[s]]);
+  }
+  return type_symbols(input.corpus.ids, input.corpus.size, key_map);
+}
+
+static PyObject *qap_solution_to_dict(const QapInput &input,
+                                      const std::vector<int> &location_of) {
+  PyObject *layout = PyDict_New();
+  for (size_t s = 0; s < input.symbols.size(); ++s) {
+    PyObject *key = symbol_to_str(input.corpus, input.symbols[s]);
+    PyObject *chord = chord_to_str(input.locations[location_of[s]]);
+    PyDict_SetItem(layout, key, chord);
+    Py_DECREF(key);
+    Py_DECREF(chord);
+  }
+  return layout;
+}
+
+static PyObject *optimize_qap(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static const char *kwlist[] = {"layout", "chords",    "fixed", "text",
+                                 "iterations", "top_k", "seed",  NULL};
+  PyObject *layout_obj, *chords_obj, *fixed_obj, *corpus_obj;
+  TabuOptions options;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOUO|iiI",
+                                   const_cast<char **>(kwlist), &layout_obj,
+                                   &chords_obj, &fixed_obj, &corpus_obj,
+                                   &options.iterations, &options.top_k,
+                                   &options.seed)) {
+    return NULL;
+  }
+
+  QapInput input;
+  if (!parse_qap(layout_obj, chords_obj, fixed_obj, corpus_obj, input)) {
+    return NULL;
+  }
+
+  std::vector<QapSolution> candidates;
+  std::vector<uint64_t> exact_costs;
+  Py_BEGIN_ALLOW_THREADS;
+  TransitionTable transitions(input.locations);
+  BigramCounts counts(input.corpus.ids, input.corpus.size, input.symbol_of,
+                      input.symbols.size());
+  QapProblem problem{transitions, counts, input.fixed};
+  candidates = tabu_search(problem, input.initial, options);
+  for (const QapSolution &candidate : candidates) {
+    exact_costs.push_back(score_qap_solution(input, candidate.location_of));
+  }
+  Py_END_ALLOW_THREADS;
+
+  // Best exact cost first
+  std::vector<size_t> order(candidates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return exact_costs[a] < exact_costs[b];
+  });
+
+  PyObject *result = PyList_New(0);
+  for (size_t i : order) {
+    PyObject *entry = Py_BuildValue(
+        "(KKN)", (unsigned long long)exact_costs[i],
+        (unsigned long long)candidates[i].cost,
+        qap_solution_to_dict(input, candidates[i].location_of));
+    PyList_Append(result, entry);
+    Py_DECREF(entry);
+  }
+  return result;
+}
+
+static PyObject *optimize_core(PyObject *self, PyObject *args,
+                               PyObject *kwargs) {
+  static const char *kwlist[] = {"layout",    "chords",  "fixed",
+                                 "text",      "core_size", "threads",
+                                 "time_limit", NULL};
+  PyObject *layout_obj, *chords_obj, *fixed_obj, *corpus_obj;
+  int core_size = 12;
+  BranchAndBoundOptions options;
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "OOUO|iid", const_cast<char **>(kwlist), &layout_obj,
+          &chords_obj, &fixed_obj, &corpus_obj, &core_size, &options.threads,
+          &options.time_limit_s)) {
+    return NULL;
+  }
+
+  QapInput input;
+  if (!parse_qap(layout_obj, chords_obj, fixed_obj, corpus_obj, input)) {
+    return NULL;
+  }
+
+  BranchAndBoundResult result;
+  uint64_t exact_cost;
+  std::vector<int> core;
+  Py_BEGIN_ALLOW_THREADS;
+  TransitionTable transitions(input.locations);
+  BigramCounts counts(input.corpus.ids, input.corpus.size, input.symbol_of,
+                      input.symbols.size());
+  QapProblem problem{transitions, counts, input.fixed};
+
+  // The most frequent movable symbols
+  std::vector<std::pair<uint64_t, int>> frequency;
+  for (int s = 0; s < problem.num_symbols(); ++s) {
+    if (input.fixed[s]) {
+      continue;
+    }
+    uint64_t count = counts.start[s];
+    for (int a = 0; a < problem.num_symbols(); ++a) {
+      count += counts(a, s);
+    }
+    frequency.push_back({count, s});
+  }
+  std::sort(frequency.rbegin(), frequency.rend());
+  for (int i = 0; i < core_size && i < (int)frequency.size(); ++i) {
+    core.push_back(frequency[i].second);
+  }
+
+  result = branch_and_bound(problem, input.initial, core, options);
+  exact_cost = score_qap_solution(input, result.best.location_of);
+  Py_END_ALLOW_THREADS;
+
+  std::u32string core_chars;
+  for (int s : core) {
+    core_chars += input.corpus.alphabet.code_points[input.symbols[s]];
+  }
+  PyObject *core_str = PyUnicode_FromKindAndData(
+      PyUnicode_4BYTE_KIND, core_chars.data(), core_chars.size());
+  return Py_BuildValue(
+      "(KKNOKN)", (unsigned long long)exact_cost,
+      (unsigned long long)result.best.cost,
+      qap_solution_to_dict(input, result.best.location_of),
+      result.proven_optimal ? Py_True : Py_False,
+      (unsigned long long)result.nodes, core_str);
+}
+
+static PyObject *build_coreset(PyObject *self, PyObject *args,
+                               PyObject *kwargs) {
+  static const char *kwlist[] = {"key_map", "text",         "ratio", "window",
+                                 "seed",    "test_layouts", NULL};
+  PyObject *key_map_obj, *corpus_obj;
+  double ratio = 0.01;
+  int window = 256;
+  unsigned seed = 0;
+  int test_layouts = 100;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|diIi",
+                                   const_cast<char **>(kwlist), &key_map_obj,
+                                   &corpus_obj, &ratio, &window, &seed,
+                                   &test_layouts)) {
+    return NULL;
+  }
+  if (window <= 0 || ratio <= 0) {
+    PyErr_SetString(PyExc_ValueError, "Window and ratio must be positive");
+    return NULL;
+  }
+
+  Corpus corpus;
+  std::vector<Fingers> key_map[MAX_SYMBOLS];
+  if (!parse_corpus(corpus_obj, corpus) ||
+      !parse_key_map(key_map_obj, corpus, key_map)) {
+    return NULL;
+  }
+  finish_corpus(corpus);
+  if (corpus.weights) {
+    PyErr_SetString(PyExc_ValueError, "Text is already a coreset");
+    return NULL;
+  }
+
+  Coreset coreset;
+  CoresetReport report;
+  Py_BEGIN_ALLOW_THREADS;
+  coreset =
+      select_coreset(corpus.ids, corpus.size, key_map, ratio, window, seed);
+  report = evaluate_coreset(corpus.ids, corpus.size, coreset, key_map,
+                            test_layouts, seed);
+  Py_END_ALLOW_THREADS;
+
+  PyObject *alphabet_str = PyUnicode_FromKindAndData(
+      PyUnicode_4BYTE_KIND, corpus.alphabet.code_points.data(),
+      corpus.alphabet.code_points.size());
+  if (alphabet_str == NULL) {
+    return NULL;
+  }
+  return Py_BuildValue(
+      "((NNNN){s:n,s:d,s:d,s:d,s:d,s:i})", alphabet_str,
+      bytes_from(coreset.ids), bytes_from(coreset.starts),
+      bytes_from(coreset.weights), "size",
+      (Py_ssize_t)coreset.ids.size(), "random_correlation",
+      report.random_correlation, "neighbour_correlation",
+      report.neighbour_correlation, "mean_relative_error",
+      report.mean_relative_error, "max_relative_error",
+      report.max_relative_error, "layouts", report.layouts);
+}
+
 // Module methods
 static PyMethodDef KeyerMethods[] = {
+    {"compile_corpus", compile_corpus, METH_VARARGS,
+     "Encode a text with a dense alphabet of its characters. The result can be "
+     "passed instead of the text to the other functions and makes them skip "
+     "the UTF-8 decoding"},
+    {"build_coreset", (PyCFunction)(void (*)(void))build_coreset,
+     METH_VARARGS | METH_KEYWORDS,
+     "Pick a small weighted sample of the text (about `ratio` of it, in "
+     "windows of `window` characters) whose cost tracks the cost of the full "
+     "text. Windows are stratified by their cost with the given key map. "
+     "Returns (coreset, report) - the coreset can be passed instead of the "
+     "text to the scoring functions and the report holds rank correlations "
+     "& relative errors measured on random and neighbouring layouts"},
     {"score_layout", score_layout, METH_VARARGS,
      "Score a keyboard layout by simulating text input"},
+    {"score_layout_attributed", score_layout_attributed, METH_VARARGS,
+     "Same as score_layout but also returns {char: (incoming, outgoing)} - "
+     "the cost of the transitions into and out of each character's chord"},
+    {"compare_layouts", (PyCFunction)(void (*)(void))compare_layouts,
+     METH_VARARGS | METH_KEYWORDS,
+     "Type the text with key maps a and b and explain the difference. Returns "
+     "{'cost': (a, b), 'bigrams': [(bigram, count, cost_a, cost_b), ...], "
+     "'kinds': {kind: (count_a, cost_a, count_b, cost_b)}} with the `top` "
+     "bigrams whose total cost differs the most (a single character is a "
+     "chord typed from the rest position) and the totals per transition kind "
+     "(rest, slide, roll, re-press)"},
+    {"score_layouts", score_layouts, METH_VARARGS,
+     "Score a list of key maps against the same text in parallel. Optional "
+     "third argument is the number of threads (0 = one per core)"},
+    {"score_layout_firmware", score_layout_firmware, METH_VARARGS,
+     "Score a layout with the firmware's timing rules. Takes the key map, "
+     "text, optional list of reserved chords and a shift_layer flag. Returns "
+     "(cost, list of characters sent at press time)"},
+    {"optimize_qap", (PyCFunction)(void (*)(void))optimize_qap,
+     METH_VARARGS | METH_KEYWORDS,
+     "Tabu search over the bigram (QAP) approximation of the layout cost. "
+     "Takes a {char: chord} layout, a list of allowed chords, a string of "
+     "fixed characters and the text. Returns a list of (exact cost, QAP cost, "
+     "layout) for the best candidates, re-scored with the full simulation"},
+    {"optimize_core", (PyCFunction)(void (*)(void))optimize_core,
+     METH_VARARGS | METH_KEYWORDS,
+     "Branch and bound over the chords of the core_size most frequent "
+     "movable characters, with the rest of the layout held in place. Same "
+     "arguments as optimize_qap. Returns (exact cost, QAP cost, layout, "
+     "proven optimal, nodes, core characters)"},
     {NULL, NULL, 0, NULL}};
 
 // Module definition
@@ -16,11 +16,10 @@ protected:
 TEST_F(FingersTransitionTest, DefaultPosition) {
   Fingers fingers{};
   EXPECT_EQ(fingers.pressed, 0u);
-  EXPECT_EQ(fingers.rows[0], MASK_NON_THUMB);
-  EXPECT_EQ(fingers.rows[1], MASK_THUMB);
-  EXPECT_EQ(fingers.rows[2], 0);
   EXPECT_EQ(fingers.finger_to_row[0], 1);
-  EXPECT_EQ(fingers.finger_to_row[1], 0);
+  for (int finger = 1; finger < NUM_FINGERS; ++finger) {
+    EXPECT_EQ(fingers.finger_to_row[finger], 0);
+  }
 }
 
 TEST_F(FingersTransitionTest, NastyRelease) {
@@ -28,7 +27,8 @@ TEST_F(FingersTransitionTest, NastyRelease) {
   Fingers target = Fingers::FromChord("1000");
   uint32_t cost = current.transition_to(target);
 
-  EXPECT_EQ(cost, FINGER_PRESS_COST_MS[0][0]);
+  // The thumb is released & pressed again (with the re-press penalty)
+  EXPECT_EQ(cost, 3 * FINGER_PRESS_COST_MS[0][0]);
   EXPECT_EQ(current.pressed, target.pressed);
 }
 
@@ -55,7 +55,8 @@ TEST_F(FingersTransitionTest, FingerAdd) {
   Fingers target = Fingers::FromChord("2110");
   uint32_t cost = current.transition_to(target);
 
-  EXPECT_EQ(cost, FINGER_PRESS_COST_MS[0][1] + FINGER_PRESS_COST_MS[2][0]);
+  // No finger is released, so the cheapest one (the thumb) is re-pressed
+  EXPECT_EQ(cost, 3 * FINGER_PRESS_COST_MS[0][1] + FINGER_PRESS_COST_MS[2][0]);
   EXPECT_EQ(current.pressed, target.pressed);
 }
 
@@ -88,7 +89,7 @@ TEST_F(FingersTransitionTest, RePressThumb) {
   Fingers current = Fingers::FromChord("2100");
   Fingers target = Fingers::FromChord("2100");
   uint32_t cost = current.transition_to(target);
-  uint32_t expected_cost = FINGER_PRESS_COST_MS[0][1];
+  uint32_t expected_cost = 3 * FINGER_PRESS_COST_MS[0][1];
   EXPECT_EQ(cost, expected_cost);
 }
 
@@ -96,7 +97,7 @@ TEST_F(FingersTransitionTest, RePressIndex) {
   Fingers current = Fingers::FromChord("0101");
   Fingers target = Fingers::FromChord("2111");
   uint32_t cost = current.transition_to(target);
-  uint32_t expected_cost = FINGER_PRESS_COST_MS[1][0] +
+  uint32_t expected_cost = 3 * FINGER_PRESS_COST_MS[1][0] +
                            FINGER_PRESS_COST_MS[0][1] +
                            FINGER_PRESS_COST_MS[2][0];
   EXPECT_EQ(cost, expected_cost);
@@ -115,9 +116,11 @@ TEST_F(FingersTransitionTest, Test) {
   Fingers current = Fingers::FromChord("2001");
   Fingers target = Fingers::FromChord("2011");
   uint32_t cost = current.transition_to(target);
-  uint32_t expected_cost = 0;
+  uint32_t expected_cost =
+      3 * FINGER_PRESS_COST_MS[0][1] + FINGER_PRESS_COST_MS[2][0];
   EXPECT_EQ(cost, expected_cost);
-  EXPECT_TRUE(current.is_pressed(1));
+  EXPECT_TRUE(current.is_pressed(2));
+  EXPECT_EQ(current.pressed, target.pressed);
 }
 
 TEST_F(FingersTransitionTest, LongDistanceTravel) {
@@ -181,7 +184,7 @@ TEST_F(FingersTransitionTest, AllFingersPressedSimultaneously) {
 
   // Test re-press
   uint32_t re_press_cost = current.transition_to(target);
-  EXPECT_EQ(re_press_cost, 40);
+  EXPECT_EQ(re_press_cost, 3 * FINGER_PRESS_COST_MS[0][1]);
 }
 
 TEST_F(FingersTransitionTest, FromChordParsing) {
@@ -197,6 +200,46 @@ TEST_F(FingersTransitionTest, FromChordParsing) {
   EXPECT_EQ(fingers.get(2), 2);
 }
 
+TEST(FirmwareTimingTest, PressTimeUnique) {
+  std::vector<Fingers> layout = {Fingers::FromChord("0100"),
+                                 Fingers::FromChord("0110")};
+  // "0100" is also reachable on the way to "0110"
+  EXPECT_FALSE(is_press_time_unique(layout[0], layout, false));
+  EXPECT_TRUE(is_press_time_unique(layout[1], layout, false));
+  // Shifted variants make everything ambiguous
+  EXPECT_FALSE(is_press_time_unique(layout[1], layout, true));
+}
+
+TEST(FirmwareTimingTest, FireOnRelease) {
+  std::vector<Fingers> key_map[256];
+  std::vector<Arpeggio> arpeggios[256];
+  key_map['a'].push_back(Fingers::FromChord("0100"));
+  key_map['b'].push_back(Fingers::FromChord("0110"));
+  std::vector<FirmwareChord> firmware_map[256];
+  compile_firmware_layout(key_map, arpeggios, {}, false, firmware_map);
+
+  // "a" waits for the index finger to be released, "b" is sent right away
+  EXPECT_EQ(type_text_firmware("a", firmware_map),
+            FINGER_PRESS_COST_MS[1][0] * 2);
+  EXPECT_EQ(type_text_firmware("b", firmware_map),
+            FINGER_PRESS_COST_MS[1][0] + FINGER_PRESS_COST_MS[2][0]);
+}
+
+TEST(FirmwareTimingTest, Arpeggio) {
+  std::vector<Fingers> key_map[256];
+  std::vector<Arpeggio> arpeggios[256];
+  arpeggios['C'].push_back(
+      {Fingers::FromChord("2000"), Fingers::FromChord("0100")});
+  std::vector<FirmwareChord> firmware_map[256];
+  compile_firmware_layout(key_map, arpeggios, {}, true, firmware_map);
+
+  // The second press is slowed down to respect the arpeggio spacing
+  uint32_t expected_cost = FINGER_PRESS_COST_MS[0][1] +
+                           ARPEGGIO_MIN_SPACING_MS +
+                           FINGER_PRESS_COST_MS[0][1];
+  EXPECT_EQ(type_text_firmware("C", firmware_map), expected_cost);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -6,7 +6,8 @@ Provides a generator function that produces all valid single-swap mutations
 of a given layout while maintaining layout invariants.
 """
 
-from typing import Dict, Set, Optional, Generator
+import random
+from typing import Dict, List, Set, Optional, Generator
 from xxlimited import new
 
 
@@ -129,3 +130,44 @@ def mutate_layout(layout: Dict[str, str]) -> Generator[Dict[str, str], None, Non
                 if key2:
                     new_layout[key2] = chord1
                 yield new_layout
+
+
+def moved_characters(layout: Dict[str, str], variant: Dict[str, str]) -> Set[str]:
+    """Characters whose chord differs between two layouts."""
+    return {char for char, chord in variant.items() if layout.get(char) != chord}
+
+
+def sample_mutations(
+    layout: Dict[str, str],
+    attribution: Dict[str, float],
+    count: int,
+    rng: random.Random,
+) -> List[Dict[str, str]]:
+    """
+    Sample mutations, favouring the ones that move expensive characters.
+
+    Args:
+        layout: Current layout (char -> chord mapping)
+        attribution: Cost attributed to each character, e.g. incoming + outgoing
+            from keyer_simulator_native.score_layout_attributed
+        count: Number of distinct mutations to return
+        rng: Random number generator
+
+    Returns:
+        List of mutated layouts, in the order they were drawn
+    """
+    candidates = list(mutate_layout(layout))
+    if not candidates:
+        return []
+    # Every mutation keeps a small chance - cheap characters may still be
+    # in the way of the expensive ones
+    floor = max(attribution.values(), default=0) * 0.01 + 1
+    # Weighted sampling without replacement: the `count` largest u^(1/w) keys
+    keyed = []
+    for variant in candidates:
+        weight = floor + sum(
+            attribution.get(char, 0) for char in moved_characters(layout, variant)
+        )
+        keyed.append((rng.random() ** (1 / weight), variant))
+    keyed.sort(key=lambda item: item[0], reverse=True)
+    return [variant for _, variant in keyed[:count]]
@@ -0,0 +1,31 @@
+"""Tests for the Python bindings of keyer_simulator_native."""
+
+import unittest
+
+import keyer_simulator_native as native
+
+LAYOUT = {"a": ["1000"], "b": ["0100"]}
+
+
+class EmptyCorpusTest(unittest.TestCase):
+    def test_compile_returns_empty_bytes(self):
+        alphabet, ids = native.compile_corpus("")
+        self.assertIsInstance(alphabet, str)
+        self.assertEqual(ids, b"")
+
+    def test_compiled_empty_corpus_scores_zero(self):
+        corpus = native.compile_corpus("")
+        self.assertEqual(native.score_layout(LAYOUT, corpus), 0)
+
+    def test_coreset_of_empty_corpus(self):
+        (alphabet, ids, starts, weights), report = native.build_coreset(
+            LAYOUT, native.compile_corpus(""))
+        self.assertEqual(ids, b"")
+        self.assertEqual(weights, b"")
+        self.assertEqual(report["size"], 0)
+        self.assertEqual(
+            native.score_layout(LAYOUT, (alphabet, ids, starts, weights)), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -4,17 +4,23 @@ Keyboard layout planner and optimizer.
 
 Uses Ant Colony Optimization to generate and optimize chording keyboard layouts
 by scoring against real text corpus.
+
+With --daemon the layouts are scored by a running scoring_daemon.py, which
+keeps the corpus loaded and remembers the costs of layouts it has seen.
 """
 
+import argparse
 import glob
 import random
 from typing import List, Dict, Set, Tuple
 from collections import Counter
 from multiprocessing import Pool, cpu_count
 
+from chord_stats import CHORD_STATS_SUFFIX, load_chord_stats
 from qwerty_analysis import QwertyKeys
 from keyer_simulator import KeyerLayout, FINGER_KEY_COUNT
 import keyer_simulator_native
+from scoring_daemon import ScoringClient, add_daemon_argument
 
 
 # version with single-chord alt variants for polish letters "best_pl.txt"
@@ -23,6 +29,11 @@ import keyer_simulator_native
 # version with single-key combos for Ctrl+C, Ctrl+V, Ctrl+X, Ctrl+Z
 ogonki = ""
 
+# Score layouts using the firmware's rules about when keys are sent (on press
+# for unique chords, on release otherwise). Slightly slower but more honest
+# about the end-to-end latency.
+firmware_timing = False
+
 ogonki_chords = [
     "000",
     "001",
@@ -77,6 +88,57 @@ def generate_all_possible_chords(num_fingers: int = 5) -> List[str]:
     return chords
 
 
+# Define forced chord assignments
+FORCED_ASSIGNMENTS = {
+    " ": "2000",
+    "\x08": "1000",  # actually backspace (shift+backspace = delete)
+    "\n": "2100",  # actually enter (shift+enter = escape)
+    "\t": "2200",
+}
+
+
+# Chords that the firmware uses for keys that aren't in the corpus. They are
+# never assigned to characters, but in firmware timing mode they still decide
+# which chords are unique at press time.
+RESERVED_CHORDS = [
+    "3100",  # Win+Enter
+    "3200",  # Alt+Tab
+    "3101",  # left
+    "3201",  # Ctrl+left
+    "3011",  # right
+    "3021",  # Ctrl+right
+    "3121",  # home
+    "3211",  # end
+    "3102",  # up
+    "3202",  # page up
+    "3012",  # down
+    "3022",  # page down
+    "3000",  # ctrl
+]
+
+
+def remove_reserved_chords(all_chords: List[str]) -> None:
+    """
+    Remove chords that shouldn't be assigned to characters (in place).
+
+    Args:
+        all_chords: List of 4-finger chords (see generate_all_possible_chords)
+    """
+    # remove chords that would tip the keyer in hand (too much pressure on 2nd row)
+    for thumb in "0123":
+        all_chords.remove(thumb + "222")
+        all_chords.remove(thumb + "220")
+        all_chords.remove(thumb + "022")
+        all_chords.remove(thumb + "202")
+        # all_chords.remove(thumb + "221")
+        # all_chords.remove(thumb + "122")
+        all_chords.remove(thumb + "212")
+
+    for chord in RESERVED_CHORDS:
+        if chord in all_chords:  # page up & down were removed above
+            all_chords.remove(chord)
+
+
 def generate_random_layout(characters: Set[str], num_fingers: int = 5) -> KeyerLayout:
     """
     Generate a random keyboard layout by assigning chords to characters.
@@ -121,6 +183,10 @@ def load_corpus(pattern: str = "corpus/*", qwerty_compatible: bool = False) -> s
     files = glob.glob(pattern, recursive=True)
 
     for filepath in files:
+        if filepath.endswith(CHORD_STATS_SUFFIX):
+            # Already in QWERTY symbols
+            corpus.append(load_chord_stats(filepath))
+            continue
         try:
             with open(filepath, "r", encoding="utf-8", errors="ignore") as f:
                 content = f.read()
@@ -143,7 +209,7 @@ def evaluate_layout(
 
     Args:
         layout: KeyerLayout to evaluate
-        key_sequence: Key sequence to type
+        key_sequence: Key sequence to type (or a corpus from compile_corpus)
         verbose: If True, print detailed scoring information
 
     Returns:
@@ -154,7 +220,12 @@ def evaluate_layout(
         print(f"Layout has mappings for {len(layout.key_map)} characters")
 
     # Score the layout using native C++ simulator
-    total_cost = keyer_simulator_native.score_layout(layout.key_map, key_sequence)
+    if firmware_timing:
+        total_cost, _ = keyer_simulator_native.score_layout_firmware(
+            layout.key_map, key_sequence, RESERVED_CHORDS
+        )
+    else:
+        total_cost = keyer_simulator_native.score_layout(layout.key_map, key_sequence)
 
     if verbose:
         print(f"Total cost: {total_cost:.1f}ms")
@@ -516,6 +587,13 @@ def evaluate_layout_wrapper(args):
 
 def main():
     """Main function to demonstrate layout generation and evaluation using ACO."""
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    add_daemon_argument(parser)
+    args = parser.parse_args()
+    # The daemon scores without the firmware's timing rules
+    if args.daemon and firmware_timing:
+        parser.error("--daemon doesn't support firmware_timing")
+
     print("Chording Keyboard Layout Planner (Ant Colony Optimization)")
     print("=" * 60)
 
@@ -550,37 +628,9 @@ def main():
     else:
         print(f"   OK: Enough chords available")
 
-    # remove chords that would tip the keyer in hand (too much pressure on 2nd row)
-    for thumb in "0123":
-        all_chords.remove(thumb + "222")
-        all_chords.remove(thumb + "220")
-        all_chords.remove(thumb + "022")
-        all_chords.remove(thumb + "202")
-        # all_chords.remove(thumb + "221")
-        # all_chords.remove(thumb + "122")
-        all_chords.remove(thumb + "212")
+    remove_reserved_chords(all_chords)
 
-    all_chords.remove("3100")  # reserved for Win+Enter
-    all_chords.remove("3200")  # reserved for Alt+Tab
-    all_chords.remove("3101")  # reserved for left
-    all_chords.remove("3201")  # reserved for Ctrl+left
-    all_chords.remove("3011")  # reserved for right
-    all_chords.remove("3021")  # reserved for Ctrl+right
-    all_chords.remove("3121")  # reserved for home
-    all_chords.remove("3211")  # reserved for end
-    all_chords.remove("3102")  # reserved for up
-    # all_chords.remove("3202")  # reserved for page up (already removed)
-    all_chords.remove("3012")  # reserved for down
-    # all_chords.remove("3022")  # reserved for page down (already removed)
-    all_chords.remove("3000")  # reserved for ctrl
-
-    # Define forced chord assignments
-    forced_assignments = {
-        " ": "2000",
-        "\x08": "1000",  # actually backspace (shift+backspace = delete)
-        "\n": "2100",  # actually enter (shift+enter = escape)
-        "\t": "2200",
-    }
+    forced_assignments = dict(FORCED_ASSIGNMENTS)
 
     # Add forced characters to the character set if not already present
     for char in forced_assignments.keys():
@@ -615,8 +665,16 @@ def main():
     overall_best_cost = float("inf")
     overall_best_layout = None
 
+    # Encoded once so that the workers don't have to decode UTF-8 every time
+    compiled_corpus = keyer_simulator_native.compile_corpus(corpus)
+
+    client = None
     print(f"   Total layouts to evaluate: {num_generations * layouts_per_generation}")
-    print(f"   Parallel workers: {num_workers} cores")
+    if args.daemon:
+        client = ScoringClient(args.daemon)
+        print(f"   Scoring on the daemon at {args.daemon}")
+    else:
+        print(f"   Parallel workers: {num_workers} cores")
 
     # Print initial pheromone table
     print("\n   Initial pheromone state:")
@@ -631,30 +689,36 @@ def main():
             for _ in range(layouts_per_generation)
         ]
 
-        # Prepare arguments for parallel evaluation
-        eval_args = [(layout, corpus) for layout in layouts]
-
         # Evaluate layouts in parallel
         generation_best_cost = float("inf")
         generation_best_layout = None
 
-        with Pool(processes=num_workers) as pool:
-            # Use imap_unordered for progress tracking
-            for i, (layout, cost) in enumerate(
-                pool.imap_unordered(evaluate_layout_wrapper, eval_args)
-            ):
+        if client:
+            costs = client.score([layout.key_map for layout in layouts])
+            for layout, cost in zip(layouts, costs):
                 if cost < generation_best_cost:
                     generation_best_cost = cost
                     generation_best_layout = layout
+            print(f"      Evaluated: {len(layouts)} layouts on the daemon")
+        else:
+            eval_args = [(layout, compiled_corpus) for layout in layouts]
+            with Pool(processes=num_workers) as pool:
+                # Use imap_unordered for progress tracking
+                for i, (layout, cost) in enumerate(
+                    pool.imap_unordered(evaluate_layout_wrapper, eval_args)
+                ):
+                    if cost < generation_best_cost:
+                        generation_best_cost = cost
+                        generation_best_layout = layout
+
+                    # Update progress (overwrite same line)
+                    print(
+                        f"\r      Evaluated: {i + 1}/{layouts_per_generation} layouts",
+                        end="",
+                        flush=True,
+                    )
 
-                # Update progress (overwrite same line)
-                print(
-                    f"\r      Evaluated: {i + 1}/{layouts_per_generation} layouts",
-                    end="",
-                    flush=True,
-                )
-
-        print()  # New line after progress
+            print()  # New line after progress
 
         # Update pheromones with best layout from this generation
         ant_generator.update_pheromones(generation_best_layout)
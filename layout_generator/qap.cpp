@@ -0,0 +1,307 @@
+// Layout search as a quadratic assignment problem (QAP).
+//
+// If we forget that fingers which are not pressed stay wherever the previous
+// chords left them, the cost of typing `ab` depends only on the chords of `a`
+// and `b`. The cost of a layout then becomes:
+//
+//   sum over bigrams (a, b): count(a, b) * transition(chord(a), chord(b))
+//
+// which is the classic QAP with characters as facilities and chords as
+// locations. Swapping two characters changes only the terms that involve them
+// so the cost delta of a move can be computed in O(characters) instead of a
+// pass over the whole corpus. Tabu search explores that space quickly and the
+// best candidates are re-scored exactly with `type_text`.
+
+#pragma once
+
+#include "fingers.cpp"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_set>
+
+// Chord-to-chord transition costs for a fixed set of chords (the locations).
+struct TransitionTable {
+  std::vector<Fingers> chords;
+  // [from * chords.size() + to]
+  std::vector<uint32_t> cost;
+  // Cost of pressing a chord with all fingers at rest.
+  std::vector<uint32_t> from_rest;
+
+  explicit TransitionTable(const std::vector<Fingers> &chords)
+      : chords(chords), cost(chords.size() * chords.size()),
+        from_rest(chords.size()) {
+    const size_t n = chords.size();
+    for (size_t from = 0; from < n; ++from) {
+      for (size_t to = 0; to < n; ++to) {
+        Fingers fingers = chords[from];
+        cost[from * n + to] = fingers.transition_to(chords[to]);
+      }
+    }
+    for (size_t to = 0; to < n; ++to) {
+      Fingers fingers = {};
+      from_rest[to] = fingers.transition_to(chords[to]);
+    }
+  }
+
+  uint32_t operator()(int from, int to) const {
+    return cost[from * chords.size() + to];
+  }
+};
+
+// How often each character follows another one in the corpus.
+struct BigramCounts {
+  int num_symbols = 0;
+  // [first * num_symbols + second]
+  std::vector<uint64_t> pair;
+  // How often a symbol is typed with the fingers at rest (at the start of the
+  // text or after a character that has no chord).
+  std::vector<uint64_t> start;
+
+  // `symbol_of` maps bytes (or alphabet IDs) to QAP symbols (-1 for
+  // characters without a chord).
+  BigramCounts(const uint8_t *text, size_t size, const int16_t symbol_of[256],
+               int num_symbols)
+      : num_symbols(num_symbols), pair(num_symbols * num_symbols),
+        start(num_symbols) {
+    int previous = -1;
+    for (const uint8_t *end = text + size; text != end; ++text) {
+      int symbol = symbol_of[*text];
+      if (symbol < 0) {
+        // Unknown key - fingers go back to their default position
+      } else if (previous < 0) {
+        ++start[symbol];
+      } else {
+        ++pair[previous * num_symbols + symbol];
+      }
+      previous = symbol;
+    }
+  }
+
+  BigramCounts(const char *text, const int16_t symbol_of[256], int num_symbols)
+      : BigramCounts(reinterpret_cast<const uint8_t *>(text), strlen(text),
+                     symbol_of, num_symbols) {}
+
+  uint64_t operator()(int first, int second) const {
+    return pair[first * num_symbols + second];
+  }
+};
+
+struct QapSolution {
+  // Index into `TransitionTable::chords` for each symbol.
+  std::vector<int> location_of;
+  uint64_t cost = 0;
+};
+
+struct QapProblem {
+  const TransitionTable &transitions;
+  const BigramCounts &counts;
+  // Symbols that must stay where they are in the initial solution.
+  std::vector<bool> fixed;
+
+  int num_symbols() const { return counts.num_symbols; }
+  int num_locations() const { return transitions.chords.size(); }
+
+  uint64_t cost(const std::vector<int> &location_of) const {
+    uint64_t total = 0;
+    for (int a = 0; a < num_symbols(); ++a) {
+      total += counts.start[a] * transitions.from_rest[location_of[a]];
+      for (int b = 0; b < num_symbols(); ++b) {
+        total += counts(a, b) * transitions(location_of[a], location_of[b]);
+      }
+    }
+    return total;
+  }
+
+  // Cost of the terms that involve `symbol` placed at `location`. `other` (if
+  // not -1) is assumed to be placed at `other_location`.
+  int64_t symbol_cost(const std::vector<int> &location_of, int symbol,
+                      int location, int other, int other_location) const {
+    int64_t total = counts.start[symbol] * transitions.from_rest[location] +
+                    counts(symbol, symbol) * transitions(location, location);
+    for (int k = 0; k < num_symbols(); ++k) {
+      if (k == symbol) {
+        continue;
+      }
+      int k_location = k == other ? other_location : location_of[k];
+      total += counts(symbol, k) * transitions(location, k_location) +
+               counts(k, symbol) * transitions(k_location, location);
+    }
+    return total;
+  }
+
+  // Cost change after swapping the contents of two locations. `u` is the
+  // symbol at `a`, `v` is the symbol at `b` (or -1 if `b` is free).
+  int64_t swap_delta(const std::vector<int> &location_of, int u, int a, int v,
+                     int b) const {
+    int64_t before = symbol_cost(location_of, u, a, v, b);
+    int64_t after = symbol_cost(location_of, u, b, v, a);
+    if (v >= 0) {
+      // The u-v terms are already included in the cost of `u`
+      before += symbol_cost(location_of, v, b, u, a) -
+                counts(u, v) * transitions(a, b) -
+                counts(v, u) * transitions(b, a);
+      after += symbol_cost(location_of, v, a, u, b) -
+               counts(u, v) * transitions(b, a) -
+               counts(v, u) * transitions(a, b);
+    }
+    return after - before;
+  }
+};
+
+struct TabuOptions {
+  int iterations = 10000;
+  // Number of distinct solutions to return.
+  int top_k = 20;
+  // Restart from a perturbed best solution after this many iterations without
+  // improvement.
+  int stagnation_limit = 2000;
+  unsigned seed = 0;
+};
+
+// Robust tabu search (Taillard, 1991). A move swaps the chords of two symbols
+// (or moves a symbol to a free chord). Moving a symbol back to a location it
+// recently left is forbidden for a randomized number of iterations unless it
+// leads to a new best solution. Returns the `top_k` best distinct solutions
+// found, best first.
+std::vector<QapSolution> tabu_search(const QapProblem &problem,
+                                     const std::vector<int> &initial,
+                                     const TabuOptions &options = {}) {
+  const int n = problem.num_symbols();
+  const int num_locations = problem.num_locations();
+  std::mt19937 rng(options.seed);
+
+  std::vector<int> location_of = initial;
+  std::vector<int> symbol_at(num_locations, -1);
+  for (int s = 0; s < n; ++s) {
+    symbol_at[location_of[s]] = s;
+  }
+  std::vector<int> movable;
+  for (int s = 0; s < n; ++s) {
+    if (!problem.fixed[s]) {
+      movable.push_back(s);
+    }
+  }
+  std::vector<int> free_locations;
+  for (int l = 0; l < num_locations; ++l) {
+    if (symbol_at[l] < 0 || !problem.fixed[symbol_at[l]]) {
+      free_locations.push_back(l);
+    }
+  }
+
+  // Iteration until which `symbol` may not move to `location`
+  std::vector<int> tabu_until(n * num_locations, 0);
+  const int min_tenure = std::max<int>(1, movable.size() * 9 / 10);
+  const int max_tenure = std::max<int>(min_tenure, movable.size() * 11 / 10);
+  std::uniform_int_distribution<int> tenure(min_tenure, max_tenure);
+
+  int64_t cost = problem.cost(location_of);
+  int64_t best_cost = cost;
+  std::vector<int> best = location_of;
+  int last_improvement = 0;
+
+  // Elite pool - the best distinct solutions seen so far
+  std::vector<QapSolution> elite;
+  std::unordered_set<std::string> elite_keys;
+  auto key_of = [](const std::vector<int> &solution) {
+    return std::string(solution.begin(), solution.end());
+  };
+  auto remember = [&]() {
+    if (static_cast<int>(elite.size()) >= options.top_k &&
+        cost >= static_cast<int64_t>(elite.back().cost)) {
+      return;
+    }
+    std::string key = key_of(location_of);
+    if (!elite_keys.insert(key).second) {
+      return;
+    }
+    QapSolution solution{location_of, static_cast<uint64_t>(cost)};
+    elite.insert(std::upper_bound(elite.begin(), elite.end(), solution,
+                                  [](const QapSolution &a,
+                                     const QapSolution &b) {
+                                    return a.cost < b.cost;
+                                  }),
+                 solution);
+    if (static_cast<int>(elite.size()) > options.top_k) {
+      elite_keys.erase(key_of(elite.back().location_of));
+      elite.pop_back();
+    }
+  };
+  remember();
+
+  auto apply = [&](int u, int b) {
+    int a = location_of[u];
+    int v = symbol_at[b];
+    location_of[u] = b;
+    symbol_at[b] = u;
+    symbol_at[a] = v;
+    if (v >= 0) {
+      location_of[v] = a;
+    }
+  };
+
+  for (int iteration = 1; iteration <= options.iterations && !movable.empty();
+       ++iteration) {
+    int64_t best_delta = INT64_MAX;
+    int best_u = -1, best_b = -1, ties = 0;
+    for (int u : movable) {
+      int a = location_of[u];
+      for (int b : free_locations) {
+        int v = symbol_at[b];
+        // Each swap of two symbols is visited only once
+        if (b == a || (v >= 0 && v < u)) {
+          continue;
+        }
+        int64_t delta = problem.swap_delta(location_of, u, a, v, b);
+        bool tabu = tabu_until[u * num_locations + b] > iteration &&
+                    (v < 0 || tabu_until[v * num_locations + a] > iteration);
+        if (tabu && cost + delta >= best_cost) {
+          continue;
+        }
+        if (delta < best_delta) {
+          best_delta = delta;
+          best_u = u;
+          best_b = b;
+          ties = 1;
+        } else if (delta == best_delta && rng() % ++ties == 0) {
+          best_u = u;
+          best_b = b;
+        }
+      }
+    }
+    if (best_u < 0) {
+      break; // everything is tabu
+    }
+
+    int a = location_of[best_u];
+    int v = symbol_at[best_b];
+    apply(best_u, best_b);
+    cost += best_delta;
+    tabu_until[best_u * num_locations + a] = iteration + tenure(rng);
+    if (v >= 0) {
+      tabu_until[v * num_locations + best_b] = iteration + tenure(rng);
+    }
+    remember();
+
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = location_of;
+      last_improvement = iteration;
+    } else if (iteration - last_improvement > options.stagnation_limit) {
+      // Diversify - continue from a perturbed copy of the best solution
+      location_of = best;
+      std::fill(symbol_at.begin(), symbol_at.end(), -1);
+      for (int s = 0; s < n; ++s) {
+        symbol_at[location_of[s]] = s;
+      }
+      for (size_t i = 0; i < movable.size() / 4; ++i) {
+        apply(movable[rng() % movable.size()],
+              free_locations[rng() % free_locations.size()]);
+      }
+      cost = problem.cost(location_of);
+      last_improvement = iteration;
+    }
+  }
+  return elite;
+}
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""
+Quadratic assignment optimizer for chording keyboard layouts.
+
+Treats the layout as a QAP over character bigrams (see qap.cpp) and runs tabu
+search on it natively. The approximate QAP cost ignores where the idle fingers
+rest, so the best candidates are re-scored with the exact simulator before
+one of them is picked.
+
+Each round first places the most frequent characters optimally with branch
+and bound (see branch_and_bound.cpp), keeping the rest of the layout in place.
+Tabu search then polishes the remaining characters around them.
+
+The candidates are re-scored inside the native search, so --daemon (see
+scoring_daemon.py) only scores the initial layout.
+"""
+
+import argparse
+import time
+
+import keyer_simulator_native
+from beam_optimizer import load_corpus, evaluate_layout
+from layout import load_layout, save_layout
+from planner import (
+    FORCED_ASSIGNMENTS,
+    generate_all_possible_chords,
+    remove_reserved_chords,
+)
+from scoring_daemon import ScoringClient, add_daemon_argument
+
+
+def main():
+    """Main QAP optimization."""
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    add_daemon_argument(parser)
+    args = parser.parse_args()
+
+    print("Chording Keyboard Layout QAP Optimizer")
+    print("=" * 60)
+
+    print("\nLoading corpus...")
+    corpus = load_corpus("corpus/*", qwerty_compatible=True)
+    print(f"Loaded corpus: {len(corpus)} characters")
+
+    print("\nLoading initial layout from best_layout.txt...")
+    initial_layout = load_layout("best_layout.txt")
+    if args.daemon:
+        client = ScoringClient(args.daemon)
+        initial_score = client.score([initial_layout])[0]
+        client.close()
+        print(f"Layout cost: {initial_score:.1f}ms (scoring daemon)")
+    else:
+        initial_score = evaluate_layout(initial_layout, corpus, verbose=True)
+    compiled_corpus = keyer_simulator_native.compile_corpus(corpus)
+
+    all_chords = generate_all_possible_chords(4)
+    remove_reserved_chords(all_chords)
+    fixed = "".join(FORCED_ASSIGNMENTS)
+
+    # Each round restarts from the best layout with a different seed
+    rounds = 10
+    iterations = 10000
+    top_k = 20
+    # Number of characters placed by branch and bound (0 disables it)
+    core_size = 12
+    core_time_limit = 600
+
+    best_layout = initial_layout
+    best_score = initial_score
+    for round_idx in range(rounds):
+        start = time.time()
+        core = ""
+        if core_size:
+            exact, qap_cost, layout, proven, nodes, core = (
+                keyer_simulator_native.optimize_core(
+                    best_layout,
+                    all_chords,
+                    fixed,
+                    compiled_corpus,
+                    core_size=core_size,
+                    time_limit=core_time_limit,
+                )
+            )
+            print(
+                f"Round {round_idx + 1}: core {core!r} "
+                f"{'optimal' if proven else 'best found'} after {nodes} nodes, "
+                f"exact {exact:.1f}ms ({time.time() - start:.1f}s)"
+            )
+            if exact < best_score:
+                best_layout = layout
+                best_score = exact
+                save_layout(
+                    layout=best_layout,
+                    score=best_score,
+                    corpus_length=len(corpus),
+                    generation=round_idx + 1,
+                    filepath="qap_best.txt",
+                )
+
+        start = time.time()
+        results = keyer_simulator_native.optimize_qap(
+            best_layout,
+            all_chords,
+            fixed + core,
+            compiled_corpus,
+            iterations=iterations,
+            top_k=top_k,
+            seed=round_idx,
+        )
+        exact, qap_cost, layout = results[0]
+        print(
+            f"Round {round_idx + 1}: best exact {exact:.1f}ms "
+            f"(QAP estimate {qap_cost:.1f}ms, {len(results)} candidates, "
+            f"{time.time() - start:.1f}s)"
+        )
+        if exact < best_score:
+            best_layout = layout
+            best_score = exact
+            save_layout(
+                layout=best_layout,
+                score=best_score,
+                corpus_length=len(corpus),
+                generation=round_idx + 1,
+                filepath="qap_best.txt",
+            )
+
+    print("\n" + "=" * 60)
+    print("Optimization Results:")
+    print(f"Best score: {best_score:.1f}ms")
+    print(f"Improvement: {initial_score - best_score:.1f}ms")
+    print(f"Improvement %: {(initial_score - best_score) / initial_score * 100:.2f}%")
+
+
+if __name__ == "__main__":
+    main()
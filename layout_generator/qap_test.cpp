@@ -0,0 +1,104 @@
+#include "qap.cpp"
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+
+class QapTest : public ::testing::Test {
+protected:
+  std::vector<Fingers> chords = {
+      Fingers::FromChord("0100"), Fingers::FromChord("0110"),
+      Fingers::FromChord("2000"), Fingers::FromChord("0011"),
+      Fingers::FromChord("1010"), Fingers::FromChord("0201")};
+  int16_t symbol_of[256];
+
+  void SetUp() override {
+    std::fill(std::begin(symbol_of), std::end(symbol_of), -1);
+    symbol_of['a'] = 0;
+    symbol_of['b'] = 1;
+    symbol_of['c'] = 2;
+  }
+};
+
+TEST_F(QapTest, CostMatchesSimulation) {
+  TransitionTable transitions(chords);
+  const char *text = "ab";
+  BigramCounts counts(text, symbol_of, 3);
+  QapProblem problem{transitions, counts, {false, false, false}};
+  std::vector<Fingers> key_map[256];
+  key_map['a'].push_back(chords[1]);
+  key_map['b'].push_back(chords[3]);
+  key_map['c'].push_back(chords[0]);
+  // Without lazy fingers involved, the QAP cost is exact
+  EXPECT_EQ(problem.cost({1, 3, 0}), type_text(text, key_map));
+}
+
+TEST_F(QapTest, SwapDeltaMatchesFullCost) {
+  TransitionTable transitions(chords);
+  BigramCounts counts("abcabbcacbbaccab x cab", symbol_of, 3);
+  QapProblem problem{transitions, counts, {false, false, false}};
+  std::vector<int> location_of = {0, 2, 4};
+  uint64_t cost = problem.cost(location_of);
+  for (int b = 0; b < problem.num_locations(); ++b) {
+    for (int u = 0; u < 3; ++u) {
+      int a = location_of[u];
+      if (a == b) {
+        continue;
+      }
+      int v = -1;
+      for (int s = 0; s < 3; ++s) {
+        if (location_of[s] == b) {
+          v = s;
+        }
+      }
+      std::vector<int> swapped = location_of;
+      swapped[u] = b;
+      if (v >= 0) {
+        swapped[v] = a;
+      }
+      EXPECT_EQ(static_cast<int64_t>(cost) +
+                    problem.swap_delta(location_of, u, a, v, b),
+                static_cast<int64_t>(problem.cost(swapped)));
+    }
+  }
+}
+
+TEST_F(QapTest, TabuFindsOptimum) {
+  TransitionTable transitions(chords);
+  BigramCounts counts("abcabbcacbbaccabcab", symbol_of, 3);
+  QapProblem problem{transitions, counts, {false, false, false}};
+
+  uint64_t optimum = UINT64_MAX;
+  for (int a = 0; a < 6; ++a)
+    for (int b = 0; b < 6; ++b)
+      for (int c = 0; c < 6; ++c)
+        if (a != b && b != c && a != c)
+          optimum = std::min(optimum, problem.cost({a, b, c}));
+
+  TabuOptions options;
+  options.iterations = 200;
+  std::vector<QapSolution> solutions =
+      tabu_search(problem, {0, 1, 2}, options);
+  ASSERT_FALSE(solutions.empty());
+  EXPECT_EQ(solutions[0].cost, optimum);
+  EXPECT_EQ(problem.cost(solutions[0].location_of), optimum);
+  for (size_t i = 1; i < solutions.size(); ++i) {
+    EXPECT_LE(solutions[i - 1].cost, solutions[i].cost);
+  }
+}
+
+TEST_F(QapTest, FixedSymbolsStay) {
+  TransitionTable transitions(chords);
+  BigramCounts counts("abcabbcacbbaccabcab", symbol_of, 3);
+  QapProblem problem{transitions, counts, {false, true, false}};
+  TabuOptions options;
+  options.iterations = 200;
+  for (const QapSolution &solution : tabu_search(problem, {0, 5, 2}, options)) {
+    EXPECT_EQ(solution.location_of[1], 5);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+"""
+Local scoring service shared by the optimizer scripts.
+
+Loading & converting the corpus and warming up a worker pool takes a while
+and every script used to do it on its own. The daemon does it once and keeps
+the compiled corpora in memory. Scripts connect over a Unix domain socket and
+send batches of layouts. All connections share one bounded pool of scoring
+threads, so concurrent clients don't oversubscribe the cores. Recently scored
+layouts are cached and a layout that is already being scored (for another
+client or earlier in the same batch) is only scored once.
+
+Start it with:
+
+    ./scoring_daemon.py [--socket PATH] [--workers N]
+
+and use it from Python:
+
+    client = ScoringClient()
+    costs = client.score([layout_a, layout_b], corpus="corpus/*")
+
+Protocol: one JSON object per line in both directions. A request looks like
+
+    {"corpus": "corpus/*", "qwerty": true, "layouts": ["e0100t0110...", ...]}
+
+Layouts are {char: chord} or {char: [chord, ...]} dicts (the latter can
+give a character several chords) or compact strings where every character is
+followed by its single 4-digit chord. The response is {"costs": [...]} or
+{"error": "..."}. {"stats": true} returns cache statistics instead.
+
+The optimizer scripts use the daemon when started with --daemon.
+"""
+
+import argparse
+import json
+import os
+import socket
+import socketserver
+import threading
+import time
+from collections import OrderedDict
+from concurrent.futures import Future, ThreadPoolExecutor
+from typing import Dict, List, Tuple, Union
+
+import keyer_simulator_native
+
+DEFAULT_SOCKET = "/tmp/keyer-scoring.sock"
+
+# Number of (corpus, layout) -> cost entries kept in memory
+CACHE_SIZE = 1_000_000
+
+CHORD_LENGTH = 4
+
+Layout = Union[str, Dict[str, Union[str, List[str]]]]
+
+# Canonical (sorted, hashable) form of a layout - the cache key
+LayoutKey = Tuple[Tuple[str, Tuple[str, ...]], ...]
+
+
+def encode_layout(layout: Dict[str, str]) -> str:
+    """Compact form of a {char: chord} layout (sorted, so it can be cached)."""
+    return "".join(char + chord for char, chord in sorted(layout.items()))
+
+
+def decode_layout(encoded: str) -> Dict[str, List[str]]:
+    """Key map accepted by keyer_simulator_native from the compact form."""
+    step = 1 + CHORD_LENGTH
+    if len(encoded) % step:
+        raise ValueError(f"Malformed layout: {encoded[:20]!r}...")
+    return {
+        encoded[i]: [encoded[i + 1 : i + step]] for i in range(0, len(encoded), step)
+    }
+
+
+def layout_key(layout: Layout) -> LayoutKey:
+    """Canonical form of a layout in any of the accepted formats."""
+    if isinstance(layout, str):
+        layout = decode_layout(layout)
+    if not isinstance(layout, dict):
+        raise ValueError(f"Layout must be a string or a dict, got {layout!r:.40}")
+    return tuple(
+        sorted(
+            (char, (chords,) if isinstance(chords, str) else tuple(chords))
+            for char, chords in layout.items()
+        )
+    )
+
+
+def wire_layout(layout: Layout) -> Layout:
+    """Smallest encoding of a layout for a request."""
+    if isinstance(layout, str):
+        return layout
+    single = {}
+    for char, chords in layout.items():
+        if not isinstance(chords, str):
+            if len(chords) != 1:
+                return layout
+            chords = chords[0]
+        if len(chords) != CHORD_LENGTH:
+            return layout
+        single[char] = chords
+    return encode_layout(single)
+
+
+class ScoringEngine:
+    """Compiled corpora, the score cache & the worker pool. Shared by all connections."""
+
+    def __init__(self, workers: int = 0):
+        self.corpora = {}
+        self.corpora_lock = threading.Lock()
+        self.workers = workers or os.cpu_count() or 1
+        self.pool = ThreadPoolExecutor(self.workers, thread_name_prefix="scorer")
+        # Guards the cache, `pending` & the counters
+        self.cache = OrderedDict()
+        self.cache_lock = threading.Lock()
+        # Layouts being scored right now -> their future cost
+        self.pending: Dict[tuple, Future] = {}
+        self.hits = 0
+        self.misses = 0
+        self.duplicates = 0
+
+    def corpus(self, pattern: str, qwerty: bool):
+        key = (pattern, qwerty)
+        with self.corpora_lock:
+            if key not in self.corpora:
+                # Imported here - planner.py imports this module
+                from planner import load_corpus
+
+                start = time.time()
+                text = load_corpus(pattern, qwerty_compatible=qwerty)
+                self.corpora[key] = keyer_simulator_native.compile_corpus(text)
+                print(
+                    f"Loaded {pattern} ({len(text)} characters, "
+                    f"{time.time() - start:.1f}s)",
+                    flush=True,
+                )
+            return self.corpora[key]
+
+    def score(self, pattern: str, qwerty: bool, layouts: List[Layout]) -> List[int]:
+        corpus = self.corpus(pattern, qwerty)
+        keys = [(pattern, qwerty, layout_key(layout)) for layout in layouts]
+        costs = {}
+        futures = {}
+        with self.cache_lock:
+            for key in keys:
+                if key in costs or key in futures:
+                    self.duplicates += 1
+                    continue
+                cost = self.cache.get(key)
+                if cost is not None:
+                    self.cache.move_to_end(key)
+                    costs[key] = cost
+                    self.hits += 1
+                elif key in self.pending:
+                    futures[key] = self.pending[key]
+                    self.duplicates += 1
+                else:
+                    futures[key] = self.pending[key] = self.pool.submit(
+                        self._score_one, key, corpus
+                    )
+                    self.misses += 1
+
+        for key, future in futures.items():
+            costs[key] = future.result()
+        return [costs[key] for key in keys]
+
+    def _score_one(self, key: tuple, corpus) -> int:
+        """Runs on the pool. Caches the cost before the future completes."""
+        try:
+            key_map = {char: list(chords) for char, chords in key[2]}
+            # A single thread per call (the pool is the parallelism); the GIL
+            # is released while scoring
+            cost = keyer_simulator_native.score_layouts([key_map], corpus, 1)[0]
+            with self.cache_lock:
+                self.cache[key] = cost
+                while len(self.cache) > CACHE_SIZE:
+                    self.cache.popitem(last=False)
+            return cost
+        finally:
+            with self.cache_lock:
+                del self.pending[key]
+
+    def stats(self) -> dict:
+        with self.cache_lock:
+            return {
+                "corpora": [pattern for pattern, _ in self.corpora],
+                "cached": len(self.cache),
+                "hits": self.hits,
+                "misses": self.misses,
+                "duplicates": self.duplicates,
+                "scoring": len(self.pending),
+                "workers": self.workers,
+            }
+
+
+class ScoringHandler(socketserver.StreamRequestHandler):
+    def handle(self):
+        engine: ScoringEngine = self.server.engine
+        for line in self.rfile:
+            try:
+                request = json.loads(line)
+                if request.get("stats"):
+                    response = engine.stats()
+                else:
+                    response = {
+                        "costs": engine.score(
+                            request.get("corpus", "corpus/*"),
+                            request.get("qwerty", True),
+                            request["layouts"],
+                        )
+                    }
+            except Exception as e:  # reported to the client, daemon keeps going
+                response = {"error": f"{type(e).__name__}: {e}"}
+            self.wfile.write(json.dumps(response).encode() + b"\n")
+            self.wfile.flush()
+
+
+class ScoringServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+    def __init__(self, path: str, workers: int = 0):
+        if os.path.exists(path):
+            os.unlink(path)
+        super().__init__(path, ScoringHandler)
+        self.engine = ScoringEngine(workers)
+
+
+class ScoringClient:
+    """Connection to a running scoring daemon."""
+
+    def __init__(self, path: str = DEFAULT_SOCKET):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.file = self.sock.makefile("rwb")
+
+    def _request(self, request: dict) -> dict:
+        self.file.write(json.dumps(request).encode() + b"\n")
+        self.file.flush()
+        response = json.loads(self.file.readline())
+        if "error" in response:
+            raise RuntimeError(f"Scoring daemon: {response['error']}")
+        return response
+
+    def score(
+        self, layouts: List[Layout], corpus: str = "corpus/*", qwerty: bool = True
+    ) -> List[int]:
+        """Costs of the given layouts (same order)."""
+        layouts = [wire_layout(layout) for layout in layouts]
+        return self._request({"corpus": corpus, "qwerty": qwerty, "layouts": layouts})[
+            "costs"
+        ]
+
+    def stats(self) -> dict:
+        return self._request({"stats": True})
+
+    def close(self):
+        self.file.close()
+        self.sock.close()
+
+
+def add_daemon_argument(parser: argparse.ArgumentParser):
+    """--daemon [SOCKET] option shared by the optimizer scripts."""
+    parser.add_argument(
+        "--daemon",
+        nargs="?",
+        const=DEFAULT_SOCKET,
+        metavar="SOCKET",
+        help="score layouts on a running scoring_daemon.py",
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    parser.add_argument("--socket", default=DEFAULT_SOCKET, help="socket path")
+    parser.add_argument(
+        "--preload",
+        default="corpus/*",
+        help="corpus to load at startup (empty to skip)",
+    )
+    parser.add_argument(
+        "--workers", type=int, default=0, help="scoring threads (0 = one per core)"
+    )
+    args = parser.parse_args()
+
+    server = ScoringServer(args.socket, args.workers)
+    if args.preload:
+        server.engine.corpus(args.preload, True)
+    print(f"Scoring daemon listening on {args.socket}", flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        server.engine.pool.shutdown(cancel_futures=True)
+        os.unlink(args.socket)
+
+
+if __name__ == "__main__":
+    main()
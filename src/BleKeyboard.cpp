@@ -14,6 +14,8 @@
 #endif // USE_NIMBLE
 #include "HIDTypes.h"
 #include <driver/adc.h>
+#include <string.h>
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
 
@@ -140,16 +142,28 @@ void BleKeyboard::begin(void)
   advertising->setAppearance(HID_KEYBOARD);
   advertising->addServiceUUID(hid->hidService()->getUUID());
   advertising->setScanResponse(false);
-  advertising->start();
   hid->setBatteryLevel(batteryLevel);
+  startAdvertising();
 
   ESP_LOGD(LOG_TAG, "Advertising started!");
+
+  xTaskCreate(senderTaskMain, "BleKeyboard", 4096, this, configMAX_PRIORITIES - 5, &senderTask);
 }
 
 void BleKeyboard::end(void)
 {
 }
 
+void BleKeyboard::startAdvertising(void)
+{
+  advertising->start();
+}
+
+BLEAdvertising* BleKeyboard::getAdvertising(void)
+{
+  return advertising;
+}
+
 bool BleKeyboard::isConnected(void) {
   return this->connected;
 }
@@ -166,7 +180,7 @@ void BleKeyboard::setName(std::string deviceName) {
 }
 
 /**
- * @brief Sets the waiting time (in milliseconds) between multiple keystrokes in NimBLE mode.
+ * @brief Sets the waiting time (in milliseconds) between multiple reports in NimBLE mode.
  *
  * @param ms Time in milliseconds
  */
@@ -174,6 +188,10 @@ void BleKeyboard::setDelay(uint32_t ms) {
   this->_delay_ms = ms;
 }
 
+void BleKeyboard::setReportSentCallback(void (*callback)(int64_t eventTime)) {
+  this->reportSentCallback = callback;
+}
+
 void BleKeyboard::set_vendor_id(uint16_t vid) {
 	this->vid = vid;
 }
@@ -186,169 +204,75 @@ void BleKeyboard::set_version(uint16_t version) {
 	this->version = version;
 }
 
-void BleKeyboard::sendReport(KeyReport* keys)
+bool BleKeyboard::sendReport(KeyReport* keys)
 {
-  if (this->isConnected())
-  {
-    this->inputKeyboard->setValue((uint8_t*)keys, sizeof(KeyReport));
-    this->inputKeyboard->notify();
-#if defined(USE_NIMBLE)
-    // vTaskDelay(delayTicks);
-    this->delay_ms(_delay_ms);
-#endif // USE_NIMBLE
-  }
+  return sendReport(keys, esp_timer_get_time());
 }
 
-void BleKeyboard::sendReport(MediaKeyReport* keys)
+bool BleKeyboard::sendReport(KeyReport* keys, int64_t eventTime)
 {
-  if (this->isConnected())
-  {
-    this->inputMediaKeys->setValue((uint8_t*)keys, sizeof(MediaKeyReport));
-    this->inputMediaKeys->notify();
-#if defined(USE_NIMBLE)
-    //vTaskDelay(delayTicks);
-    this->delay_ms(_delay_ms);
-#endif // USE_NIMBLE
-  }
+  if (!this->isConnected())
+    return false;
+  return queueReport(this->inputKeyboard, keys, sizeof(KeyReport), eventTime);
 }
 
-extern
-const uint8_t _asciimap[128] PROGMEM;
+bool BleKeyboard::sendReport(MediaKeyReport* keys)
+{
+  if (!this->isConnected())
+    return false;
+  return queueReport(this->inputMediaKeys, keys, sizeof(MediaKeyReport), esp_timer_get_time());
+}
 
-#define SHIFT 0x80
-const uint8_t _asciimap[128] =
+size_t BleKeyboard::freeReportSlots(void)
 {
-	0x00,             // NUL
-	0x00,             // SOH
-	0x00,             // STX
-	0x00,             // ETX
-	0x00,             // EOT
-	0x00,             // ENQ
-	0x00,             // ACK
-	0x00,             // BEL
-	0x2a,			// BS	Backspace
-	0x2b,			// TAB	Tab
-	0x28,			// LF	Enter
-	0x00,             // VT
-	0x00,             // FF
-	0x00,             // CR
-	0x00,             // SO
-	0x00,             // SI
-	0x00,             // DEL
-	0x00,             // DC1
-	0x00,             // DC2
-	0x00,             // DC3
-	0x00,             // DC4
-	0x00,             // NAK
-	0x00,             // SYN
-	0x00,             // ETB
-	0x00,             // CAN
-	0x00,             // EM
-	0x00,             // SUB
-	0x00,             // ESC
-	0x00,             // FS
-	0x00,             // GS
-	0x00,             // RS
-	0x00,             // US
-
-	0x2c,		   //  ' '
-	0x1e|SHIFT,	   // !
-	0x34|SHIFT,	   // "
-	0x20|SHIFT,    // #
-	0x21|SHIFT,    // $
-	0x22|SHIFT,    // %
-	0x24|SHIFT,    // &
-	0x34,          // '
-	0x26|SHIFT,    // (
-	0x27|SHIFT,    // )
-	0x25|SHIFT,    // *
-	0x2e|SHIFT,    // +
-	0x36,          // ,
-	0x2d,          // -
-	0x37,          // .
-	0x38,          // /
-	0x27,          // 0
-	0x1e,          // 1
-	0x1f,          // 2
-	0x20,          // 3
-	0x21,          // 4
-	0x22,          // 5
-	0x23,          // 6
-	0x24,          // 7
-	0x25,          // 8
-	0x26,          // 9
-	0x33|SHIFT,      // :
-	0x33,          // ;
-	0x36|SHIFT,      // <
-	0x2e,          // =
-	0x37|SHIFT,      // >
-	0x38|SHIFT,      // ?
-	0x1f|SHIFT,      // @
-	0x04|SHIFT,      // A
-	0x05|SHIFT,      // B
-	0x06|SHIFT,      // C
-	0x07|SHIFT,      // D
-	0x08|SHIFT,      // E
-	0x09|SHIFT,      // F
-	0x0a|SHIFT,      // G
-	0x0b|SHIFT,      // H
-	0x0c|SHIFT,      // I
-	0x0d|SHIFT,      // J
-	0x0e|SHIFT,      // K
-	0x0f|SHIFT,      // L
-	0x10|SHIFT,      // M
-	0x11|SHIFT,      // N
-	0x12|SHIFT,      // O
-	0x13|SHIFT,      // P
-	0x14|SHIFT,      // Q
-	0x15|SHIFT,      // R
-	0x16|SHIFT,      // S
-	0x17|SHIFT,      // T
-	0x18|SHIFT,      // U
-	0x19|SHIFT,      // V
-	0x1a|SHIFT,      // W
-	0x1b|SHIFT,      // X
-	0x1c|SHIFT,      // Y
-	0x1d|SHIFT,      // Z
-	0x2f,          // [
-	0x31,          // bslash
-	0x30,          // ]
-	0x23|SHIFT,    // ^
-	0x2d|SHIFT,    // _
-	0x35,          // `
-	0x04,          // a
-	0x05,          // b
-	0x06,          // c
-	0x07,          // d
-	0x08,          // e
-	0x09,          // f
-	0x0a,          // g
-	0x0b,          // h
-	0x0c,          // i
-	0x0d,          // j
-	0x0e,          // k
-	0x0f,          // l
-	0x10,          // m
-	0x11,          // n
-	0x12,          // o
-	0x13,          // p
-	0x14,          // q
-	0x15,          // r
-	0x16,          // s
-	0x17,          // t
-	0x18,          // u
-	0x19,          // v
-	0x1a,          // w
-	0x1b,          // x
-	0x1c,          // y
-	0x1d,          // z
-	0x2f|SHIFT,    // {
-	0x31|SHIFT,    // |
-	0x30|SHIFT,    // }
-	0x35|SHIFT,    // ~
-	0				// DEL
-};
+  return kMaxPendingReports - pendingReports.Size();
+}
 
+uint32_t BleKeyboard::getDroppedReports(void)
+{
+  return droppedReports.load(std::memory_order_relaxed);
+}
+
+bool BleKeyboard::queueReport(BLECharacteristic* characteristic, const void* data, uint8_t size, int64_t eventTime)
+{
+  PendingReport report = {characteristic, size, {}, eventTime};
+  memcpy(report.data, data, size);
+  // The queue holds a couple of seconds worth of typing. If the radio can't
+  // keep up, the caller has to keep the report until freeReportSlots() grows.
+  if (!pendingReports.Push(report)) {
+    return false;
+  }
+  xTaskNotifyGive(senderTask);
+  return true;
+}
+
+// Sends the queued reports one by one. With Bluedroid, notify() returns after
+// the stack confirms that the notification was handed to the controller
+// (ESP_GATTS_CONF_EVT), which paces the reports by the connection events and
+// congestion. NimBLE doesn't wait, so the reports are spaced by `_delay_ms`.
+void BleKeyboard::senderTaskMain(void* arg)
+{
+  BleKeyboard* keyboard = static_cast<BleKeyboard*>(arg);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    PendingReport report;
+    while (keyboard->pendingReports.Pop(report)) {
+      if (!keyboard->isConnected()) {
+        // The host released all keys when the link dropped
+        keyboard->droppedReports.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      report.characteristic->setValue(report.data, report.size);
+      report.characteristic->notify();
+      if (keyboard->reportSentCallback) {
+        keyboard->reportSentCallback(report.eventTime);
+      }
+#if defined(USE_NIMBLE)
+      vTaskDelay(pdMS_TO_TICKS(keyboard->_delay_ms));
+#endif // USE_NIMBLE
+    }
+  }
+}
 
 uint8_t USBPutChar(uint8_t c);
 
@@ -358,40 +282,9 @@ uint8_t USBPutChar(uint8_t c);
 // call release(), releaseAll(), or otherwise clear the report and resend.
 size_t BleKeyboard::press(uint8_t k)
 {
-	uint8_t i;
-	if (k >= 136) {			// it's a non-printing key (not a modifier)
-		k = k - 136;
-	} else if (k >= 128) {	// it's a modifier key
-		_keyReport.modifiers |= (1<<(k-128));
-		k = 0;
-	} else {				// it's a printing key
-		k = pgm_read_byte(_asciimap + k);
-		if (!k) {
-			setWriteError();
-			return 0;
-		}
-		if (k & 0x80) {						// it's a capital letter or other character reached with shift
-			_keyReport.modifiers |= 0x02;	// the left shift modifier
-			k &= 0x7F;
-		}
-	}
-
-	// Add k to the key report only if it's not already present
-	// and if there is an empty slot.
-	if (_keyReport.keys[0] != k && _keyReport.keys[1] != k &&
-		_keyReport.keys[2] != k && _keyReport.keys[3] != k &&
-		_keyReport.keys[4] != k && _keyReport.keys[5] != k) {
-
-		for (i=0; i<6; i++) {
-			if (_keyReport.keys[i] == 0x00) {
-				_keyReport.keys[i] = k;
-				break;
-			}
-		}
-		if (i == 6) {
-			setWriteError();
-			return 0;
-		}
+	if (!AddToKeyReport(_keyReport, k)) {
+		setWriteError();
+		return 0;
 	}
 	sendReport(&_keyReport);
 	return 1;
@@ -415,31 +308,9 @@ size_t BleKeyboard::press(const MediaKeyReport k)
 // it shouldn't be repeated any more.
 size_t BleKeyboard::release(uint8_t k)
 {
-	uint8_t i;
-	if (k >= 136) {			// it's a non-printing key (not a modifier)
-		k = k - 136;
-	} else if (k >= 128) {	// it's a modifier key
-		_keyReport.modifiers &= ~(1<<(k-128));
-		k = 0;
-	} else {				// it's a printing key
-		k = pgm_read_byte(_asciimap + k);
-		if (!k) {
-			return 0;
-		}
-		if (k & 0x80) {							// it's a capital letter or other character reached with shift
-			_keyReport.modifiers &= ~(0x02);	// the left shift modifier
-			k &= 0x7F;
-		}
-	}
-
-	// Test the key report to see if k is present.  Clear it if it exists.
-	// Check all positions in case the key is present more than once (which it shouldn't be)
-	for (i=0; i<6; i++) {
-		if (0 != k && _keyReport.keys[i] == k) {
-			_keyReport.keys[i] = 0x00;
-		}
+	if (!RemoveFromKeyReport(_keyReport, k)) {
+		return 0;
 	}
-
 	sendReport(&_keyReport);
 	return 1;
 }
@@ -524,7 +395,7 @@ void BleKeyboard::onDisconnect(BLEServer* pServer) {
   desc = (BLE2902*)this->inputMediaKeys->getDescriptorByUUID(BLEUUID((uint16_t)0x2902));
   desc->setNotifications(false);
 
-  advertising->start();
+  startAdvertising();
 
 #endif // !USE_NIMBLE
 }
@@ -534,14 +405,3 @@ void BleKeyboard::onWrite(BLECharacteristic* me) {
   (void)value;
   ESP_LOGI(LOG_TAG, "special keys: %d", *value);
 }
-
-void BleKeyboard::delay_ms(uint64_t ms) {
-  uint64_t m = esp_timer_get_time();
-  if(ms){
-    uint64_t e = (m + (ms * 1000));
-    if(m > e){ //overflow
-        while(esp_timer_get_time() > e) { }
-    }
-    while(esp_timer_get_time() < e) {}
-  }
-}
@@ -0,0 +1,405 @@
+#include "ChordEngine.h"
+#include "ChordStats.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <utility>
+
+const char *ButtonToStr(int btn) {
+  switch (btn) {
+  case THUMB_0:
+    return "THUMB_0";
+  case THUMB_1:
+    return "THUMB_1";
+  case THUMB_2:
+    return "THUMB_2";
+  case INDEX_3:
+    return "INDEX_3";
+  case MIDDLE_4:
+    return "MIDDLE_4";
+  case RING_5:
+    return "RING_5";
+  case LITTLE_6:
+    return "LITTLE_6";
+  case INDEX_7:
+    return "INDEX_7";
+  case MIDDLE_8:
+    return "MIDDLE_8";
+  case RING_9:
+    return "RING_9";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+const char *IBM_KeyToStr(IBM_Key key) {
+  switch (key) {
+  case KEY_LEFT_CTRL:
+    return "CtrlL";
+  case KEY_RIGHT_CTRL:
+    return "CtrlR";
+  case KEY_LEFT_SHIFT:
+    return "ShiftL";
+  case KEY_RIGHT_SHIFT:
+    return "ShiftR";
+  case KEY_LEFT_ALT:
+    return "AltL";
+  case KEY_RIGHT_ALT:
+    return "AltR";
+  case KEY_LEFT_GUI:
+    return "GuiL";
+  case KEY_RIGHT_GUI:
+    return "GuiR";
+  case KEY_ESC:
+    return "Esc";
+  case KEY_RETURN:
+    return "Enter";
+  case ' ':
+    return "Space";
+  case KEY_TAB:
+    return "Tab";
+  case KEY_BACKSPACE:
+    return "Backspace";
+  case KEY_DELETE:
+    return "Delete";
+  default:
+    break;
+  }
+  static char buf[10];
+  if (isprint(key)) {
+    snprintf(buf, sizeof(buf), "%c", key);
+  } else {
+    snprintf(buf, sizeof(buf), "0x%02x", key);
+  }
+  return buf;
+}
+
+static bool HasKey(const KeyReport &report, uint8_t key) {
+  return key && std::find(report.keys, report.keys + 6, key) != report.keys + 6;
+}
+
+void CoalescingHidSink::Apply(const KeyReport &next) {
+  uint8_t changed_modifiers = pending.modifiers ^ host_report.modifiers;
+  uint8_t toggled_modifiers = next.modifiers ^ pending.modifiers;
+  bool flush = changed_modifiers & toggled_modifiers;
+  const KeyReport *reports[] = {&pending, &next};
+  for (const KeyReport *report : reports) {
+    for (uint8_t key : report->keys) {
+      bool seen = HasKey(host_report, key), now = HasKey(pending, key);
+      if (!key || seen == now) {
+        continue; // not changed since the last report
+      }
+      bool undone = HasKey(next, key) != now;
+      bool pressed_with_other_modifiers = now && toggled_modifiers;
+      flush |= undone || pressed_with_other_modifiers;
+    }
+  }
+  if (flush) {
+    Flush();
+  }
+  pending = next;
+}
+
+void CoalescingHidSink::Flush() {
+  if (pending.modifiers == host_report.modifiers &&
+      std::equal(pending.keys, pending.keys + 6, host_report.keys)) {
+    return;
+  }
+  SendReport(pending);
+  host_report = pending;
+}
+
+void ChordEngine::Setup() {
+  chord_autostart_timer = clock.CreateTimer(
+      "Chord Autostart",
+      [](void *arg) { static_cast<ChordEngine *>(arg)->OnChordAutostart(); },
+      this);
+  if (chord_autostart_timer == nullptr) {
+    DebugPrintf("Failed to create timer for chord autostart\n");
+  }
+}
+
+void ChordEngine::ReleaseTempModifiers() {
+  for (auto mod : temp_modifiers) {
+    DebugPrintf("  Releasing modifier: %s (ReleaseTempModifiers)\n",
+                IBM_KeyToStr(mod));
+    hid.Release(mod);
+  }
+  temp_modifiers.clear();
+}
+
+void ChordEngine::StartAction(ActionId id) {
+  for (; id; id = layout.actions[id].next) {
+    const Action &action = layout.actions[id];
+    switch (action.op) {
+    case OP_KEY:
+      DebugPrintf("  Pressing key: %s (Key)\n", IBM_KeyToStr(action.key));
+      hid.Press(action.key);
+      break;
+    case OP_TEMPORARY_MODIFIER: {
+      auto existing_modifier_it = temp_modifiers.end();
+      for (auto it = temp_modifiers.begin(); it != temp_modifiers.end(); ++it) {
+        if (*it == action.key) {
+          existing_modifier_it = it;
+          break;
+        }
+      }
+      if (existing_modifier_it != temp_modifiers.end()) {
+        DebugPrintf("  Releasing modifier [%s] (Mod)\n",
+                    IBM_KeyToStr(action.key));
+        hid.Release(action.key);
+        temp_modifiers.erase(existing_modifier_it);
+      } else {
+        DebugPrintf("  Pressing modifier [%s] (Mod)\n",
+                    IBM_KeyToStr(action.key));
+        hid.Press(action.key);
+        temp_modifiers.push_back(action.key);
+      }
+      break;
+    }
+    case OP_HOLD_MODIFIER:
+      if (active_button_actions[action.hold_button]) {
+        DebugPrintf("  Keeping modifier [%s] (Hold)\n",
+                    IBM_KeyToStr(action.key));
+        break;
+      }
+      DebugPrintf("  Pressing modifier [%s] (Hold)\n",
+                  IBM_KeyToStr(action.key));
+      hid.Press(action.key);
+      // The release step is stored right after the hold
+      active_button_actions[action.hold_button] = id + 1;
+      break;
+    case OP_NONE:
+    case OP_RELEASE_HELD_MODIFIER:
+      break;
+    }
+  }
+}
+
+void ChordEngine::StopAction(ActionId id) {
+  if (id == 0) {
+    return;
+  }
+  const Action &action = layout.actions[id];
+  StopAction(action.next);
+  switch (action.op) {
+  case OP_KEY:
+    DebugPrintf("  Releasing key: %s (Key)\n", IBM_KeyToStr(action.key));
+    hid.Release(action.key);
+    ReleaseTempModifiers();
+    break;
+  case OP_RELEASE_HELD_MODIFIER:
+    DebugPrintf("  Releasing modifier [%s] (Hold)\n",
+                IBM_KeyToStr(action.key));
+    hid.Release(action.key);
+    break;
+  case OP_NONE:
+  case OP_TEMPORARY_MODIFIER:
+  case OP_HOLD_MODIFIER:
+    break;
+  }
+}
+
+void ChordEngine::Decide(ActionId id, EngineDecision decision,
+                         ButtonMask buttons) {
+  if (stats && id) {
+    stats->Record(id, clock.Micros());
+  }
+  if (trace) {
+    trace->Decision(clock.Micros(), decision, id, buttons);
+  }
+}
+
+void ChordEngine::OnButtonDown(Button i) {
+  auto now = clock.Millis();
+  if (arpeggio_state == STATE_READY) {
+    arpeggio_start_millis = now;
+    arpeggio_button1 = i;
+    arpeggio_state = STATE_BUTTON1_DOWN;
+  } else if (arpeggio_state == STATE_BUTTON1_DOWN) {
+    DebugPrintf("Arpeggio key 1 down millis: %lu\n",
+                now - arpeggio_start_millis);
+    if (now - arpeggio_start_millis >= kArpeggioMinSpacingMillis) {
+      arpeggio_button2 = i;
+      arpeggio_start_millis = now;
+      arpeggio_state = STATE_BUTTON2_DOWN;
+    } else {
+      arpeggio_state = STATE_INACTIVE;
+    }
+  } else {
+    arpeggio_state = STATE_INACTIVE;
+  }
+
+  buttons_down |= ButtonBit(i);
+  auto unique_action = FindUniqueAction();
+  if (unique_action) {
+    // If a unique key action was found, then don't add it to the chord but
+    // rather start it immediately This allows multiple actions to be active at
+    // the same time (as long as they have been unique at press time)
+    buttons_down &= ~ButtonBit(i);
+    // We also don't want to start a new chord
+    if (chord_autostart_timer->IsActive()) {
+      chord_autostart_timer->Stop();
+    }
+    DebugPrintf(" Unique action!\n");
+    active_button_actions[i] = unique_action;
+    Decide(unique_action, DECISION_UNIQUE, buttons_down | ButtonBit(i));
+    StartAction(unique_action);
+  } else {
+    if (chord_autostart_timer->IsActive()) {
+      chord_autostart_timer->Stop();
+    }
+    chord_autostart_timer->Start(kChordAutostartMillis * 1000);
+  }
+  hid.Flush();
+}
+
+void ChordEngine::OnButtonUp(Button i) {
+  auto now = clock.Millis();
+  if (arpeggio_state == STATE_BUTTON2_DOWN) {
+    DebugPrintf("Arpeggio button 2 down millis: %lu\n",
+                now - arpeggio_start_millis);
+    if (now - arpeggio_start_millis <= kArpeggioMaxHoldMillis) {
+      auto action = layout.arpeggios[arpeggio_button1][arpeggio_button2];
+      if (action) {
+        DebugPrintf("Arpeggio action\n");
+        Decide(action, DECISION_ARPEGGIO,
+               ButtonBit(arpeggio_button1) | ButtonBit(arpeggio_button2));
+        ExecuteAction(action);
+        if (chord_autostart_timer->IsActive()) {
+          chord_autostart_timer->Stop();
+        }
+      }
+    }
+    arpeggio_state = STATE_INACTIVE;
+  }
+
+  if (auto &active_button_action = active_button_actions[i]) {
+    DebugPrintf("Stopping active button action\n");
+    StopAction(active_button_action);
+    active_button_action = 0;
+  } else if (chord_action && (buttons_down & ButtonBit(i))) {
+    DebugPrintf("Stopping chord action\n");
+    StopAction(chord_action);
+    chord_action = 0;
+  } else if (chord_autostart_timer->IsActive()) {
+    chord_autostart_timer->Stop();
+    auto action = current_layer->ChordAction(buttons_down);
+    if (action) {
+      DebugPrintf("Chord action\n");
+      Decide(action, DECISION_CHORD, buttons_down);
+      ExecuteAction(action);
+
+      // It's possible that chord action attaches an "active key" action to the
+      // currently released key. If that's the case then it should be
+      // immediately stopped.
+      if (auto &active_button_action = active_button_actions[i]) {
+        DebugPrintf("Stopping active button action\n");
+        StopAction(active_button_action);
+        active_button_action = 0;
+      }
+    } else {
+      DebugPrintf("No chord action\n");
+      Decide(0, DECISION_NO_CHORD, buttons_down);
+    }
+  }
+
+  buttons_down &= ~ButtonBit(i);
+
+  bool all_buttons_up = buttons_down == 0;
+  if (all_buttons_up) {
+    arpeggio_state = STATE_READY;
+  }
+  hid.Flush();
+}
+
+void ChordEngine::OnChordAutostart() {
+  if (chord_action) {
+    DebugPrintf("ERROR: Chord action already active\n");
+    return;
+  }
+  auto action = current_layer->ChordAction(buttons_down);
+  if (action) {
+    DebugPrintf("Starting chord hold\n");
+    Decide(action, DECISION_AUTOSTART, buttons_down);
+    StartAction(action);
+    chord_action = action;
+  }
+  hid.Flush();
+}
+
+void ButtonDebouncer::OnSetup(Clock &clock, Gpio &gpio,
+                              std::function<void(Button, bool)> report) {
+  this->gpio = &gpio;
+  this->report = std::move(report);
+  pressed_state = last_scan = gpio.ReadPressed();
+
+  timer = clock.CreateTimer(
+      "Debounce",
+      [](void *arg) { static_cast<ButtonDebouncer *>(arg)->OnScan(); }, this);
+  if (timer == nullptr) {
+    DebugPrintf("Failed to create debounce timer\n");
+  }
+}
+
+void ButtonDebouncer::OnChange(Button button) {
+  ButtonMask bit = ButtonBit(button);
+  if (unsettled & bit) {
+    // Ignore state changes until the button settles.
+    // If it leads to any issues, then the settling scan will fix them.
+  } else {
+    pressed_state ^= bit;
+    report(button, pressed_state & bit);
+  }
+  unsettled |= bit;
+  bounced |= bit;
+  if (!timer->IsActive()) {
+    timer->Start(kScanMicroseconds);
+  }
+}
+
+void ButtonDebouncer::OnScan() {
+  static_assert(kSettleScans == 3, "quiet_count has 2 bits");
+  ButtonMask levels = gpio->ReadPressed();
+  ButtonMask restart = bounced | (levels ^ last_scan);
+  bounced = 0;
+  last_scan = levels;
+
+  // Increment the counters of the quiet buttons, reset the others
+  ButtonMask quiet = unsettled & ~restart;
+  ButtonMask settled = quiet & quiet_count1 & ~quiet_count0;
+  ButtonMask carry = quiet & quiet_count0;
+  quiet_count0 = (quiet_count0 ^ quiet) & ~restart & ~settled;
+  quiet_count1 = (quiet_count1 ^ carry) & ~restart & ~settled;
+  unsettled &= ~settled;
+
+  // Fix the buttons whose last edge was missed
+  ButtonMask wrong = settled & (levels ^ pressed_state);
+  for (Button i = 0; i < NUM_BUTTONS; i++) {
+    if (wrong & ButtonBit(i)) {
+      pressed_state ^= ButtonBit(i);
+      report(i, pressed_state & ButtonBit(i));
+    }
+  }
+
+  if (unsettled) {
+    timer->Start(kScanMicroseconds);
+  }
+}
+
+void ReplayWakeButtons(ButtonMask waking, ButtonMask held,
+                       const std::function<void(Button, bool)> &report) {
+  for (ButtonMask mask : {waking, ButtonMask(held & ~waking)}) {
+    for (Button i = 0; i < NUM_BUTTONS; i++) {
+      if (mask & ButtonBit(i)) {
+        report(i, true);
+      }
+    }
+  }
+  ButtonMask taps = waking & ~held;
+  for (Button i = 0; i < NUM_BUTTONS; i++) {
+    if (taps & ButtonBit(i)) {
+      report(i, false);
+    }
+  }
+}
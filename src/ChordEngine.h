@@ -0,0 +1,466 @@
+// Chord & arpeggio state machine of the keyer.
+//
+// Everything here is portable - the hardware is reached only through the
+// `Clock`, `Timer`, `Gpio` and `HidSink` interfaces. ChordKeyboard.cpp
+// implements them with esp_timer, GPIO reads & BleKeyboard. The host build in
+// `host/` implements them with a simulated clock and records the HID reports,
+// which makes it possible to replay button traces on a PC.
+
+#pragma once
+
+#include "HidReport.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+// Change to true to enable serial debug output
+//
+// The default is false because when device is not connected to a computer but
+// is printing to the serial port, it causes the device to become laggy (weird).
+constexpr bool kDebug = false;
+
+// Set this to something like 350 to enable chord autostart when a chord is held
+// down for this duration. Chords started this way cause the keys to be pressed
+// and they will be released only when the chord is also released. This allows
+// chords to function more like keyboard keys.
+//
+// This is disabled by default because it makes learning very hard. Re-enable
+// this once your WPM is above 20.
+constexpr unsigned long kChordAutostartMillis = 350 * 1000 * 1000;
+
+// The two arpeggio keys must be spread apart by at least this many
+// milliseconds.
+constexpr unsigned long kArpeggioMinSpacingMillis = 80;
+
+// Arpeggios must be released quickly after the last button is pressed. This
+// constant conrols how long the last button can be held down for an action to
+// be registered as an arpeggio.
+constexpr unsigned long kArpeggioMaxHoldMillis = 240;
+
+// Character sent by the keyboard to the computer
+using IBM_Key = uint8_t;
+
+// A mechanical switch numbered 0-9
+using Button = uint8_t;
+
+// 0 = not pressing, 1 = pressing first button, 2 = pressing second button, etc.
+using FingerPosition = uint8_t;
+
+enum ButtonEnum {
+  THUMB_0,
+  THUMB_1,
+  THUMB_2,
+  INDEX_3,
+  MIDDLE_4,
+  RING_5,
+  LITTLE_6,
+  INDEX_7,
+  MIDDLE_8,
+  RING_9,
+  NUM_BUTTONS
+};
+
+const char *ButtonToStr(int btn);
+
+// The returned string is going to be invalidated after the next call to
+// ByteToStr()
+const char *IBM_KeyToStr(IBM_Key key);
+
+template <typename... Args> void DebugPrintf(Args... args) {
+  if constexpr (kDebug) {
+#if defined(ARDUINO)
+    Serial.printf(args...);
+#else
+    printf(args...);
+#endif
+  }
+}
+
+// Set of pressed buttons, bit `i` = button `i`.
+using ButtonMask = uint16_t;
+
+constexpr ButtonMask ButtonBit(Button button) { return 1 << button; }
+
+// One-shot timer. The callback runs on the same task as the button events (the
+// input task on the firmware, the simulated clock on the host), so the engine
+// state is never accessed concurrently.
+struct Timer {
+  virtual void Start(int64_t timeout_micros) = 0;
+  virtual void Stop() = 0;
+  virtual bool IsActive() = 0;
+};
+
+struct Clock {
+  // Microseconds since boot (same as esp_timer_get_time).
+  virtual int64_t Micros() = 0;
+  unsigned long Millis() { return Micros() / 1000; }
+  // Returns nullptr if the timer couldn't be created.
+  virtual Timer *CreateTimer(const char *name, void (*callback)(void *),
+                             void *arg) = 0;
+};
+
+struct Gpio {
+  // Current (possibly bouncing) state of all the switches, read at once.
+  virtual ButtonMask ReadPressed() = 0;
+};
+
+// Receives the keys in the format of BleKeyboard::press / release.
+struct HidSink {
+  virtual void Press(IBM_Key key) = 0;
+  virtual void Release(IBM_Key key) = 0;
+  // Called at the end of every button / timer event.
+  virtual void Flush() {}
+};
+
+// Merges the key presses & releases of an event into as few reports as the host
+// needs to see the same keystrokes. The pending report is sent early only if
+// the next change would undo a change the host didn't see yet (a key pressed &
+// released by the same action) or would change the modifiers of a key that was
+// just pressed.
+struct CoalescingHidSink : HidSink {
+  KeyReport host_report = {}; // last report sent
+  KeyReport pending = {};
+
+  virtual void SendReport(const KeyReport &report) = 0;
+
+  void Press(IBM_Key key) override {
+    KeyReport next = pending;
+    if (AddToKeyReport(next, key)) {
+      Apply(next);
+    }
+  }
+  void Release(IBM_Key key) override {
+    KeyReport next = pending;
+    if (RemoveFromKeyReport(next, key)) {
+      Apply(next);
+    }
+  }
+  void Flush() override;
+
+private:
+  void Apply(const KeyReport &next);
+};
+
+// Position of each finger in a set of pressed buttons. If a finger presses
+// several buttons, the first one wins.
+constexpr FingerPosition Thumb(ButtonMask buttons) {
+  if (buttons & ButtonBit(THUMB_0))
+    return 1;
+  if (buttons & ButtonBit(THUMB_1))
+    return 2;
+  if (buttons & ButtonBit(THUMB_2))
+    return 3;
+  return 0;
+}
+
+constexpr FingerPosition Index(ButtonMask buttons) {
+  if (buttons & ButtonBit(INDEX_3))
+    return 1;
+  if (buttons & ButtonBit(INDEX_7))
+    return 2;
+  return 0;
+}
+
+constexpr FingerPosition Middle(ButtonMask buttons) {
+  if (buttons & ButtonBit(MIDDLE_4))
+    return 1;
+  if (buttons & ButtonBit(MIDDLE_8))
+    return 2;
+  return 0;
+}
+
+constexpr FingerPosition Ring(ButtonMask buttons) {
+  if (buttons & ButtonBit(RING_5))
+    return 1;
+  if (buttons & ButtonBit(RING_9))
+    return 2;
+  return 0;
+}
+
+constexpr FingerPosition Little(ButtonMask buttons) {
+  if (buttons & ButtonBit(LITTLE_6))
+    return 1;
+  return 0;
+}
+
+// Index into `Layout::actions`. 0 means no action.
+using ActionId = uint16_t;
+
+enum ActionOp : uint8_t {
+  OP_NONE,
+  // Presses `key` on start, releases it (and the temporary modifiers) on stop.
+  OP_KEY,
+  // Toggles the `key` modifier for the next key press. It's released along
+  // with the next key.
+  OP_TEMPORARY_MODIFIER,
+  // Presses the `key` modifier and keeps it pressed until `hold_button` is
+  // released. Always followed by its OP_RELEASE_HELD_MODIFIER in the table.
+  OP_HOLD_MODIFIER,
+  // Releases the `key` modifier on stop.
+  OP_RELEASE_HELD_MODIFIER,
+};
+
+// One step of an action. Starting an action starts its whole `next` chain,
+// stopping it stops the chain in reverse order.
+struct Action {
+  ActionOp op = OP_NONE;
+  IBM_Key key = 0;
+  Button hold_button = 0;
+  ActionId next = 0;
+};
+
+struct Layer {
+  ActionId chords[4][3][3][3][2] = {};
+
+  // For every set of pressed buttons - the only action that can still be
+  // reached by pressing more buttons (or 0 if there are zero or many).
+  // Filled by `CompileUniqueActions` so that the key-down path doesn't have to
+  // scan `chords`.
+  ActionId unique_actions[1 << NUM_BUTTONS] = {};
+
+  ActionId ChordAction(ButtonMask buttons) const {
+    return chords[Thumb(buttons)][Index(buttons)][Middle(buttons)]
+                 [Ring(buttons)][Little(buttons)];
+  }
+
+  // Must be called after `chords` are modified.
+  constexpr void CompileUniqueActions() {
+    // A finger position of 0 (not pressing) matches any position of that
+    // finger. Chords that share the pressed positions are first found for each
+    // of the 4*3*3*3*2 combinations and then spread over the button masks.
+    ActionId unique[4][3][3][3][2] = {};
+    for (int thumb_current = 0; thumb_current <= 3; ++thumb_current)
+      for (int index_current = 0; index_current <= 2; ++index_current)
+        for (int middle_current = 0; middle_current <= 2; ++middle_current)
+          for (int ring_current = 0; ring_current <= 2; ++ring_current)
+            for (int little_current = 0; little_current <= 1;
+                 ++little_current) {
+              ActionId first_found = 0;
+              int found_count = 0;
+              for (int thumb = 0; thumb <= 3; ++thumb) {
+                if (thumb_current && thumb_current != thumb)
+                  continue;
+                for (int index = 0; index <= 2; ++index) {
+                  if (index_current && index_current != index)
+                    continue;
+                  for (int middle = 0; middle <= 2; ++middle) {
+                    if (middle_current && middle_current != middle)
+                      continue;
+                    for (int ring = 0; ring <= 2; ++ring) {
+                      if (ring_current && ring_current != ring)
+                        continue;
+                      for (int little = 0; little <= 1; ++little) {
+                        if (little_current && little_current != little)
+                          continue;
+                        if (ActionId found =
+                                chords[thumb][index][middle][ring][little]) {
+                          first_found = found;
+                          ++found_count;
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+              unique[thumb_current][index_current][middle_current]
+                    [ring_current][little_current] =
+                        found_count == 1 ? first_found : 0;
+            }
+    for (int buttons = 0; buttons < (1 << NUM_BUTTONS); ++buttons) {
+      unique_actions[buttons] =
+          unique[Thumb(buttons)][Index(buttons)][Middle(buttons)]
+                [Ring(buttons)][Little(buttons)];
+    }
+  }
+};
+
+// Actions, chords & arpeggios of a layout.
+//
+// Layouts are built at compile time (see Layout.cpp) so that they live in
+// flash - the firmware doesn't allocate anything for them at boot. Adding more
+// than `kMaxActions` actions fails the compilation.
+struct Layout {
+  constexpr static int kMaxActions = 320;
+
+  Action actions[kMaxActions] = {};
+  int action_count = 1; // actions[0] is the "no action"
+  Layer base_layer = {};
+  ActionId arpeggios[NUM_BUTTONS][NUM_BUTTONS] = {};
+
+  constexpr ActionId Add(Action action) {
+    actions[action_count] = action;
+    return action_count++;
+  }
+
+  // Shortcuts for faster layout definition
+  constexpr ActionId Key(IBM_Key key, ActionId next = 0) {
+    return Add({OP_KEY, key, 0, next});
+  }
+  constexpr ActionId Mod(IBM_Key modifier, ActionId next = 0) {
+    return Add({OP_TEMPORARY_MODIFIER, modifier, 0, next});
+  }
+  constexpr ActionId Hold(Button hold_button, IBM_Key modifier,
+                          ActionId next = 0) {
+    ActionId hold = Add({OP_HOLD_MODIFIER, modifier, hold_button, next});
+    Add({OP_RELEASE_HELD_MODIFIER, modifier, 0, 0});
+    return hold;
+  }
+
+  // Every chord without the little finger gets a variant that holds Shift
+  // while LITTLE_6 is pressed (unless that variant is already defined).
+  constexpr void AddShifts() {
+    for (int thumb = 0; thumb <= 3; ++thumb) {
+      for (int index = 0; index <= 2; ++index) {
+        for (int middle = 0; middle <= 2; ++middle) {
+          for (int ring = 0; ring <= 2; ++ring) {
+            ActionId base = base_layer.chords[thumb][index][middle][ring][0];
+            ActionId &shift = base_layer.chords[thumb][index][middle][ring][1];
+            if (base == 0)
+              continue;
+            if (shift)
+              continue;
+            shift = Hold(LITTLE_6, KEY_LEFT_SHIFT, base);
+          }
+        }
+      }
+    }
+  }
+};
+
+// The default layout (Layout.cpp).
+extern const Layout kDefaultLayout;
+
+struct ChordStats;
+struct TraceRecorder;
+
+// How the engine picked an action (recorded in the trace, see TraceRecorder.h).
+enum EngineDecision : uint8_t {
+  // The only action that can be reached from the pressed buttons
+  DECISION_UNIQUE,
+  DECISION_ARPEGGIO,
+  // Chord released
+  DECISION_CHORD,
+  // Chord held for kChordAutostartMillis
+  DECISION_AUTOSTART,
+  // Chord released, but it has no action
+  DECISION_NO_CHORD,
+};
+
+struct ChordEngine {
+  Clock &clock;
+  HidSink &hid;
+
+  const Layout &layout;
+  const Layer *current_layer = &layout.base_layer;
+
+  ButtonMask buttons_down = 0;
+  ActionId active_button_actions[NUM_BUTTONS] = {};
+  ActionId chord_action = 0;
+  Timer *chord_autostart_timer = nullptr;
+
+  // Counts the executed chords & arpeggios (optional, see ChordStats.h).
+  ChordStats *stats = nullptr;
+  // Records the engine's decisions (optional, see TraceRecorder.h).
+  TraceRecorder *trace = nullptr;
+
+  enum ArpeggioState {
+    STATE_READY,
+    STATE_BUTTON1_DOWN,
+    STATE_BUTTON2_DOWN,
+    STATE_INACTIVE,
+  } arpeggio_state = STATE_READY;
+  unsigned long arpeggio_start_millis = 0;
+  Button arpeggio_button1 = 0;
+  Button arpeggio_button2 = 0;
+
+  std::vector<IBM_Key> temp_modifiers;
+
+  ChordEngine(Clock &clock, HidSink &hid,
+              const Layout &layout = kDefaultLayout)
+      : clock(clock), hid(hid), layout(layout) {}
+
+  // Creates the timers. Must be called before the first button event.
+  void Setup();
+
+  ActionId FindUniqueAction() const {
+    return current_layer->unique_actions[buttons_down];
+  }
+  void ReleaseTempModifiers();
+
+  void ExecuteAction(ActionId id) {
+    StartAction(id);
+    StopAction(id);
+  }
+  void StartAction(ActionId id);
+  void StopAction(ActionId id);
+  // Called for every chord & arpeggio decision, before the action is started.
+  // `buttons` are the buttons that picked the action.
+  void Decide(ActionId id, EngineDecision decision, ButtonMask buttons);
+
+  void OnButtonDown(Button i);
+  void OnButtonUp(Button i);
+  void OnChordAutostart();
+};
+
+// Edge of a button signal, recorded by the GPIO interrupt. The host build
+// replays sequences of these.
+struct ButtonChange {
+  uint8_t button : 4;
+  int64_t time : 52; // esp_timer_get_time returns up to 52 bits
+} __attribute__((packed));
+
+// Zero-latency debouncer of all the buttons.
+//
+// Initial state change of a button is immediately registered as button press or
+// release. The button is then unsettled and its subsequent state changes are
+// ignored until it's been quiet for `kSettleScans` scans in a row. The scans
+// run on a single timer, only while some button is unsettled - they read all
+// the switches at once and count the quiet scans of every button with a
+// vertical (bit-sliced) counter. When a button settles, its switch is read to
+// verify the registered state.
+//
+// The approach used by this debouncer results in zero latency but a minimal
+// press duration equal to the debounce window.
+struct ButtonDebouncer {
+  ButtonMask pressed_state = 0;
+  // Buttons that changed recently and whose edges are ignored.
+  ButtonMask unsettled = 0;
+  // Buttons with an edge since the last scan.
+  ButtonMask bounced = 0;
+  // Switch levels seen by the last scan.
+  ButtonMask last_scan = 0;
+  // Number of quiet scans of each unsettled button (bit 0 & bit 1).
+  ButtonMask quiet_count0 = 0, quiet_count1 = 0;
+  Timer *timer = nullptr;
+  Gpio *gpio = nullptr;
+  // Receives the debounced state changes (pressed = true).
+  std::function<void(Button, bool)> report;
+
+  // Experimentally, the shortest physically possible key press was a tad over
+  // 15ms. A button settles after 15-20ms without edges.
+  constexpr static int64_t kScanMicroseconds = 5 * 1000;
+  constexpr static int kSettleScans = 3;
+
+  // Called at setup time
+  void OnSetup(Clock &clock, Gpio &gpio,
+               std::function<void(Button, bool)> report);
+
+  // Called for every edge reported by the GPIO interrupt.
+  void OnChange(Button button);
+
+  void OnScan();
+};
+
+// Replays the presses that woke the keyboard up from deep sleep, before any
+// other event. The `waking` buttons go first, then the other `held` ones.
+// Waking buttons that are no longer held were tapped and are released at the
+// end - the debouncer reports the releases of the others.
+void ReplayWakeButtons(ButtonMask waking, ButtonMask held,
+                       const std::function<void(Button, bool)> &report);
@@ -1,95 +1,171 @@
 #include "BleKeyboard.h"
+#include "ChordEngine.h"
+#include "ChordStats.h"
+#include "ConnectionPolicy.h"
+#include "EventRing.h"
+#include "LatencyStats.h"
+#include "ReconnectPolicy.h"
+#include "ReportBuffer.h"
+#include "TimerExpiry.h"
+#include "TraceRecorder.h"
+#include "driver/rtc_io.h"
 #include "esp_gap_ble_api.h"
+#include "esp_heap_caps.h"
 #include "esp_pm.h"
 #include "esp_sleep.h"
 #include "esp_timer.h"
 #include "freertos/portmacro.h"
+#include "nvs.h"
+#include "soc/gpio_reg.h"
 #include <Arduino.h>
 #include <BLEDevice.h>
 #include <BLESecurity.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <vector>
 
-// Change to true to enable serial debug output
-//
-// The default is false because when device is not connected to a computer but
-// is printing to the serial port, it causes the device to become laggy (weird).
-constexpr bool kDebug = false;
-
-// Set this to something like 350 to enable chord autostart when a chord is held
-// down for this duration. Chords started this way cause the keys to be pressed
-// and they will be released only when the chord is also released. This allows
-// chords to function more like keyboard keys.
-//
-// This is disabled by default because it makes learning very hard. Re-enable
-// this once your WPM is above 20.
-constexpr unsigned long kChordAutostartMillis = 350 * 1000 * 1000;
-
-// The two arpeggio keys must be spread apart by at least this many
-// milliseconds.
-constexpr unsigned long kArpeggioMinSpacingMillis = 80;
-
-// Arpeggios must be released quickly after the last button is pressed. This
-// constant conrols how long the last button can be held down for an action to
-// be registered as an arpeggio.
-constexpr unsigned long kArpeggioMaxHoldMillis = 240;
-
-// Character sent by the keyboard to the computer
-using IBM_Key = uint8_t;
-
 using GPIO_Pin = uint8_t;
 
-// A mechanical switch numbered 0-9
-using Button = uint8_t;
-
-// 0 = not pressing, 1 = pressing first button, 2 = pressing second button, etc.
-using FingerPosition = uint8_t;
-
-BleKeyboard ble_keyboard("temp", "𝖒𝖆𝖋", 100);
+// The keyboard goes to deep sleep after this long without key presses. Only
+// the buttons on RTC GPIOs (0-21) can wake it up.
+constexpr unsigned long kDeepSleepIdleMillis = 10 * 60 * 1000;
+
+// Events kept by the trace recorder - 1 MB of PSRAM, minutes of typing.
+constexpr uint32_t kTraceEvents = 1 << 16;
+
+LatencyStats latency_stats;
+ChordStats chord_stats;
+TraceRecorder trace;
+
+// ISR timestamp of the edge being processed by the input task (-1 while it
+// runs timer callbacks). Reports are attributed to it.
+int64_t current_edge_time = -1;
+
+// Custom GATT service with the latency histograms (in the format of
+// LatencyStats::Serialize).
+#define STATS_SERVICE_UUID "8f6a0001-2c4e-4b8f-9a3e-6b1d2c3e4f50"
+#define LATENCY_CHARACTERISTIC_UUID "8f6a0002-2c4e-4b8f-9a3e-6b1d2c3e4f50"
+#define CHORD_STATS_CHARACTERISTIC_UUID "8f6a0003-2c4e-4b8f-9a3e-6b1d2c3e4f50"
+#define TRACE_CHARACTERISTIC_UUID "8f6a0004-2c4e-4b8f-9a3e-6b1d2c3e4f50"
+
+struct LatencyCharacteristicCallbacks : BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic *characteristic) override {
+    uint8_t value[LatencyStats::kSerializedSize];
+    latency_stats.Serialize(value);
+    characteristic->setValue(value, sizeof(value));
+  }
+} latency_characteristic_callbacks;
+
+// The chord stats don't fit in one attribute. Reads return consecutive chunks
+// of ChordStats::Serialize and an empty value marks the end. A write restarts
+// the export.
+struct ChordStatsCharacteristicCallbacks : BLECharacteristicCallbacks {
+  constexpr static size_t kChunkSize = 500; // attributes are at most 512 bytes
+  std::vector<uint8_t> snapshot;
+  size_t offset = 0;
+
+  void onRead(BLECharacteristic *characteristic) override {
+    if (offset == 0) {
+      snapshot = chord_stats.Serialize(kDefaultLayout);
+    }
+    size_t size = std::min(kChunkSize, snapshot.size() - offset);
+    characteristic->setValue(snapshot.data() + offset, size);
+    offset = size ? offset + size : 0;
+  }
+  void onWrite(BLECharacteristic *) override { offset = 0; }
+} chord_stats_characteristic_callbacks;
+
+// Reads return consecutive chunks of the trace dump (see TraceRecorder) and an
+// empty value marks the end. The recording is paused from the first read until
+// the end. A write restarts the dump. A dump that is abandoned - the link drops
+// or no chunk is read for `kAbandonMicros` - ends as well, so that the
+// recording doesn't stay paused.
+struct TraceCharacteristicCallbacks : BLECharacteristicCallbacks {
+  constexpr static size_t kChunkSize = 496; // 31 records
+  constexpr static int64_t kAbandonMicros = 5 * 1000 * 1000;
+  uint8_t chunk[kChunkSize];
+  std::atomic<size_t> offset{0};
+  esp_timer_handle_t abandon_timer = nullptr;
+
+  void Setup() {
+    auto args = esp_timer_create_args_t{
+        .callback = [](void *arg) {
+          static_cast<TraceCharacteristicCallbacks *>(arg)->EndDump();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "Trace dump",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&args, &abandon_timer) != ESP_OK) {
+      DebugPrintf("Failed to create the trace dump timer\n");
+      abandon_timer = nullptr;
+    }
+  }
 
-const GPIO_Pin BATTERY_PIN = 3;
+  // Safe to call from any task.
+  void EndDump() {
+    if (abandon_timer) {
+      esp_timer_stop(abandon_timer);
+    }
+    offset = 0;
+    trace.Resume();
+  }
 
-enum ButtonEnum {
-  THUMB_0,
-  THUMB_1,
-  THUMB_2,
-  INDEX_3,
-  MIDDLE_4,
-  RING_5,
-  LITTLE_6,
-  INDEX_7,
-  MIDDLE_8,
-  RING_9,
-  NUM_BUTTONS
+  void onRead(BLECharacteristic *characteristic) override {
+    size_t start = offset;
+    if (start == 0) {
+      trace.Pause();
+    }
+    size_t size = trace.ReadDump(start, chunk, kChunkSize);
+    characteristic->setValue(chunk, size);
+    if (size == 0) {
+      EndDump();
+      return;
+    }
+    offset = start + size;
+    if (abandon_timer) {
+      esp_timer_stop(abandon_timer);
+      esp_timer_start_once(abandon_timer, kAbandonMicros);
+    }
+  }
+  void onWrite(BLECharacteristic *) override { EndDump(); }
+} trace_characteristic_callbacks;
+
+struct KeyerBleKeyboard : BleKeyboard {
+  using BleKeyboard::BleKeyboard;
+
+protected:
+  // ReconnectPolicy picks the advertising on the input task
+  void startAdvertising() override;
+
+  void onStarted(BLEServer *server) override {
+    BLEService *service = server->createService(STATS_SERVICE_UUID);
+    BLECharacteristic *latency = service->createCharacteristic(
+        LATENCY_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ);
+    latency->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED);
+    latency->setCallbacks(&latency_characteristic_callbacks);
+    BLECharacteristic *stats = service->createCharacteristic(
+        CHORD_STATS_CHARACTERISTIC_UUID,
+        BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+    stats->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED |
+                                ESP_GATT_PERM_WRITE_ENCRYPTED);
+    stats->setCallbacks(&chord_stats_characteristic_callbacks);
+    BLECharacteristic *dump = service->createCharacteristic(
+        TRACE_CHARACTERISTIC_UUID,
+        BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+    dump->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED |
+                               ESP_GATT_PERM_WRITE_ENCRYPTED);
+    dump->setCallbacks(&trace_characteristic_callbacks);
+    service->start();
+  }
 };
 
-const char *ButtonToStr(int btn) {
-  switch (btn) {
-  case THUMB_0:
-    return "THUMB_0";
-  case THUMB_1:
-    return "THUMB_1";
-  case THUMB_2:
-    return "THUMB_2";
-  case INDEX_3:
-    return "INDEX_3";
-  case MIDDLE_4:
-    return "MIDDLE_4";
-  case RING_5:
-    return "RING_5";
-  case LITTLE_6:
-    return "LITTLE_6";
-  case INDEX_7:
-    return "INDEX_7";
-  case MIDDLE_8:
-    return "MIDDLE_8";
-  case RING_9:
-    return "RING_9";
-  default:
-    return "UNKNOWN";
-  }
-}
+KeyerBleKeyboard ble_keyboard("temp", "𝖒𝖆𝖋", 100);
+
+const GPIO_Pin BATTERY_PIN = 3;
 
 constexpr GPIO_Pin kButtonPin[NUM_BUTTONS] = {
     [THUMB_0] = 2,   [THUMB_1] = 5, [THUMB_2] = 0,   [INDEX_3] = 46,
@@ -97,405 +173,330 @@ constexpr GPIO_Pin kButtonPin[NUM_BUTTONS] = {
     [MIDDLE_8] = 8,  [RING_9] = 42,
 };
 
-struct Action {
-  virtual void OnStart() = 0;
-  virtual void OnStop() = 0;
-  Action(Action *next = nullptr) : next(next) {}
-  void Execute() {
-    Start();
-    Stop();
-  }
-  void Start() {
-    OnStart();
-    if (next) {
-      next->Start();
+// Everything that touches the chord engine runs on this task. The button edges
+// and timer expirations are delivered to it as bits of its notification value
+// so that the engine needs no locking.
+TaskHandle_t input_task;
+constexpr uint32_t kButtonChangesBit = 1 << 0;
+
+// The esp_timer task only reports the expiration - its callback runs on the
+// input task. Expirations that were in flight while the timer was stopped or
+// restarted are dropped (see TimerExpiry.h).
+struct EspTimer : Timer {
+  esp_timer_handle_t handle;
+  uint32_t notify_bit;
+  void (*callback)(void *);
+  void *arg;
+  TimerExpiry expiry;
+
+  void Start(int64_t timeout_micros) override {
+    esp_timer_stop(handle);
+    // Read before esp_timer_start_once so that it's not later than its alarm
+    expiry.Arm(esp_timer_get_time() + timeout_micros);
+    esp_timer_start_once(handle, timeout_micros);
+  }
+  void Stop() override {
+    esp_timer_stop(handle);
+    expiry.Disarm();
+  }
+  // A timer that fired but whose callback didn't run yet is still active.
+  bool IsActive() override { return expiry.IsActive(); }
+
+  static void OnExpired(void *arg) {
+    auto timer = static_cast<EspTimer *>(arg);
+    timer->expiry.Expire();
+    xTaskNotify(input_task, timer->notify_bit, eSetBits);
+  }
+
+  void RunIfFired() {
+    if (expiry.TakeExpired(esp_timer_get_time())) {
+      callback(arg);
     }
   }
-  void Stop() {
-    if (next) {
-      next->Stop();
+};
+
+struct EspClock : Clock {
+  // Notification bits 1..kMaxTimers
+  constexpr static int kMaxTimers = 8;
+  EspTimer *timers[kMaxTimers];
+  int timer_count = 0;
+
+  int64_t Micros() override { return esp_timer_get_time(); }
+  Timer *CreateTimer(const char *name, void (*callback)(void *),
+                     void *arg) override {
+    if (timer_count == kMaxTimers) {
+      return nullptr;
+    }
+    EspTimer *timer = new EspTimer();
+    timer->notify_bit = 1 << (timer_count + 1);
+    timer->callback = callback;
+    timer->arg = arg;
+    auto args = esp_timer_create_args_t{.callback = EspTimer::OnExpired,
+                                        .arg = timer,
+                                        .dispatch_method = ESP_TIMER_TASK,
+                                        .name = name,
+                                        .skip_unhandled_events = false};
+    if (esp_timer_create(&args, &timer->handle) != ESP_OK) {
+      delete timer;
+      return nullptr;
+    }
+    timers[timer_count++] = timer;
+    return timer;
+  }
+} esp_clock;
+
+struct ButtonGpio : Gpio {
+  // Reads the input registers of all the pins at once (buttons pull them low)
+  ButtonMask ReadPressed() override {
+    uint64_t levels =
+        REG_READ(GPIO_IN_REG) | (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+    ButtonMask pressed = 0;
+    for (Button i = 0; i < NUM_BUTTONS; i++) {
+      if (!(levels >> kButtonPin[i] & 1)) {
+        pressed |= ButtonBit(i);
+      }
+    }
+    return pressed;
+  }
+} button_gpio;
+
+// Set from a deep sleep wake-up until the first report of the waking chord is
+// sent.
+bool waking = false;
+// Event time of that report, for the app start->report histogram.
+constexpr int64_t kWakeEventTime = -2;
+
+// Whether the host is connected and the link encrypted (input task only).
+// While it isn't, the reports wait in `report_buffer`.
+bool host_ready = false;
+ReportBuffer report_buffer;
+// Set while `report_buffer` isn't empty, so that the sender task asks for more
+// reports when it sends one.
+std::atomic<bool> flushing{false};
+
+// Set when the sender task has room for more of the buffered reports.
+constexpr uint32_t kFlushBit = 1 << (EspClock::kMaxTimers + 3);
+
+// Moves buffered reports to the BleKeyboard queue, as many as fit without
+// waiting. The sender task paces them by the notification confirmations.
+void FlushReports() {
+  if (host_ready && ble_keyboard.isConnected()) {
+    KeyReport report;
+    size_t slots = ble_keyboard.freeReportSlots();
+    for (; slots && report_buffer.Pop(report, esp_timer_get_time()); --slots) {
+      int64_t event_time = -1;
+      if (waking) {
+        waking = false;
+        if (report_buffer.expired == 0) {
+          event_time = kWakeEventTime;
+        }
+      }
+      ble_keyboard.sendReport(&report, event_time);
     }
-    OnStop();
   }
-  Action *next;
-};
+  flushing = !report_buffer.Empty();
+}
 
-struct Layer {
-  Action *chords[4][3][3][3][2];
-};
+struct BleHid : CoalescingHidSink {
+  void SendReport(const KeyReport &report) override {
+    trace.Report(esp_timer_get_time(), report);
+    // Buffered reports go first
+    if (!host_ready || !ble_keyboard.isConnected() || !report_buffer.Empty()) {
+      report_buffer.Push(report, esp_timer_get_time());
+      FlushReports();
+      return;
+    }
+    KeyReport copy = report;
+    if (!ble_keyboard.sendReport(&copy, current_edge_time)) {
+      // The sender queue is full - wait in the buffer until it drains
+      report_buffer.Push(report, esp_timer_get_time());
+      flushing = true;
+    }
+  }
+} ble_hid;
 
-Layer base_layer = {};
-Layer *current_layer = &base_layer;
-
-#define CHORDS current_layer->chords
-
-Action *arpeggios[NUM_BUTTONS][NUM_BUTTONS];
-
-bool buttons_down[NUM_BUTTONS];
-Action *active_button_actions[NUM_BUTTONS];
-Action *chord_action;
-esp_timer_handle_t chord_autostart_timer;
-
-enum ArpeggioState {
-  STATE_READY,
-  STATE_BUTTON1_DOWN,
-  STATE_BUTTON2_DOWN,
-  STATE_INACTIVE,
-} arpeggio_state = STATE_READY;
-unsigned long arpeggio_start_millis = 0;
-Button arpeggio_button1 = 0;
-Button arpeggio_button2 = 0;
-
-FingerPosition Thumb() {
-  if (buttons_down[THUMB_0])
-    return 1;
-  if (buttons_down[THUMB_1])
-    return 2;
-  if (buttons_down[THUMB_2])
-    return 3;
-  return 0;
+// Runs on the BleKeyboard sender task
+void OnReportSent(int64_t edge_time) {
+  if (edge_time >= 0) {
+    latency_stats.edge_to_notify.Record(esp_timer_get_time() - edge_time);
+  } else if (edge_time == kWakeEventTime) {
+    // esp_timer starts with the app, after the ROM & bootloader
+    latency_stats.app_start_to_report.Record(esp_timer_get_time() / 1000);
+  }
+  if (flushing) {
+    xTaskNotify(input_task, kFlushBit, eSetBits);
+  }
 }
 
-FingerPosition Index() {
-  if (buttons_down[INDEX_3])
-    return 1;
-  if (buttons_down[INDEX_7])
-    return 2;
-  return 0;
-}
+ChordEngine engine(esp_clock, ble_hid);
 
-FingerPosition Middle() {
-  if (buttons_down[MIDDLE_4])
-    return 1;
-  if (buttons_down[MIDDLE_8])
-    return 2;
-  return 0;
-}
+// Set when the link is (re)established, so that the input task can reset the
+// connection parameters.
+constexpr uint32_t kConnectedBit = 1 << (EspClock::kMaxTimers + 1);
 
-FingerPosition Ring() {
-  if (buttons_down[RING_5])
-    return 1;
-  if (buttons_down[RING_9])
-    return 2;
-  return 0;
-}
+// Set when the link is lost (and after boot), so that the input task can
+// start advertising.
+constexpr uint32_t kAdvertiseBit = 1 << (EspClock::kMaxTimers + 2);
 
-FingerPosition Little() {
-  if (buttons_down[LITTLE_6])
-    return 1;
-  return 0;
+void KeyerBleKeyboard::startAdvertising() {
+  xTaskNotify(input_task, kAdvertiseBit, eSetBits);
 }
 
-// The returned string is going to be invalidated after the next call to
-// ByteToStr()
-const char *IBM_KeyToStr(IBM_Key key) {
-  switch (key) {
-  case KEY_LEFT_CTRL:
-    return "CtrlL";
-  case KEY_RIGHT_CTRL:
-    return "CtrlR";
-  case KEY_LEFT_SHIFT:
-    return "ShiftL";
-  case KEY_RIGHT_SHIFT:
-    return "ShiftR";
-  case KEY_LEFT_ALT:
-    return "AltL";
-  case KEY_RIGHT_ALT:
-    return "AltR";
-  case KEY_LEFT_GUI:
-    return "GuiL";
-  case KEY_RIGHT_GUI:
-    return "GuiR";
-  case KEY_ESC:
-    return "Esc";
-  case KEY_RETURN:
-    return "Enter";
-  case ' ':
-    return "Space";
-  case KEY_TAB:
-    return "Tab";
-  case KEY_BACKSPACE:
-    return "Backspace";
-  case KEY_DELETE:
-    return "Delete";
-  default:
-    break;
-  }
-  static char buf[10];
-  if (isprint(key)) {
-    snprintf(buf, sizeof(buf), "%c", key);
-  } else {
-    snprintf(buf, sizeof(buf), "0x%02x", key);
-  }
-  return buf;
-}
+// Address of the central, written before kConnectedBit is sent. Kept in RTC
+// memory, so it's still known after a deep sleep (all zeros until the first
+// connection).
+RTC_DATA_ATTR esp_bd_addr_t peer_address;
+RTC_DATA_ATTR esp_ble_addr_type_t peer_address_type;
 
-std::vector<IBM_Key> temp_modifiers;
+// The last authenticated host is also kept in NVS, as a `StoredPeer` blob, so
+// that it survives a power cycle.
+constexpr char kPeerNamespace[] = "peer";
+constexpr char kPeerKey[] = "last";
 
-template <typename... Args> void DebugPrintf(Args... args) {
-  if constexpr (kDebug) {
-    Serial.printf(args...);
-  }
-}
+struct StoredPeer {
+  esp_bd_addr_t address;
+  esp_ble_addr_type_t type;
+};
 
-void ReleaseTempModifiers() {
-  for (auto mod : temp_modifiers) {
-    DebugPrintf("  Releasing modifier: %s (ReleaseTempModifiers)\n",
-                IBM_KeyToStr(mod));
-    ble_keyboard.release(mod);
+bool LoadPeer(StoredPeer &peer) {
+  nvs_handle_t handle;
+  if (nvs_open(kPeerNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return false; // nothing saved yet
   }
-  temp_modifiers.clear();
+  size_t size = sizeof(peer);
+  bool loaded = nvs_get_blob(handle, kPeerKey, &peer, &size) == ESP_OK &&
+                size == sizeof(peer);
+  nvs_close(handle);
+  return loaded;
 }
 
-struct WriteKeyAction : Action {
-  IBM_Key key;
-  WriteKeyAction(IBM_Key key, Action *next = nullptr)
-      : Action(next), key(key) {}
-  void OnStart() override {
-    DebugPrintf("  Pressing key: %s (WriteKeyAction)\n", IBM_KeyToStr(key));
-    ble_keyboard.press(key);
-  }
-  void OnStop() override {
-    DebugPrintf("  Releasing key: %s (WriteKeyAction)\n", IBM_KeyToStr(key));
-    ble_keyboard.release(key);
-    ReleaseTempModifiers();
+// Runs on the input task after every authentication. Writes the flash only
+// when the host changed.
+void SavePeer() {
+  StoredPeer peer = {};
+  memcpy(peer.address, peer_address, sizeof(peer.address));
+  peer.type = peer_address_type;
+  StoredPeer saved;
+  if (LoadPeer(saved) &&
+      memcmp(saved.address, peer.address, sizeof(peer.address)) == 0 &&
+      saved.type == peer.type) {
+    return;
   }
-};
-// A modifier that affects the next key press.
-// It's released along with the next key.
-struct TemporaryModifierAction : Action {
-  IBM_Key modifier;
-  TemporaryModifierAction(IBM_Key modifier, Action *next = nullptr)
-      : Action(next), modifier(modifier) {}
-  void OnStart() override {
-    auto existing_modifier_it = temp_modifiers.end();
-    for (auto it = temp_modifiers.begin(); it != temp_modifiers.end(); ++it) {
-      if (*it == modifier) {
-        existing_modifier_it = it;
-        break;
-      }
-    }
-    if (existing_modifier_it != temp_modifiers.end()) {
-      DebugPrintf("  Releasing modifier [%s] (TemporaryModifierAction)\n",
-                  IBM_KeyToStr(modifier));
-      ble_keyboard.release(modifier);
-      temp_modifiers.erase(existing_modifier_it);
-    } else {
-      DebugPrintf("  Pressing modifier [%s] (TemporaryModifierAction)\n",
-                  IBM_KeyToStr(modifier));
-      ble_keyboard.press(modifier);
-      temp_modifiers.push_back(modifier);
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(kPeerNamespace, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, kPeerKey, &peer, sizeof(peer));
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
     }
+    nvs_close(handle);
   }
-  void OnStop() override {}
-};
-struct HoldModifierAction : Action {
-  Button hold_button;
-  IBM_Key modifier;
-  struct ReleaseHeldModifierAction : Action {
-    HoldModifierAction &hold_action;
-    ReleaseHeldModifierAction(HoldModifierAction &hold_action)
-        : Action(nullptr), hold_action(hold_action) {}
-    void OnStart() override {}
-    void OnStop() override {
-      DebugPrintf("  Releasing modifier [%s] (ReleaseHeldModifierAction)\n",
-                  IBM_KeyToStr(hold_action.modifier));
-      ble_keyboard.release(hold_action.modifier);
-    }
-  };
-  ReleaseHeldModifierAction release_action;
-  HoldModifierAction(Button held_key, IBM_Key modifier, Action *next = nullptr)
-      : Action(next), hold_button(held_key), modifier(modifier),
-        release_action(*this) {}
-  void OnStart() override {
-    if (active_button_actions[hold_button]) {
-      DebugPrintf("  Keeping modifier [%s] (HoldModifierAction)\n",
-                  IBM_KeyToStr(modifier));
-      return;
-    }
-    DebugPrintf("  Pressing modifier [%s] (HoldModifierAction)\n",
-                IBM_KeyToStr(modifier));
-    ble_keyboard.press(modifier);
-    active_button_actions[hold_button] = &release_action;
+  if (err != ESP_OK) {
+    DebugPrintf("Failed to save the peer address: %d\n", err);
   }
-  void OnStop() override {}
-};
-
-// Shortcuts for faster layout definition
-static Action *Key(IBM_Key key, Action *next = nullptr) {
-  return new WriteKeyAction(key, next);
-}
-static Action *Mod(IBM_Key modifier, Action *next = nullptr) {
-  return new TemporaryModifierAction(modifier, next);
-}
-static Action *Hold(Button hold_button, IBM_Key modifier,
-                    Action *next = nullptr) {
-  return new HoldModifierAction(hold_button, modifier, next);
 }
 
-Action *FindUniqueAction() {
-  Action *first_found = nullptr;
-  FingerPosition thumb_current = Thumb(), index_current = Index(),
-                 middle_current = Middle(), ring_current = Ring(),
-                 little_current = Little();
-  for (FingerPosition thumb = 0; thumb <= 3; ++thumb) {
-    if (thumb_current && thumb_current != thumb)
-      continue;
-    for (FingerPosition index = 0; index <= 2; ++index) {
-      if (index_current && index_current != index)
-        continue;
-      for (FingerPosition middle = 0; middle <= 2; ++middle) {
-        if (middle_current && middle_current != middle)
-          continue;
-        for (FingerPosition ring = 0; ring <= 2; ++ring) {
-          if (ring_current && ring_current != ring)
-            continue;
-          for (FingerPosition little = 0; little <= 1; ++little) {
-            if (little_current && little_current != little)
-              continue;
-            if (Action *found = CHORDS[thumb][index][middle][ring][little]) {
-              if (first_found) {
-                return nullptr;
-              } else {
-                first_found = found;
-              }
-            }
-          }
-        }
-      }
-    }
+// The host to direct the advertising to - the last one since power-up, then
+// the last one saved in NVS, otherwise the first bonded one. Returns false if
+// there's none.
+bool FindPeer() {
+  const esp_bd_addr_t no_address = {};
+  if (memcmp(peer_address, no_address, sizeof(peer_address)) != 0) {
+    return true;
   }
-  return first_found;
-}
-
-void OnButtonDown(Button i) {
-  auto now = millis();
-  if (arpeggio_state == STATE_READY) {
-    arpeggio_start_millis = now;
-    arpeggio_button1 = i;
-    arpeggio_state = STATE_BUTTON1_DOWN;
-  } else if (arpeggio_state == STATE_BUTTON1_DOWN) {
-    DebugPrintf("Arpeggio key 1 down millis: %lu\n",
-                now - arpeggio_start_millis);
-    if (now - arpeggio_start_millis >= kArpeggioMinSpacingMillis) {
-      arpeggio_button2 = i;
-      arpeggio_start_millis = now;
-      arpeggio_state = STATE_BUTTON2_DOWN;
-    } else {
-      arpeggio_state = STATE_INACTIVE;
-    }
-  } else {
-    arpeggio_state = STATE_INACTIVE;
-  }
-
-  buttons_down[i] = true;
-  auto unique_action = FindUniqueAction();
-  if (unique_action) {
-    // If a unique key action was found, then don't add it to the chord but
-    // rather start it immediately This allows multiple actions to be active at
-    // the same time (as long as they have been unique at press time)
-    buttons_down[i] = false;
-    // We also don't want to start a new chord
-    if (esp_timer_is_active(chord_autostart_timer)) {
-      esp_timer_stop(chord_autostart_timer);
-    }
-    DebugPrintf(" Unique action!\n");
-    active_button_actions[i] = unique_action;
-    unique_action->Start();
-  } else {
-    if (esp_timer_is_active(chord_autostart_timer)) {
-      esp_timer_stop(chord_autostart_timer);
-    }
-    esp_timer_start_once(chord_autostart_timer, kChordAutostartMillis * 1000);
+  StoredPeer stored;
+  if (LoadPeer(stored) &&
+      memcmp(stored.address, no_address, sizeof(no_address)) != 0) {
+    memcpy(peer_address, stored.address, sizeof(peer_address));
+    peer_address_type = stored.type;
+    return true;
+  }
+  int count = esp_ble_get_bond_device_num();
+  if (count <= 0) {
+    return false;
   }
+  std::vector<esp_ble_bond_dev_t> bonded(count);
+  if (esp_ble_get_bond_device_list(&count, bonded.data()) != ESP_OK ||
+      count <= 0) {
+    return false;
+  }
+  memcpy(peer_address, bonded[0].bd_addr, sizeof(peer_address));
+  peer_address_type = bonded[0].bond_key.pid_key.addr_type;
+  return true;
 }
 
-void OnButtonUp(Button i) {
-  auto now = millis();
-  if (arpeggio_state == STATE_BUTTON2_DOWN) {
-    DebugPrintf("Arpeggio button 2 down millis: %lu\n",
-                now - arpeggio_start_millis);
-    if (now - arpeggio_start_millis <= kArpeggioMaxHoldMillis) {
-      auto action = arpeggios[arpeggio_button1][arpeggio_button2];
-      if (action) {
-        DebugPrintf("Arpeggio action\n");
-        action->Execute();
-        if (esp_timer_is_active(chord_autostart_timer)) {
-          esp_timer_stop(chord_autostart_timer);
-        }
-      }
-    }
-    arpeggio_state = STATE_INACTIVE;
-  }
-
-  if (auto &active_button_action = active_button_actions[i]) {
-    DebugPrintf("Stopping active button action\n");
-    active_button_action->Stop();
-    active_button_action = nullptr;
-  } else if (chord_action && buttons_down[i]) {
-    DebugPrintf("Stopping chord action\n");
-    chord_action->Stop();
-    chord_action = nullptr;
-  } else if (esp_timer_is_active(chord_autostart_timer)) {
-    esp_timer_stop(chord_autostart_timer);
-    auto action = CHORDS[Thumb()][Index()][Middle()][Ring()][Little()];
-    if (action) {
-      DebugPrintf("Chord action\n");
-      action->Execute();
-
-      // It's possible that chord action attaches an "active key" action to the
-      // currently released key. If that's the case then it should be
-      // immediately stopped.
-      if (auto &active_button_action = active_button_actions[i]) {
-        DebugPrintf("Stopping active button action\n");
-        active_button_action->Stop();
-        active_button_action = nullptr;
-      }
-    } else {
-      DebugPrintf("No chord action\n");
+// Runs on the input task
+void Advertise(AdvertisingMode mode) {
+  if (ble_keyboard.isConnected()) {
+    return; // the controller stopped advertising
+  }
+  esp_ble_gap_stop_advertising();
+  BLEAdvertising *advertising = ble_keyboard.getAdvertising();
+  switch (mode) {
+  case ADVERTISING_DIRECTED: {
+    esp_ble_adv_params_t params = {
+        .adv_int_min = 0x20, // not used by the high duty cycle mode
+        .adv_int_max = 0x20,
+        .adv_type = ADV_TYPE_DIRECT_IND_HIGH,
+        .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+        .peer_addr = {},
+        .peer_addr_type = peer_address_type,
+        .channel_map = ADV_CHNL_ALL,
+        .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+    };
+    memcpy(params.peer_addr, peer_address, sizeof(params.peer_addr));
+    esp_err_t err = esp_ble_gap_start_advertising(&params);
+    if (err != ESP_OK) {
+      DebugPrintf("Failed to start directed advertising: %d\n", err);
     }
+    break;
   }
-
-  buttons_down[i] = false;
-
-  bool any_button_down = false;
-  for (int i = 0; i < NUM_BUTTONS; i++) {
-    any_button_down |= buttons_down[i];
+  case ADVERTISING_FAST:
+  case ADVERTISING_SLOW: {
+    const uint16_t *interval = mode == ADVERTISING_FAST
+                                   ? kFastAdvertisingInterval
+                                   : kSlowAdvertisingInterval;
+    advertising->setMinInterval(interval[0]);
+    advertising->setMaxInterval(interval[1]);
+    advertising->start();
+    break;
   }
-  bool all_buttons_up = !any_button_down;
-  if (all_buttons_up) {
-    arpeggio_state = STATE_READY;
+  case ADVERTISING_OFF:
+    break;
   }
 }
 
-void OnChordAutostart() {
-  if (chord_action) {
-    DebugPrintf("ERROR: Chord action already active\n");
-    return;
-  }
-  auto action = CHORDS[Thumb()][Index()][Middle()][Ring()][Little()];
-  if (action) {
-    DebugPrintf("Starting chord hold\n");
-    action->Start();
-    chord_action = action;
-  }
-}
+ReconnectPolicy reconnect_policy(esp_clock, Advertise);
 
 // See
 // https://academy.nordicsemi.com/courses/bluetooth-low-energy-fundamentals/lessons/lesson-3-bluetooth-le-connections/topic/connection-parameters/
-void SetupConnectionParameters(esp_bd_addr_t addr) {
+void RequestConnectionParameters(const ConnectionParams &params) {
   esp_ble_conn_update_params_t conn_params = {
-      .bda = {addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]},
-      .min_int = 30 * 4 / 5, // 30ms in 1.25ms units
-      .max_int = 50 * 4 / 5, // 50ms in 1.25ms units
-      .latency = 0,
-      .timeout = 6000 / 10, // 6s in 10ms units
+      .bda = {peer_address[0], peer_address[1], peer_address[2],
+              peer_address[3], peer_address[4], peer_address[5]},
+      .min_int = params.min_interval,
+      .max_int = params.max_interval,
+      .latency = params.latency,
+      .timeout = params.timeout,
   };
   esp_err_t ret = esp_ble_gap_update_conn_params(&conn_params);
   if (ret != ESP_OK) {
     DebugPrintf("DEBUG: Failed to update connection parameters: %d\n", ret);
   } else {
-    DebugPrintf("DEBUG: connection parameters changed successfully\n");
+    DebugPrintf("DEBUG: requested connection interval %d-%d\n",
+                params.min_interval, params.max_interval);
+  }
+}
+
+ConnectionPolicy connection_policy(esp_clock, RequestConnectionParameters);
+
+// Runs on the BLE stack's task
+void OnGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+  if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT &&
+      param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+    connection_policy.OnUpdated(param->update_conn_params.conn_int,
+                                param->update_conn_params.latency,
+                                param->update_conn_params.timeout);
   }
 }
 
@@ -553,24 +554,26 @@ struct BleKeyboardSecurityCallbacks : public BLESecurityCallbacks {
     DebugPrintf("DEBUG: onAuthenticationComplete called\n");
     if (cmpl.success) {
       DebugPrintf("DEBUG: Pairing successful!\n");
-      SetupConnectionParameters(cmpl.bd_addr);
+      memcpy(peer_address, cmpl.bd_addr, sizeof(peer_address));
+      peer_address_type = cmpl.addr_type;
+      xTaskNotify(input_task, kConnectedBit, eSetBits);
     } else {
       DebugPrintf("DEBUG: Pairing failed, reason: %d\n", cmpl.fail_reason);
     }
   }
 } ble_kb_security;
 
-QueueHandle_t button_changes;
-
-struct ButtonChange {
-  uint8_t button : 4;
-  int64_t time : 52; // esp_timer_get_time returns up to 52 bits
-} __attribute__((packed));
+// Button edges from the interrupts to the input task. `dropped` & `high_water`
+// tell whether it's big enough.
+DRAM_ATTR EventRing<ButtonChange, 256> button_changes;
 
 #define BUTTON_ISR(button)                                                     \
   void IRAM_ATTR button_isr_##button() {                                       \
-    auto event = ButtonChange{button, esp_timer_get_time()};                   \
-    xQueueSendToBackFromISR(button_changes, &event, nullptr);                  \
+    button_changes.Push(ButtonChange{button, esp_timer_get_time()});           \
+    BaseType_t higher_priority_task_woken = pdFALSE;                           \
+    xTaskNotifyFromISR(input_task, kButtonChangesBit, eSetBits,                \
+                       &higher_priority_task_woken);                           \
+    portYIELD_FROM_ISR(higher_priority_task_woken);                            \
   }
 
 BUTTON_ISR(0)
@@ -598,104 +601,192 @@ void ReadBattery(void *) {
 
   // DebugPrintf("PM Locks:\n");
   // esp_pm_dump_locks(stdout);
+
+  DebugPrintf("Button changes: %u dropped, high water %u\n",
+              (unsigned)button_changes.dropped,
+              (unsigned)button_changes.high_water);
+  DebugPrintf("Buffered reports: %u expired, %u overwritten, %u dropped "
+              "by the link\n",
+              (unsigned)report_buffer.expired,
+              (unsigned)report_buffer.overwritten,
+              (unsigned)ble_keyboard.getDroppedReports());
+  latency_stats.Print([](const char *format, auto... args) {
+    DebugPrintf(format, args...);
+  });
 }
 
-// Zero-latency button debouncer.
-//
-// Initial state change is immediately registered as button press or release.
-// Subsequent state changes are ignored for a short time window (a couple of
-// milliseconds). After a period of no activity, the GPIO state is read directly
-// to verify the current button state.
-//
-// The approach used by this debouncer results in zero latency but a minimal
-// press duration equal to the debounce window.
-struct ButtonDebouncer {
-  Button i;
-  bool pressed_state;
-  esp_timer_handle_t timer;
-  int64_t last_change;
-
-  // Experimentally, the shortest physically possible key press was a tad over
-  // 15ms
-  constexpr static int64_t kDebounceMicroseconds = 15 * 1000;
-
-  bool ReadPressedGpio() { return digitalRead(kButtonPin[i]) == LOW; }
-
-  // Called at setup time
-  void OnSetup(Button button) {
-    i = button;
-    pinMode(kButtonPin[i], INPUT_PULLUP);
-    last_change = esp_timer_get_time();
-    pressed_state = ReadPressedGpio();
-
-    auto args =
-        esp_timer_create_args_t{.callback =
-                                    [](void *arg) {
-                                      ButtonDebouncer *debouncer =
-                                          static_cast<ButtonDebouncer *>(arg);
-                                      debouncer->OnTimer();
-                                    },
-                                .arg = this,
-                                .dispatch_method = ESP_TIMER_TASK,
-                                .name = ButtonToStr(i),
-                                .skip_unhandled_events = false};
-    auto timer_result = esp_timer_create(&args, &timer);
-    if (timer_result != ESP_OK) {
-      DebugPrintf("Failed to create timer for button %s\n", ButtonToStr(i));
-    }
-  }
-
-  void OnChange(int64_t time) {
-    auto delta = time - last_change;
-    last_change = time;
-    if (delta <= kDebounceMicroseconds) {
-      // Ignore state changes that happen within the debounce window.
-      // If it leads to any issues, then the ground-truth timer will fix them.
+// Time of the last key press, for the deep sleep timer.
+int64_t last_key_press = 0;
+
+void ReportPressedState(Button i, bool pressed_state) {
+  trace.Debounced(esp_timer_get_time(), i, pressed_state);
+  if (pressed_state) {
+    last_key_press = esp_timer_get_time();
+    if (ble_kb_security.pass_key_collecting) {
+      // During PIN collection, add digit to PIN buffer
+      ble_kb_security.pass_key_buffer += (char)(i + '0');
+      DebugPrintf("DEBUG: PIN buffer: '%s' (%d/%d)\n",
+                  ble_kb_security.pass_key_buffer.c_str(),
+                  ble_kb_security.pass_key_buffer.length(),
+                  ble_kb_security.PASS_KEY_LENGTH);
     } else {
-      pressed_state = !pressed_state;
-      ReportPressedState();
-    }
-    { // Schedule a ground truth read in kDebounceMicroseconds
-      if (esp_timer_is_active(timer)) {
-        esp_timer_stop(timer);
+      // Normal operation - the reports are buffered while the link is down
+      if (host_ready) {
+        connection_policy.OnKeyPress();
       }
-      esp_timer_start_once(timer, kDebounceMicroseconds);
+      engine.OnButtonDown(i);
+    }
+  } else {
+    if (ble_kb_security.pass_key_collecting) {
+      // ignore
+    } else {
+      engine.OnButtonUp(i);
     }
   }
+}
+
+ButtonDebouncer button_debouncer;
+
+// The chord stats are kept in NVS as a single blob, in the format of
+// ChordStats::Serialize.
+constexpr char kChordStatsNamespace[] = "chord_stats";
+constexpr char kChordStatsKey[] = "table";
 
-  void OnTimer() {
-    bool pressed_gpio = ReadPressedGpio();
-    if (pressed_gpio != pressed_state) {
-      pressed_state = pressed_gpio;
-      last_change = esp_timer_get_time();
-      ReportPressedState();
+void LoadChordStats() {
+  nvs_handle_t handle;
+  if (nvs_open(kChordStatsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return; // nothing saved yet
+  }
+  size_t size = 0;
+  if (nvs_get_blob(handle, kChordStatsKey, nullptr, &size) == ESP_OK) {
+    std::vector<uint8_t> data(size);
+    if (nvs_get_blob(handle, kChordStatsKey, data.data(), &size) != ESP_OK ||
+        !chord_stats.Load(kDefaultLayout, data.data(), size)) {
+      DebugPrintf("Failed to load the chord stats\n");
     }
   }
+  nvs_close(handle);
+}
 
-  void ReportPressedState() {
-    if (pressed_state) {
-      if (ble_kb_security.pass_key_collecting) {
-        // During PIN collection, add digit to PIN buffer
-        ble_kb_security.pass_key_buffer += (char)(i + '0');
-        DebugPrintf("DEBUG: PIN buffer: '%s' (%d/%d)\n",
-                    ble_kb_security.pass_key_buffer.c_str(),
-                    ble_kb_security.pass_key_buffer.length(),
-                    ble_kb_security.PASS_KEY_LENGTH);
-      } else if (ble_keyboard.isConnected()) {
-        // Normal operation - send via BLE
-        OnButtonDown(i);
-      } else {
-        DebugPrintf("BLE not connected\n");
+void SaveChordStats() {
+  int64_t now = esp_timer_get_time();
+  uint32_t recorded = chord_stats.recorded;
+  std::vector<uint8_t> data = chord_stats.Serialize(kDefaultLayout);
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(kChordStatsNamespace, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, kChordStatsKey, data.data(), data.size());
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (err == ESP_OK) {
+    chord_stats.OnSaved(recorded, now);
+  } else {
+    DebugPrintf("Failed to save the chord stats: %d\n", err);
+  }
+}
+
+// Flash pages wear out, so the table is saved in batches (see
+// ChordStats::ShouldSave) by a low priority task.
+void ChordStatsTask(void *) {
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(60 * 1000));
+    if (chord_stats.ShouldSave(esp_timer_get_time())) {
+      SaveChordStats();
+    }
+  }
+}
+
+// Buttons that woke the keyboard up and the buttons that were still held when
+// the debouncer started.
+ButtonMask wake_buttons = 0, wake_holds = 0;
+
+Timer *deep_sleep_timer;
+
+// Pressed buttons pull their pins low. Only RTC GPIOs can wake the chip up
+// from deep sleep. GPIO0 (THUMB_2) is a strapping pin - held low while the chip
+// boots it selects the download mode - so it's left out.
+bool IsWakePin(gpio_num_t pin) {
+  return rtc_gpio_is_valid_gpio(pin) && pin != GPIO_NUM_0;
+}
+
+void EnterDeepSleep() {
+  DebugPrintf("Entering deep sleep\n");
+  if (chord_stats.recorded != chord_stats.saved_recorded) {
+    SaveChordStats();
+  }
+  // The pull-ups of the wake pins must stay powered
+  uint64_t wake_pins = 0;
+  for (Button i = 0; i < NUM_BUTTONS; i++) {
+    gpio_num_t pin = gpio_num_t(kButtonPin[i]);
+    if (IsWakePin(pin)) {
+      rtc_gpio_pullup_en(pin);
+      rtc_gpio_pulldown_dis(pin);
+      wake_pins |= 1ULL << pin;
+    }
+  }
+  esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+  esp_sleep_enable_ext1_wakeup(wake_pins, ESP_EXT1_WAKEUP_ANY_LOW);
+  esp_deep_sleep_start();
+}
+
+// Re-armed for the remaining idle time rather than on every key press.
+void OnDeepSleepTimer(void *) {
+  const int64_t idle_micros = kDeepSleepIdleMillis * 1000;
+  int64_t idle = esp_timer_get_time() - last_key_press;
+  bool busy = button_debouncer.pressed_state || button_debouncer.unsettled ||
+              ble_kb_security.pass_key_collecting;
+  if (busy || idle < idle_micros) {
+    deep_sleep_timer->Start(busy ? idle_micros : idle_micros - idle);
+    return;
+  }
+  EnterDeepSleep();
+}
+
+void InputTask(void *) {
+  if (waking) {
+    // Before any other event
+    ReplayWakeButtons(wake_buttons, wake_holds, ReportPressedState);
+  }
+  while (true) {
+    uint32_t bits = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+    // Timers first - same order as in the host replay, where timers that
+    // expired before an edge fire before it's processed.
+    for (int i = 0; i < esp_clock.timer_count; ++i) {
+      if (bits & esp_clock.timers[i]->notify_bit) {
+        esp_clock.timers[i]->RunIfFired();
       }
-    } else {
-      if (ble_kb_security.pass_key_collecting) {
-        // ignore
-      } else if (ble_keyboard.isConnected()) {
-        OnButtonUp(i);
+    }
+    if (bits & kAdvertiseBit) {
+      host_ready = false;
+      trace_characteristic_callbacks.EndDump();
+      reconnect_policy.OnDisconnected(FindPeer());
+    }
+    if (bits & kConnectedBit) {
+      SavePeer();
+      host_ready = true;
+      reconnect_policy.OnConnected();
+      connection_policy.OnConnected();
+    }
+    if (bits & (kConnectedBit | kFlushBit)) {
+      FlushReports();
+    }
+    if (bits & kButtonChangesBit) {
+      latency_stats.edge_queue_depth.Record(button_changes.Size());
+      ButtonChange event;
+      while (button_changes.Pop(event)) {
+        current_edge_time = event.time;
+        trace.Edge(event.time, event.button);
+        button_debouncer.OnChange(event.button);
+        latency_stats.edge_to_engine.Record(esp_timer_get_time() - event.time);
+        current_edge_time = -1;
       }
     }
   }
-} button_debouncers[NUM_BUTTONS];
+}
 
 void setup() {
 
@@ -704,122 +795,53 @@ void setup() {
   }
   DebugPrintf("Starting Chord Keyboard...\n");
 
-  // Arpeggios are global
-  arpeggios[THUMB_1][INDEX_3] = Mod(KEY_RIGHT_CTRL);
-  arpeggios[INDEX_3][THUMB_1] = Key(KEY_RIGHT_CTRL);
-  arpeggios[THUMB_1][INDEX_7] = Mod(KEY_LEFT_CTRL);
-  arpeggios[INDEX_7][THUMB_1] = Key(KEY_LEFT_CTRL);
-
-  arpeggios[THUMB_1][MIDDLE_4] = Mod(KEY_RIGHT_ALT);
-  arpeggios[MIDDLE_4][THUMB_1] = Key(KEY_RIGHT_ALT);
-  arpeggios[THUMB_1][MIDDLE_8] = Mod(KEY_LEFT_ALT);
-  arpeggios[MIDDLE_8][THUMB_1] = Key(KEY_LEFT_ALT);
-
-  arpeggios[THUMB_1][RING_5] = Mod(KEY_RIGHT_GUI);
-  arpeggios[RING_5][THUMB_1] = Key(KEY_RIGHT_GUI);
-  arpeggios[THUMB_1][RING_9] = Mod(KEY_LEFT_GUI);
-  arpeggios[RING_9][THUMB_1] = Key(KEY_LEFT_GUI);
-
-  // Fingerwalker layout, Generation 21303, 149.21ms
-  // Thumb layer 0 (no thumb key pressed)
-  CHORDS[0][2][1][1][0] = Mod(KEY_RIGHT_ALT);
-
-  // Thumb layer 1 (THUMB_0 pressed)
-  CHORDS[1][0][0][0][0] = Key(KEY_BACKSPACE);
-  CHORDS[1][0][0][0][1] = Key(KEY_DELETE);
-
-  // Thumb layer 2 (THUMB_1 pressed)
-  CHORDS[2][0][0][0][0] = Key(' ');
-  CHORDS[2][1][0][0][0] = Key('\n');
-  CHORDS[2][2][0][0][0] = Key('\t');
-  CHORDS[2][1][0][0][1] = Key(KEY_ESC);
-
-  // Thumb layer 3 (THUMB_2 pressed) - special keys and navigation
-  CHORDS[3][0][0][0][0] = Mod(KEY_LEFT_CTRL);
-  CHORDS[3][0][1][1][0] = Key(KEY_RIGHT_ARROW);
-  CHORDS[3][0][1][2][0] = Key(KEY_DOWN_ARROW);
-  CHORDS[3][0][2][1][0] = Mod(KEY_LEFT_CTRL, Key(KEY_RIGHT_ARROW));
-  CHORDS[3][0][2][2][0] = Key(KEY_PAGE_DOWN);
-  CHORDS[3][1][0][0][0] = Mod(KEY_RIGHT_GUI, Key(KEY_RETURN));
-  CHORDS[3][1][0][1][0] = Key(KEY_LEFT_ARROW);
-  CHORDS[3][1][0][2][0] = Key(KEY_UP_ARROW);
-  CHORDS[3][1][2][1][0] = Key(KEY_HOME);
-  CHORDS[3][2][0][0][0] = Hold(THUMB_2, KEY_LEFT_ALT, Key(KEY_TAB));
-  CHORDS[3][2][0][1][0] = Mod(KEY_LEFT_CTRL, Key(KEY_LEFT_ARROW));
-  CHORDS[3][2][0][2][0] = Key(KEY_PAGE_UP);
-  CHORDS[3][2][1][1][0] = Key(KEY_END);
-
-  CHORDS[3][1][1][1][0] = Key('\'');
-  CHORDS[0][1][2][0][0] = Key(',');
-  CHORDS[0][1][0][0][0] = Key('-');
-  CHORDS[3][0][0][1][0] = Key('.');
-  CHORDS[1][0][1][1][0] = Key('/');
-  CHORDS[0][0][2][1][0] = Key('0');
-  CHORDS[3][0][2][0][0] = Key('1');
-  CHORDS[1][0][2][0][0] = Key('2');
-  CHORDS[2][1][2][1][0] = Key('3');
-  CHORDS[1][1][2][0][0] = Key('4');
-  CHORDS[3][1][2][0][0] = Key('5');
-  CHORDS[1][0][2][1][0] = Key('6');
-  CHORDS[0][1][0][2][0] = Key('7');
-  CHORDS[2][0][2][1][0] = Key('8');
-  CHORDS[2][1][1][1][0] = Key('9');
-  CHORDS[2][0][2][0][0] = Key(';');
-  CHORDS[0][0][0][1][0] = Key('=');
-  CHORDS[2][2][1][0][0] = Key('T');
-  CHORDS[0][0][2][0][0] = Key('[');
-  CHORDS[0][0][0][2][0] = Key('\\');
-  CHORDS[0][1][2][1][0] = Key(']');
-  CHORDS[1][2][0][0][0] = Key('`');
-  CHORDS[0][0][1][1][0] = Key('a');
-  CHORDS[1][1][1][0][0] = Key('b');
-  CHORDS[1][0][0][1][0] = Key('c');
-  CHORDS[2][0][1][1][0] = Key('d');
-  CHORDS[0][1][0][1][0] = Key('e');
-  CHORDS[1][1][1][1][0] = Key('f');
-  CHORDS[3][0][1][0][0] = Key('g');
-  CHORDS[0][2][0][1][0] = Key('h');
-  CHORDS[2][1][0][1][0] = Key('i');
-  CHORDS[1][2][1][0][0] = Key('j');
-  CHORDS[0][2][0][0][0] = Key('k');
-  CHORDS[2][1][1][0][0] = Key('l');
-  CHORDS[1][1][0][0][0] = Key('m');
-  CHORDS[2][0][1][0][0] = Key('n');
-  CHORDS[0][1][1][1][0] = Key('o');
-  CHORDS[1][0][1][0][0] = Key('p');
-  CHORDS[1][2][0][1][0] = Key('q');
-  CHORDS[0][1][1][0][0] = Key('r');
-  CHORDS[0][0][1][0][0] = Key('s');
-  CHORDS[2][0][0][1][0] = Key('t');
-  CHORDS[1][1][0][1][0] = Key('u');
-  CHORDS[3][1][1][0][0] = Key('v');
-  CHORDS[0][2][1][0][0] = Key('w');
-  CHORDS[2][1][2][0][0] = Key('x');
-  CHORDS[0][2][1][1][0] = Key('y');
-  CHORDS[2][2][0][1][0] = Key('z');
-
-  // Add Shifts
-  for (FingerPosition thumb = 0; thumb <= 3; ++thumb) {
-    for (FingerPosition index = 0; index <= 2; ++index) {
-      for (FingerPosition middle = 0; middle <= 2; ++middle) {
-        for (FingerPosition ring = 0; ring <= 2; ++ring) {
-          auto *&base = CHORDS[thumb][index][middle][ring][0];
-          auto *&shift = CHORDS[thumb][index][middle][ring][1];
-          if (base == nullptr)
-            continue;
-          if (shift)
-            continue;
-          shift = Hold(LITTLE_6, KEY_LEFT_SHIFT, base);
-        }
+  // Latch the buttons that woke the keyboard up before they are released
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1) {
+    uint64_t wake_pins = esp_sleep_get_ext1_wakeup_status();
+    for (Button i = 0; i < NUM_BUTTONS; i++) {
+      gpio_num_t pin = gpio_num_t(kButtonPin[i]);
+      if (wake_pins >> pin & 1) {
+        wake_buttons |= ButtonBit(i);
+      }
+      if (IsWakePin(pin)) {
+        rtc_gpio_deinit(pin); // back to a digital GPIO
       }
     }
+    waking = true;
   }
 
-  button_changes = xQueueCreate(100, sizeof(ButtonChange));
-
   for (Button i = 0; i < NUM_BUTTONS; i++) {
-    button_debouncers[i].OnSetup(i);
+    pinMode(kButtonPin[i], INPUT_PULLUP);
   }
+  button_debouncer.OnSetup(esp_clock, button_gpio, ReportPressedState);
+  if (waking) {
+    wake_holds = button_debouncer.pressed_state;
+  }
+  LoadChordStats();
+  engine.stats = &chord_stats;
+  // Recorded on the input task - the interrupts only pass the edges on, so
+  // the buffer isn't touched while the flash cache is disabled
+  if (void *buffer = heap_caps_malloc(kTraceEvents * sizeof(TraceEvent),
+                                      MALLOC_CAP_SPIRAM)) {
+    trace.Attach(static_cast<TraceEvent *>(buffer), kTraceEvents);
+  } else {
+    DebugPrintf("No PSRAM for the trace\n");
+  }
+  engine.trace = &trace;
+  trace_characteristic_callbacks.Setup();
+  engine.Setup();
+  connection_policy.Setup();
+  reconnect_policy.reconnect_millis = &latency_stats.reconnect;
+  reconnect_policy.Setup();
+  deep_sleep_timer =
+      esp_clock.CreateTimer("Deep sleep", OnDeepSleepTimer, nullptr);
+  deep_sleep_timer->Start(kDeepSleepIdleMillis * 1000);
+
+  // Above the Bluedroid tasks, on the core that doesn't run the BT controller
+  xTaskCreatePinnedToCore(InputTask, "Input", 4096, nullptr,
+                          configMAX_PRIORITIES - 4, &input_task, APP_CPU_NUM);
+  xTaskCreatePinnedToCore(ChordStatsTask, "Chord stats", 4096, nullptr,
+                          tskIDLE_PRIORITY + 1, nullptr, APP_CPU_NUM);
 
 #define ATTACH(button)                                                         \
   attachInterrupt(kButtonPin[button], button_isr_##button, CHANGE);
@@ -838,6 +860,7 @@ void setup() {
   pinMode(BATTERY_PIN, INPUT);
 
   ble_keyboard.setName("𝖒𝖆𝖋.🎹");
+  ble_keyboard.setReportSentCallback(OnReportSent);
   ble_keyboard.begin();
 
   BLESecurity *ble_security = new BLESecurity();
@@ -850,6 +873,7 @@ void setup() {
                                      ESP_BLE_ID_KEY_MASK);
 
   BLEDevice::setSecurityCallbacks(&ble_kb_security);
+  BLEDevice::setCustomGapHandler(OnGapEvent);
   DebugPrintf("BLE Keyboard initialized\n");
 
   // Enable automatic light-sleep (modem-sleep)
@@ -896,26 +920,7 @@ void setup() {
       DebugPrintf("Failed to create battery timer: %d\n", err);
     }
   }
-
-  { // Create chord autostart timer
-    auto args = esp_timer_create_args_t{
-        .callback = [](void *arg) { OnChordAutostart(); },
-        .arg = nullptr,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "Chord Autostart",
-        .skip_unhandled_events = false};
-    auto timer_result = esp_timer_create(&args, &chord_autostart_timer);
-    if (timer_result != ESP_OK) {
-      DebugPrintf("Failed to create timer for chord autostart: %d\n",
-                  timer_result);
-    }
-  }
 }
 
-void loop() {
-  ButtonChange event;
-  auto result = xQueueReceive(button_changes, &event, portMAX_DELAY);
-  if (result != pdTRUE)
-    return;
-  button_debouncers[event.button].OnChange(event.time);
-}
+// Button events are handled by InputTask
+void loop() { vTaskDelete(nullptr); }
@@ -0,0 +1,295 @@
+#include "ChordStats.h"
+
+void ChordStats::AddBigram(ActionId first, ActionId second, uint32_t count) {
+  uint32_t key = uint32_t(first) << 16 | second;
+  // Fibonacci hashing, then linear probing
+  uint32_t slot = (key * 2654435769u) >> 23;
+  static_assert(kBigramSlots == 1 << (32 - 23));
+  for (int probe = 0; probe < kBigramSlots; ++probe) {
+    Bigram &bigram = bigrams[(slot + probe) % kBigramSlots];
+    uint32_t slot_key = bigram.key.load(std::memory_order_relaxed);
+    if (slot_key == 0) {
+      bigram.key.store(key, std::memory_order_relaxed);
+      slot_key = key;
+    }
+    if (slot_key == key) {
+      Increment(bigram.count, count);
+      return;
+    }
+  }
+  Increment(dropped_bigrams, count);
+}
+
+bool ChordStats::ShouldSave(int64_t now_micros) const {
+  uint32_t unsaved = recorded.load(std::memory_order_relaxed) - saved_recorded;
+  int64_t since_save_millis = (now_micros - last_save_micros) / 1000;
+  if (unsaved == 0 ||
+      since_save_millis < int64_t(kChordStatsMinSaveIntervalMillis)) {
+    return false;
+  }
+  return unsaved >= kChordStatsSaveBatch ||
+         since_save_millis >= int64_t(kChordStatsMaxUnsavedMillis);
+}
+
+static bool IsShift(IBM_Key key) {
+  return key == KEY_LEFT_SHIFT || key == KEY_RIGHT_SHIFT;
+}
+
+void ChordStats::Describe(const Layout &layout, ActionId id, IBM_Key &key,
+                          uint8_t &flags) {
+  key = 0;
+  flags = 0;
+  IBM_Key first_modifier = 0;
+  uint8_t modifier_flags = 0;
+  for (ActionId step = id; step; step = layout.actions[step].next) {
+    const Action &action = layout.actions[step];
+    switch (action.op) {
+    case OP_KEY:
+      if (key == 0) {
+        key = action.key;
+      }
+      break;
+    case OP_TEMPORARY_MODIFIER:
+    case OP_HOLD_MODIFIER:
+      if (first_modifier == 0) {
+        first_modifier = action.key;
+      }
+      modifier_flags |= IsShift(action.key) ? kShifted : kModified;
+      break;
+    case OP_NONE:
+    case OP_RELEASE_HELD_MODIFIER:
+      break;
+    }
+  }
+  if (key) {
+    flags = modifier_flags;
+  } else {
+    // Modifier-only action - the modifier is its key
+    key = first_modifier;
+  }
+  for (auto &row : layout.arpeggios) {
+    for (ActionId arpeggio : row) {
+      if (arpeggio && arpeggio == id) {
+        flags |= kArpeggio;
+      }
+    }
+  }
+}
+
+uint32_t ChordStats::Fingerprint(const Layout &layout) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  auto add = [&](uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      hash = (hash ^ (value >> (8 * i) & 0xff)) * 16777619u;
+    }
+  };
+  add(layout.action_count);
+  for (int id = 1; id < layout.action_count; ++id) {
+    const Action &action = layout.actions[id];
+    add(action.op);
+    add(action.key);
+    add(action.hold_button);
+    add(action.next);
+  }
+  return hash;
+}
+
+namespace {
+
+struct Writer {
+  std::vector<uint8_t> &out;
+  void U8(uint8_t value) { out.push_back(value); }
+  void U16(uint16_t value) {
+    U8(value);
+    U8(value >> 8);
+  }
+  void U32(uint32_t value) {
+    U16(value);
+    U16(value >> 16);
+  }
+};
+
+struct Reader {
+  const uint8_t *data;
+  size_t size;
+  bool ok = true;
+  uint32_t Read(int bytes) {
+    if (size < size_t(bytes)) {
+      ok = false;
+      return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+      value |= uint32_t(data[i]) << (8 * i);
+    }
+    data += bytes;
+    size -= bytes;
+    return value;
+  }
+};
+
+} // namespace
+
+std::vector<uint8_t> ChordStats::Serialize(const Layout &layout) const {
+  std::vector<uint8_t> out;
+  Writer writer{out};
+  writer.U8(kFormatVersion);
+  writer.U16(kBigramSlots);
+  writer.U32(dropped_bigrams.load(std::memory_order_relaxed));
+  writer.U32(Fingerprint(layout));
+
+  uint16_t action_count = 0;
+  for (int id = 1; id < layout.action_count; ++id) {
+    action_count += executed[id].load(std::memory_order_relaxed) != 0;
+  }
+  writer.U16(action_count);
+  for (int id = 1; id < layout.action_count; ++id) {
+    uint32_t count = executed[id].load(std::memory_order_relaxed);
+    if (count == 0) {
+      continue;
+    }
+    IBM_Key key;
+    uint8_t flags;
+    Describe(layout, id, key, flags);
+    writer.U16(id);
+    writer.U8(key);
+    writer.U8(flags);
+    writer.U32(count);
+  }
+
+  size_t bigram_count_offset = out.size();
+  uint16_t bigram_count = 0;
+  writer.U16(0);
+  for (auto &bigram : bigrams) {
+    uint32_t key = bigram.key.load(std::memory_order_relaxed);
+    uint32_t count = bigram.count.load(std::memory_order_relaxed);
+    if (key == 0 || count == 0) {
+      continue;
+    }
+    writer.U16(key >> 16);
+    writer.U16(key);
+    writer.U32(count);
+    ++bigram_count;
+  }
+  out[bigram_count_offset] = bigram_count;
+  out[bigram_count_offset + 1] = bigram_count >> 8;
+  return out;
+}
+
+bool ChordStats::Load(const Layout &layout, const uint8_t *data, size_t size) {
+  Reader reader{data, size};
+  uint8_t version = reader.Read(1);
+  if (version != 1 && version != kFormatVersion) {
+    return false;
+  }
+  reader.Read(2); // capacity of the saved table
+  uint32_t dropped = reader.Read(4);
+  bool same_layout = version >= 2 && reader.Read(4) == Fingerprint(layout);
+
+  // Actions that are started by chords & arpeggios (the other ones are steps
+  // of their chains)
+  struct Root {
+    ActionId id;
+    IBM_Key key;
+    uint8_t flags;
+  };
+  std::vector<Root> roots;
+  auto add_root = [&](ActionId id) {
+    if (id == 0) {
+      return;
+    }
+    for (const Root &root : roots) {
+      if (root.id == id) {
+        return;
+      }
+    }
+    Root root = {id, 0, 0};
+    Describe(layout, id, root.key, root.flags);
+    roots.push_back(root);
+  };
+  const ActionId *chords = &layout.base_layer.chords[0][0][0][0][0];
+  for (size_t i = 0; i < sizeof(layout.base_layer.chords) / sizeof(ActionId);
+       ++i) {
+    add_root(chords[i]);
+  }
+  for (auto &row : layout.arpeggios) {
+    for (ActionId arpeggio : row) {
+      add_root(arpeggio);
+    }
+  }
+
+  // Root with the given description, 0 if there's none or more than one
+  auto find_root = [&](IBM_Key key, uint8_t flags) -> ActionId {
+    ActionId found = 0;
+    for (const Root &root : roots) {
+      if (root.key == key && root.flags == flags) {
+        if (found) {
+          return 0;
+        }
+        found = root.id;
+      }
+    }
+    return found;
+  };
+
+  struct Saved {
+    ActionId id;
+    IBM_Key key;
+    uint8_t flags;
+    uint32_t count;
+  };
+  std::vector<Saved> saved;
+  uint16_t action_count = reader.Read(2);
+  for (int i = 0; i < action_count && reader.ok; ++i) {
+    Saved action;
+    action.id = reader.Read(2);
+    action.key = reader.Read(1);
+    action.flags = reader.Read(1);
+    action.count = reader.Read(4);
+    saved.push_back(action);
+  }
+
+  // Maps the saved action IDs to the actions of `layout`
+  std::vector<ActionId> saved_ids, new_ids;
+  for (const Saved &action : saved) {
+    ActionId new_id = 0;
+    if (same_layout) {
+      new_id = action.id < layout.action_count ? action.id : 0;
+    } else {
+      // Saved actions with the same description can't be told apart either
+      int matching = 0;
+      for (const Saved &other : saved) {
+        matching += other.key == action.key && other.flags == action.flags;
+      }
+      if (matching == 1) {
+        new_id = find_root(action.key, action.flags);
+      }
+    }
+    saved_ids.push_back(action.id);
+    new_ids.push_back(new_id);
+    if (new_id) {
+      Increment(executed[new_id], action.count);
+    }
+  }
+  auto map_id = [&](ActionId saved_id) -> ActionId {
+    for (size_t i = 0; i < saved_ids.size(); ++i) {
+      if (saved_ids[i] == saved_id) {
+        return new_ids[i];
+      }
+    }
+    return 0;
+  };
+
+  uint16_t bigram_count = reader.Read(2);
+  for (int i = 0; i < bigram_count && reader.ok; ++i) {
+    ActionId first = map_id(reader.Read(2));
+    ActionId second = map_id(reader.Read(2));
+    uint32_t count = reader.Read(4);
+    if (first && second) {
+      AddBigram(first, second, count);
+    }
+  }
+  Increment(dropped_bigrams, dropped);
+  return reader.ok;
+}
@@ -0,0 +1,109 @@
+// Usage statistics of the layout, for the layout optimizer.
+//
+// Counts how often every action is executed and how often one action follows
+// another (bigrams). Only counts are kept - the order of the typed text can't
+// be recovered from them. Actions that follow a pause of more than
+// `kBigramMaxGapMicros` are counted as typed with the fingers at rest.
+//
+// The firmware saves the table to NVS in the format of `Serialize` and exports
+// it over BLE. `layout_generator/chord_stats.py` loads it as a corpus.
+
+#pragma once
+
+#include "ChordEngine.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimum time between two saves of the table to flash.
+constexpr unsigned long kChordStatsMinSaveIntervalMillis = 5 * 60 * 1000;
+// A save happens after this many new actions or `kMaxUnsavedMillis` after the
+// first unsaved one, whichever comes first.
+constexpr uint32_t kChordStatsSaveBatch = 500;
+constexpr unsigned long kChordStatsMaxUnsavedMillis = 30 * 60 * 1000;
+
+struct ChordStats {
+  constexpr static int kBigramSlots = 512;
+  constexpr static int64_t kBigramMaxGapMicros = 1000 * 1000;
+  constexpr static uint8_t kFormatVersion = 2;
+
+  // Flags of the exported actions.
+  constexpr static uint8_t kArpeggio = 1;   // fired by an arpeggio
+  constexpr static uint8_t kShifted = 2;    // holds or toggles Shift
+  constexpr static uint8_t kModified = 4;   // other modifiers than Shift
+
+  // Only the input task records the actions, the saving & exporting tasks
+  // read the counts concurrently.
+  std::atomic<uint32_t> executed[Layout::kMaxActions] = {};
+  // Open addressing hash table. `key` is (first << 16 | second), 0 = empty.
+  struct Bigram {
+    std::atomic<uint32_t> key;
+    std::atomic<uint32_t> count;
+  } bigrams[kBigramSlots] = {};
+  // Bigrams that didn't fit in the table.
+  std::atomic<uint32_t> dropped_bigrams{0};
+  // Number of `Record` calls.
+  std::atomic<uint32_t> recorded{0};
+
+  ActionId previous = 0;
+  int64_t previous_micros = 0;
+
+  // State of the saving task.
+  uint32_t saved_recorded = 0;
+  int64_t last_save_micros = 0;
+
+  void Record(ActionId id, int64_t now_micros) {
+    Increment(executed[id]);
+    if (previous && now_micros - previous_micros <= kBigramMaxGapMicros) {
+      AddBigram(previous, id, 1);
+    }
+    previous = id;
+    previous_micros = now_micros;
+    Increment(recorded);
+  }
+
+  // Whether the batching policy allows a save now.
+  bool ShouldSave(int64_t now_micros) const;
+  // `recorded_at_snapshot` is the value of `recorded` before the saved table
+  // was serialized.
+  void OnSaved(uint32_t recorded_at_snapshot, int64_t now_micros) {
+    saved_recorded = recorded_at_snapshot;
+    last_save_micros = now_micros;
+  }
+
+  // Version, bigram capacity (uint16), dropped bigrams (uint32) & layout
+  // fingerprint (uint32), then the action count (uint16) & records of the
+  // executed actions: ID (uint16), key, flags, count (uint32), then the bigram
+  // count (uint16) & records: first & second action IDs (uint16), count
+  // (uint32). Everything is little-endian. Version 1 had no fingerprint.
+  //
+  // The key & flags of the actions (see `Describe`) make the table independent
+  // of the action IDs of the layout.
+  std::vector<uint8_t> Serialize(const Layout &layout) const;
+
+  // Adds a table saved by `Serialize` to the counts. If it was saved with the
+  // same layout (equal fingerprints) the action IDs are kept. Otherwise the
+  // actions are matched to the `layout` by their key & flags, so the counts
+  // survive layout changes - descriptions shared by several actions (e.g. an
+  // arpeggio that holds Ctrl and one that taps it) can't be told apart and are
+  // dropped. Returns false if the data is malformed.
+  bool Load(const Layout &layout, const uint8_t *data, size_t size);
+
+  // Main key and flags of the action that starts with `id`.
+  static void Describe(const Layout &layout, ActionId id, IBM_Key &key,
+                       uint8_t &flags);
+
+  // Hash of the layout's actions. Tables with the same fingerprint use the
+  // same action IDs.
+  static uint32_t Fingerprint(const Layout &layout);
+
+private:
+  static void Increment(std::atomic<uint32_t> &counter, uint32_t by = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + by,
+                  std::memory_order_relaxed);
+  }
+
+  void AddBigram(ActionId first, ActionId second, uint32_t count);
+};
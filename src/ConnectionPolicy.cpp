@@ -0,0 +1,49 @@
+#include "ConnectionPolicy.h"
+
+void ConnectionPolicy::Setup() {
+  idle_timer = clock.CreateTimer(
+      "Connection idle",
+      [](void *arg) { static_cast<ConnectionPolicy *>(arg)->OnIdleTimer(); },
+      this);
+  if (idle_timer == nullptr) {
+    DebugPrintf("Failed to create timer for connection idle\n");
+  }
+}
+
+void ConnectionPolicy::OnConnected() {
+  if (idle_timer->IsActive()) {
+    idle_timer->Stop();
+  }
+  typing = false;
+  request(kIdleConnection);
+}
+
+void ConnectionPolicy::OnKeyPress() {
+  last_key_press = clock.Micros();
+  if (typing) {
+    // The idle timer will notice the new key press
+    return;
+  }
+  typing = true;
+  request(kTypingConnection);
+  idle_timer->Start(idle_micros);
+}
+
+void ConnectionPolicy::OnIdleTimer() {
+  int64_t idle = clock.Micros() - last_key_press;
+  if (idle < idle_micros) {
+    idle_timer->Start(idle_micros - idle);
+    return;
+  }
+  typing = false;
+  request(kIdleConnection);
+}
+
+void ConnectionPolicy::OnUpdated(uint16_t interval, uint16_t latency,
+                                 uint16_t timeout) {
+  this->interval = interval;
+  this->latency = latency;
+  this->timeout = timeout;
+  DebugPrintf("Connection interval %.2fms, latency %u, timeout %ums\n",
+              interval * 1.25, latency, timeout * 10);
+}
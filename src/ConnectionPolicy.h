@@ -0,0 +1,62 @@
+// Picks the BLE connection parameters based on typing activity.
+//
+// A short connection interval means that a report waits less for the next
+// connection event, but the radio also wakes up more often. The keyboard asks
+// for the shortest interval when a key is pressed and relaxes to a long
+// interval with slave latency (the keyboard may skip connection events when it
+// has nothing to send) after `kConnectionIdleMillis` without key presses.
+//
+// The central has the final word - the negotiated parameters are reported by
+// the GAP update event and kept for inspection.
+
+#pragma once
+
+#include "ChordEngine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// How long after the last key press the connection relaxes to the idle
+// parameters.
+constexpr unsigned long kConnectionIdleMillis = 10 * 1000;
+
+// Link layer connection parameters, in the units of the BLE spec.
+struct ConnectionParams {
+  uint16_t min_interval; // 1.25ms units
+  uint16_t max_interval; // 1.25ms units
+  uint16_t latency;      // connection events the keyboard may skip
+  uint16_t timeout;      // 10ms units
+};
+
+// 7.5ms - the shortest interval allowed by the spec
+constexpr ConnectionParams kTypingConnection = {6, 6, 0, 600};
+// 30-50ms, only every 11th connection event has to be attended when idle
+constexpr ConnectionParams kIdleConnection = {24, 40, 10, 600};
+
+struct ConnectionPolicy {
+  Clock &clock;
+  // Sends the connection parameter update request to the central.
+  std::function<void(const ConnectionParams &)> request;
+  int64_t idle_micros = kConnectionIdleMillis * 1000;
+
+  Timer *idle_timer = nullptr;
+  bool typing = false;
+  int64_t last_key_press = 0;
+
+  // Negotiated parameters (written from the BLE stack's task).
+  std::atomic<uint16_t> interval{0}, latency{0}, timeout{0};
+
+  ConnectionPolicy(Clock &clock,
+                   std::function<void(const ConnectionParams &)> request)
+      : clock(clock), request(std::move(request)) {}
+
+  // Creates the idle timer.
+  void Setup();
+
+  // The link is up - starts with the idle parameters.
+  void OnConnected();
+  void OnKeyPress();
+  void OnIdleTimer();
+  void OnUpdated(uint16_t interval, uint16_t latency, uint16_t timeout);
+};
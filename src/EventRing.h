@@ -0,0 +1,59 @@
+// Lock-free single-producer / single-consumer ring buffer.
+//
+// Used to pass button edges from the GPIO interrupt to the input task without
+// the critical section of a FreeRTOS queue. Push may only be called from one
+// context at a time (the GPIO interrupts don't preempt each other) and Pop only
+// from one task.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t N> struct EventRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+  T events[N];
+  std::atomic<uint32_t> head{0}; // written by the producer
+  std::atomic<uint32_t> tail{0}; // written by the consumer
+
+  // Statistics, readable at any time. Both are written only by the producer.
+  std::atomic<uint32_t> dropped{0};    // events pushed while the ring was full
+  std::atomic<uint32_t> high_water{0}; // most events waiting at once
+
+  // Returns false (and counts the event as dropped) if the ring is full.
+  // Always inlined so that it ends up in the (IRAM) interrupt handler.
+  [[gnu::always_inline]] inline bool Push(const T &event) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+    if (h - t == N) {
+      dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      return false;
+    }
+    events[h % N] = event;
+    head.store(h + 1, std::memory_order_release);
+    if (h + 1 - t > high_water.load(std::memory_order_relaxed)) {
+      high_water.store(h + 1 - t, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Returns false if the ring is empty.
+  bool Pop(T &event) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+    if (t == h) {
+      return false;
+    }
+    event = events[t % N];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t Size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+};
@@ -0,0 +1,310 @@
+// Key codes and the HID keyboard report.
+//
+// Shared by BleKeyboard (which sends the reports over BLE) and the host build
+// of the chord engine (host/), which records them instead. Doesn't depend on
+// BLE or Arduino headers.
+
+#pragma once
+
+#include <cstdint>
+
+const uint8_t KEY_LEFT_CTRL = 0x80;
+const uint8_t KEY_LEFT_SHIFT = 0x81;
+const uint8_t KEY_LEFT_ALT = 0x82;
+const uint8_t KEY_LEFT_GUI = 0x83;
+const uint8_t KEY_RIGHT_CTRL = 0x84;
+const uint8_t KEY_RIGHT_SHIFT = 0x85;
+const uint8_t KEY_RIGHT_ALT = 0x86;
+const uint8_t KEY_RIGHT_GUI = 0x87;
+
+const uint8_t KEY_UP_ARROW = 0xDA;
+const uint8_t KEY_DOWN_ARROW = 0xD9;
+const uint8_t KEY_LEFT_ARROW = 0xD8;
+const uint8_t KEY_RIGHT_ARROW = 0xD7;
+const uint8_t KEY_BACKSPACE = 0xB2;
+const uint8_t KEY_TAB = 0xB3;
+const uint8_t KEY_RETURN = 0xB0;
+const uint8_t KEY_ESC = 0xB1;
+const uint8_t KEY_INSERT = 0xD1;
+const uint8_t KEY_PRTSC = 0xCE;
+const uint8_t KEY_DELETE = 0xD4;
+const uint8_t KEY_PAGE_UP = 0xD3;
+const uint8_t KEY_PAGE_DOWN = 0xD6;
+const uint8_t KEY_HOME = 0xD2;
+const uint8_t KEY_END = 0xD5;
+const uint8_t KEY_CAPS_LOCK = 0xC1;
+const uint8_t KEY_F1 = 0xC2;
+const uint8_t KEY_F2 = 0xC3;
+const uint8_t KEY_F3 = 0xC4;
+const uint8_t KEY_F4 = 0xC5;
+const uint8_t KEY_F5 = 0xC6;
+const uint8_t KEY_F6 = 0xC7;
+const uint8_t KEY_F7 = 0xC8;
+const uint8_t KEY_F8 = 0xC9;
+const uint8_t KEY_F9 = 0xCA;
+const uint8_t KEY_F10 = 0xCB;
+const uint8_t KEY_F11 = 0xCC;
+const uint8_t KEY_F12 = 0xCD;
+const uint8_t KEY_F13 = 0xF0;
+const uint8_t KEY_F14 = 0xF1;
+const uint8_t KEY_F15 = 0xF2;
+const uint8_t KEY_F16 = 0xF3;
+const uint8_t KEY_F17 = 0xF4;
+const uint8_t KEY_F18 = 0xF5;
+const uint8_t KEY_F19 = 0xF6;
+const uint8_t KEY_F20 = 0xF7;
+const uint8_t KEY_F21 = 0xF8;
+const uint8_t KEY_F22 = 0xF9;
+const uint8_t KEY_F23 = 0xFA;
+const uint8_t KEY_F24 = 0xFB;
+
+const uint8_t KEY_NUM_0 = 0xEA;
+const uint8_t KEY_NUM_1 = 0xE1;
+const uint8_t KEY_NUM_2 = 0xE2;
+const uint8_t KEY_NUM_3 = 0xE3;
+const uint8_t KEY_NUM_4 = 0xE4;
+const uint8_t KEY_NUM_5 = 0xE5;
+const uint8_t KEY_NUM_6 = 0xE6;
+const uint8_t KEY_NUM_7 = 0xE7;
+const uint8_t KEY_NUM_8 = 0xE8;
+const uint8_t KEY_NUM_9 = 0xE9;
+const uint8_t KEY_NUM_SLASH = 0xDC;
+const uint8_t KEY_NUM_ASTERISK = 0xDD;
+const uint8_t KEY_NUM_MINUS = 0xDE;
+const uint8_t KEY_NUM_PLUS = 0xDF;
+const uint8_t KEY_NUM_ENTER = 0xE0;
+const uint8_t KEY_NUM_PERIOD = 0xEB;
+
+typedef uint8_t MediaKeyReport[2];
+
+const MediaKeyReport KEY_MEDIA_NEXT_TRACK = {1, 0};
+const MediaKeyReport KEY_MEDIA_PREVIOUS_TRACK = {2, 0};
+const MediaKeyReport KEY_MEDIA_STOP = {4, 0};
+const MediaKeyReport KEY_MEDIA_PLAY_PAUSE = {8, 0};
+const MediaKeyReport KEY_MEDIA_MUTE = {16, 0};
+const MediaKeyReport KEY_MEDIA_VOLUME_UP = {32, 0};
+const MediaKeyReport KEY_MEDIA_VOLUME_DOWN = {64, 0};
+const MediaKeyReport KEY_MEDIA_WWW_HOME = {128, 0};
+const MediaKeyReport KEY_MEDIA_LOCAL_MACHINE_BROWSER = {0, 1}; // Opens "My Computer" on Windows
+const MediaKeyReport KEY_MEDIA_CALCULATOR = {0, 2};
+const MediaKeyReport KEY_MEDIA_WWW_BOOKMARKS = {0, 4};
+const MediaKeyReport KEY_MEDIA_WWW_SEARCH = {0, 8};
+const MediaKeyReport KEY_MEDIA_WWW_STOP = {0, 16};
+const MediaKeyReport KEY_MEDIA_WWW_BACK = {0, 32};
+const MediaKeyReport KEY_MEDIA_CONSUMER_CONTROL_CONFIGURATION = {0, 64}; // Media Selection
+const MediaKeyReport KEY_MEDIA_EMAIL_READER = {0, 128};
+
+
+//  Low level key report: up to 6 keys and shift, ctrl etc at once
+typedef struct
+{
+  uint8_t modifiers;
+  uint8_t reserved;
+  uint8_t keys[6];
+} KeyReport;
+
+// Printable ASCII characters are translated into HID usage codes with this
+// table. Characters that need shift have the ASCII_SHIFT bit set.
+constexpr uint8_t ASCII_SHIFT = 0x80;
+inline constexpr uint8_t _asciimap[128] =
+{
+	0x00,             // NUL
+	0x00,             // SOH
+	0x00,             // STX
+	0x00,             // ETX
+	0x00,             // EOT
+	0x00,             // ENQ
+	0x00,             // ACK
+	0x00,             // BEL
+	0x2a,			// BS	Backspace
+	0x2b,			// TAB	Tab
+	0x28,			// LF	Enter
+	0x00,             // VT
+	0x00,             // FF
+	0x00,             // CR
+	0x00,             // SO
+	0x00,             // SI
+	0x00,             // DEL
+	0x00,             // DC1
+	0x00,             // DC2
+	0x00,             // DC3
+	0x00,             // DC4
+	0x00,             // NAK
+	0x00,             // SYN
+	0x00,             // ETB
+	0x00,             // CAN
+	0x00,             // EM
+	0x00,             // SUB
+	0x00,             // ESC
+	0x00,             // FS
+	0x00,             // GS
+	0x00,             // RS
+	0x00,             // US
+
+	0x2c,		   //  ' '
+	0x1e|ASCII_SHIFT,	   // !
+	0x34|ASCII_SHIFT,	   // "
+	0x20|ASCII_SHIFT,    // #
+	0x21|ASCII_SHIFT,    // $
+	0x22|ASCII_SHIFT,    // %
+	0x24|ASCII_SHIFT,    // &
+	0x34,          // '
+	0x26|ASCII_SHIFT,    // (
+	0x27|ASCII_SHIFT,    // )
+	0x25|ASCII_SHIFT,    // *
+	0x2e|ASCII_SHIFT,    // +
+	0x36,          // ,
+	0x2d,          // -
+	0x37,          // .
+	0x38,          // /
+	0x27,          // 0
+	0x1e,          // 1
+	0x1f,          // 2
+	0x20,          // 3
+	0x21,          // 4
+	0x22,          // 5
+	0x23,          // 6
+	0x24,          // 7
+	0x25,          // 8
+	0x26,          // 9
+	0x33|ASCII_SHIFT,      // :
+	0x33,          // ;
+	0x36|ASCII_SHIFT,      // <
+	0x2e,          // =
+	0x37|ASCII_SHIFT,      // >
+	0x38|ASCII_SHIFT,      // ?
+	0x1f|ASCII_SHIFT,      // @
+	0x04|ASCII_SHIFT,      // A
+	0x05|ASCII_SHIFT,      // B
+	0x06|ASCII_SHIFT,      // C
+	0x07|ASCII_SHIFT,      // D
+	0x08|ASCII_SHIFT,      // E
+	0x09|ASCII_SHIFT,      // F
+	0x0a|ASCII_SHIFT,      // G
+	0x0b|ASCII_SHIFT,      // H
+	0x0c|ASCII_SHIFT,      // I
+	0x0d|ASCII_SHIFT,      // J
+	0x0e|ASCII_SHIFT,      // K
+	0x0f|ASCII_SHIFT,      // L
+	0x10|ASCII_SHIFT,      // M
+	0x11|ASCII_SHIFT,      // N
+	0x12|ASCII_SHIFT,      // O
+	0x13|ASCII_SHIFT,      // P
+	0x14|ASCII_SHIFT,      // Q
+	0x15|ASCII_SHIFT,      // R
+	0x16|ASCII_SHIFT,      // S
+	0x17|ASCII_SHIFT,      // T
+	0x18|ASCII_SHIFT,      // U
+	0x19|ASCII_SHIFT,      // V
+	0x1a|ASCII_SHIFT,      // W
+	0x1b|ASCII_SHIFT,      // X
+	0x1c|ASCII_SHIFT,      // Y
+	0x1d|ASCII_SHIFT,      // Z
+	0x2f,          // [
+	0x31,          // bslash
+	0x30,          // ]
+	0x23|ASCII_SHIFT,    // ^
+	0x2d|ASCII_SHIFT,    // _
+	0x35,          // `
+	0x04,          // a
+	0x05,          // b
+	0x06,          // c
+	0x07,          // d
+	0x08,          // e
+	0x09,          // f
+	0x0a,          // g
+	0x0b,          // h
+	0x0c,          // i
+	0x0d,          // j
+	0x0e,          // k
+	0x0f,          // l
+	0x10,          // m
+	0x11,          // n
+	0x12,          // o
+	0x13,          // p
+	0x14,          // q
+	0x15,          // r
+	0x16,          // s
+	0x17,          // t
+	0x18,          // u
+	0x19,          // v
+	0x1a,          // w
+	0x1b,          // x
+	0x1c,          // y
+	0x1d,          // z
+	0x2f|ASCII_SHIFT,    // {
+	0x31|ASCII_SHIFT,    // |
+	0x30|ASCII_SHIFT,    // }
+	0x35|ASCII_SHIFT,    // ~
+	0				// DEL
+};
+
+// Adds the specified key (printing, non-printing, or modifier) to the report.
+// Returns false if the key can't be typed or there is no empty slot.
+inline bool AddToKeyReport(KeyReport &report, uint8_t k) {
+  uint8_t i;
+  if (k >= 136) { // it's a non-printing key (not a modifier)
+    k = k - 136;
+  } else if (k >= 128) { // it's a modifier key
+    report.modifiers |= (1 << (k - 128));
+    k = 0;
+  } else { // it's a printing key
+    k = _asciimap[k];
+    if (!k) {
+      return false;
+    }
+    if (k & ASCII_SHIFT) { // it's a capital letter or other character reached
+                           // with shift
+      report.modifiers |= 0x02; // the left shift modifier
+      k &= 0x7F;
+    }
+  }
+
+  // Add k to the key report only if it's not already present
+  // and if there is an empty slot.
+  if (report.keys[0] != k && report.keys[1] != k && report.keys[2] != k &&
+      report.keys[3] != k && report.keys[4] != k && report.keys[5] != k) {
+    for (i = 0; i < 6; i++) {
+      if (report.keys[i] == 0x00) {
+        report.keys[i] = k;
+        break;
+      }
+    }
+    if (i == 6) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Takes the specified key out of the report. Returns false if the key can't be
+// typed (the report is unchanged).
+inline bool RemoveFromKeyReport(KeyReport &report, uint8_t k) {
+  uint8_t i;
+  if (k >= 136) { // it's a non-printing key (not a modifier)
+    k = k - 136;
+  } else if (k >= 128) { // it's a modifier key
+    report.modifiers &= ~(1 << (k - 128));
+    k = 0;
+  } else { // it's a printing key
+    k = _asciimap[k];
+    if (!k) {
+      return false;
+    }
+    if (k & ASCII_SHIFT) { // it's a capital letter or other character reached
+                           // with shift
+      report.modifiers &= ~(0x02); // the left shift modifier
+      k &= 0x7F;
+    }
+  }
+
+  // Test the key report to see if k is present. Clear it if it exists.
+  // Check all positions in case the key is present more than once (which it
+  // shouldn't be)
+  for (i = 0; i < 6; i++) {
+    if (0 != k && report.keys[i] == k) {
+      report.keys[i] = 0x00;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,128 @@
+// Fixed-bucket histograms of the keyer's latencies.
+//
+// Recording a sample is a couple of instructions (count leading zeros &
+// increment), so it's always on. The histograms can be read over BLE (see
+// `Serialize`) or printed to the serial port.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Power-of-two buckets. Bucket 0 counts zeros, bucket `b` counts the values in
+// [2^(b-1), 2^b) and the last bucket everything above.
+struct Histogram {
+  constexpr static int kBuckets = 20;
+  // Only one task records the samples of a histogram, readers may run
+  // concurrently.
+  std::atomic<uint32_t> counts[kBuckets] = {};
+
+  static int Bucket(uint32_t value) {
+    if (value == 0) {
+      return 0;
+    }
+    int bucket = 32 - __builtin_clz(value);
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+  }
+
+  // Smallest value that doesn't fit in the bucket.
+  static uint32_t BucketLimit(int bucket) { return uint32_t(1) << bucket; }
+
+  void Record(int64_t value) {
+    uint32_t clamped = value < 0 ? 0 : value > UINT32_MAX ? UINT32_MAX : value;
+    auto &count = counts[Bucket(clamped)];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  }
+
+  uint32_t Total() const {
+    uint32_t total = 0;
+    for (auto &count : counts) {
+      total += count.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  // Upper limit of the bucket that contains the `fraction` quantile (0 if
+  // there are no samples).
+  uint32_t Quantile(double fraction) const {
+    uint32_t total = Total();
+    if (total == 0) {
+      return 0;
+    }
+    uint32_t seen = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+      seen += counts[b].load(std::memory_order_relaxed);
+      if (seen >= fraction * total) {
+        return BucketLimit(b);
+      }
+    }
+    return BucketLimit(kBuckets - 1);
+  }
+};
+
+struct LatencyStats {
+  // Microseconds from the GPIO interrupt to the end of the engine's processing
+  // of the edge.
+  Histogram edge_to_engine;
+  // Microseconds from the GPIO interrupt to notify() returning for the report
+  // it caused.
+  Histogram edge_to_notify;
+  // Edges waiting in the ring when the input task wakes up.
+  Histogram edge_queue_depth;
+  // Milliseconds from the start of the app after a deep sleep wake-up to
+  // notify() returning for the first report of the waking chord. Only the app's
+  // share of the wake-up: the time spent in the ROM, the bootloader & loading
+  // the image (a few ms with CONFIG_BOOTLOADER_SKIP_VALIDATE_IN_DEEP_SLEEP)
+  // isn't included - the chip keeps no timestamp of the ext1 wake-up to
+  // measure it from.
+  Histogram app_start_to_report;
+  // Milliseconds from losing the link to the host to an encrypted reconnection
+  // (see ReconnectPolicy).
+  Histogram reconnect;
+
+  constexpr static int kHistograms = 5;
+  constexpr static uint8_t kFormatVersion = 3;
+  // Version, histogram count, bucket count, then the counts of every histogram
+  // (in the order above) as little-endian uint32.
+  constexpr static size_t kSerializedSize =
+      3 + kHistograms * Histogram::kBuckets * 4;
+
+  const Histogram &Get(int index) const {
+    const Histogram *histograms[kHistograms] = {
+        &edge_to_engine, &edge_to_notify, &edge_queue_depth,
+        &app_start_to_report, &reconnect};
+    return *histograms[index];
+  }
+
+  void Serialize(uint8_t (&out)[kSerializedSize]) const {
+    out[0] = kFormatVersion;
+    out[1] = kHistograms;
+    out[2] = Histogram::kBuckets;
+    uint8_t *p = out + 3;
+    for (int h = 0; h < kHistograms; ++h) {
+      for (auto &count : Get(h).counts) {
+        uint32_t value = count.load(std::memory_order_relaxed);
+        for (int i = 0; i < 4; ++i) {
+          *p++ = value >> (8 * i);
+        }
+      }
+    }
+  }
+
+  // One line per histogram: sample count and the 50/99/100% quantiles.
+  template <typename Printf> void Print(Printf print) const {
+    const char *names[kHistograms] = {"edge->engine us", "edge->notify us",
+                                      "edge queue depth", "app->report ms",
+                                      "reconnect ms"};
+    for (int h = 0; h < kHistograms; ++h) {
+      const Histogram &histogram = Get(h);
+      print("%-16s n=%u p50<%u p99<%u max<%u\n", names[h],
+            (unsigned)histogram.Total(), (unsigned)histogram.Quantile(0.5),
+            (unsigned)histogram.Quantile(0.99),
+            (unsigned)histogram.Quantile(1));
+    }
+  }
+};
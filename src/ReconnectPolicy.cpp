@@ -0,0 +1,60 @@
+#include "ReconnectPolicy.h"
+
+void ReconnectPolicy::Setup() {
+  timer = clock.CreateTimer(
+      "Reconnect",
+      [](void *arg) { static_cast<ReconnectPolicy *>(arg)->OnTimer(); }, this);
+  if (timer == nullptr) {
+    DebugPrintf("Failed to create timer for reconnection\n");
+  }
+}
+
+void ReconnectPolicy::Advertise(AdvertisingMode mode, unsigned long millis) {
+  this->mode = mode;
+  advertise(mode);
+  if (timer->IsActive()) {
+    timer->Stop();
+  }
+  if (millis) {
+    timer->Start(millis * 1000);
+  }
+}
+
+void ReconnectPolicy::OnDisconnected(bool peer_known) {
+  if (connected) {
+    connected = false;
+    disconnected_at = clock.Micros();
+  }
+  if (peer_known) {
+    Advertise(ADVERTISING_DIRECTED, kDirectedAdvertisingMillis);
+  } else {
+    Advertise(ADVERTISING_FAST, kFastAdvertisingMillis);
+  }
+}
+
+void ReconnectPolicy::OnConnected() {
+  if (timer->IsActive()) {
+    timer->Stop();
+  }
+  // The controller stops advertising when the link is established
+  mode = ADVERTISING_OFF;
+  connected = true;
+  if (disconnected_at >= 0 && reconnect_millis) {
+    reconnect_millis->Record((clock.Micros() - disconnected_at) / 1000);
+  }
+  disconnected_at = -1;
+}
+
+void ReconnectPolicy::OnTimer() {
+  switch (mode) {
+  case ADVERTISING_DIRECTED:
+    Advertise(ADVERTISING_FAST, kFastAdvertisingMillis);
+    break;
+  case ADVERTISING_FAST:
+    Advertise(ADVERTISING_SLOW, 0);
+    break;
+  case ADVERTISING_OFF:
+  case ADVERTISING_SLOW:
+    break;
+  }
+}
@@ -0,0 +1,67 @@
+// Picks how the keyboard advertises while it has no link.
+//
+// A host that was connected before is most likely still around (it slept or
+// walked out of range), so the keyboard first uses high duty cycle directed
+// advertising to its address - the host's controller answers the first
+// advertisement it hears, within milliseconds. The spec limits that mode to
+// 1.28 s, after which the keyboard falls back to fast undirected advertising
+// (other hosts and hosts with a new address can connect too) and finally to
+// slow advertising that saves the battery.
+//
+// The time from losing the link to an encrypted reconnection is recorded in a
+// histogram.
+
+#pragma once
+
+#include "ChordEngine.h"
+#include "LatencyStats.h"
+
+#include <cstdint>
+#include <functional>
+
+enum AdvertisingMode {
+  ADVERTISING_OFF,
+  // High duty cycle directed advertising to the last host
+  ADVERTISING_DIRECTED,
+  ADVERTISING_FAST,
+  ADVERTISING_SLOW,
+};
+
+// How long each mode lasts before the next one is used.
+constexpr unsigned long kDirectedAdvertisingMillis = 1280;
+constexpr unsigned long kFastAdvertisingMillis = 30 * 1000;
+
+// Advertising intervals in 0.625ms units (the recommended 20-30ms while fast,
+// then about a second).
+constexpr uint16_t kFastAdvertisingInterval[2] = {32, 48};
+constexpr uint16_t kSlowAdvertisingInterval[2] = {1636, 2056};
+
+struct ReconnectPolicy {
+  Clock &clock;
+  // Stops the current advertising and starts `mode`.
+  std::function<void(AdvertisingMode)> advertise;
+  // Milliseconds from the link drop to OnConnected (optional).
+  Histogram *reconnect_millis = nullptr;
+
+  Timer *timer = nullptr;
+  AdvertisingMode mode = ADVERTISING_OFF;
+  bool connected = false;
+  // -1 before the first connection (boot isn't a reconnection).
+  int64_t disconnected_at = -1;
+
+  ReconnectPolicy(Clock &clock, std::function<void(AdvertisingMode)> advertise)
+      : clock(clock), advertise(std::move(advertise)) {}
+
+  // Creates the timer.
+  void Setup();
+
+  // There's no link (after boot or a disconnection). `peer_known` tells
+  // whether there is a host to direct the advertising to.
+  void OnDisconnected(bool peer_known);
+  // The link is up and encrypted.
+  void OnConnected();
+  void OnTimer();
+
+private:
+  void Advertise(AdvertisingMode mode, unsigned long millis);
+};
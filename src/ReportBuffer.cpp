@@ -0,0 +1,31 @@
+#include "ReportBuffer.h"
+
+void ReportBuffer::Push(const KeyReport &report, int64_t now_micros) {
+  Expire(now_micros);
+  if (count == kCapacity) {
+    entries[(first + count - 1) % kCapacity] = {report, now_micros};
+    ++overwritten;
+    return;
+  }
+  entries[(first + count) % kCapacity] = {report, now_micros};
+  ++count;
+}
+
+bool ReportBuffer::Pop(KeyReport &report, int64_t now_micros) {
+  Expire(now_micros);
+  if (count == 0) {
+    return false;
+  }
+  report = entries[first].report;
+  first = (first + 1) % kCapacity;
+  --count;
+  return true;
+}
+
+void ReportBuffer::Expire(int64_t now_micros) {
+  while (count && now_micros - entries[first].time > expiry_micros) {
+    first = (first + 1) % kCapacity;
+    --count;
+    ++expired;
+  }
+}
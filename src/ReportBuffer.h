@@ -0,0 +1,49 @@
+// Holds the HID reports produced while the host can't receive them.
+//
+// The chord engine keeps running while the link is down (dropped, or not yet
+// back after a deep sleep wake-up). Its reports - the resolved actions, not
+// the raw button edges - wait here and are sent in order once the host
+// reconnects. Reports older than `expiry_micros` are dropped, so text typed
+// into a host that was away for long doesn't show up out of the blue.
+//
+// Every report carries the state of all the keys, so dropping a prefix of the
+// buffer never leaves a key stuck on the host.
+
+#pragma once
+
+#include "HidReport.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Default expiry of the buffered reports.
+constexpr unsigned long kBufferedReportExpiryMillis = 10 * 1000;
+
+struct ReportBuffer {
+  // About a hundred keystrokes (press & release reports).
+  constexpr static size_t kCapacity = 256;
+
+  int64_t expiry_micros = kBufferedReportExpiryMillis * 1000;
+
+  struct Entry {
+    KeyReport report;
+    int64_t time; // when it was buffered
+  } entries[kCapacity];
+  size_t first = 0;
+  size_t count = 0;
+
+  // Statistics
+  uint32_t expired = 0;     // reports dropped because of their age
+  uint32_t overwritten = 0; // reports replaced while the buffer was full
+
+  bool Empty() const { return count == 0; }
+  size_t Size() const { return count; }
+
+  // When the buffer is full, the newest report is replaced so that the host
+  // still ends up with the final state of the keys.
+  void Push(const KeyReport &report, int64_t now_micros);
+  // Oldest report that didn't expire. Returns false if there's none.
+  bool Pop(KeyReport &report, int64_t now_micros);
+  void Expire(int64_t now_micros);
+  void Clear() { count = 0; }
+};
@@ -0,0 +1,57 @@
+// Hands the expirations of a one-shot timer from the task that dispatches them
+// (esp_timer) to the task that owns the timer.
+//
+// Every Arm and Disarm starts a new generation. The dispatcher reports the
+// generation that was armed when the timer expired and the owner drops reports
+// of older generations, so a timer that expired while the owner was stopping or
+// restarting it doesn't fire afterwards (esp_timer_stop can't cancel a callback
+// that is already being dispatched). A dispatch that started just before a
+// restart may still read the new generation - an expiration is therefore also
+// ignored before the armed deadline, the real one follows.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct TimerExpiry {
+  // Owner task. The deadline must not be later than the actual expiration.
+  void Arm(int64_t deadline_micros) {
+    deadline = deadline_micros;
+    active = true;
+    armed.store(++generation, std::memory_order_release);
+  }
+  void Disarm() {
+    ++generation;
+    active = false;
+    armed.store(0, std::memory_order_release);
+  }
+  // Armed and not taken yet (even if the expiration is still on its way).
+  bool IsActive() const { return active; }
+
+  // Dispatching task.
+  void Expire() {
+    expired.store(armed.load(std::memory_order_acquire),
+                  std::memory_order_release);
+  }
+
+  // Owner task. True once per generation, when its expiration has arrived.
+  bool TakeExpired(int64_t now_micros) {
+    uint32_t reported = expired.exchange(0, std::memory_order_acq_rel);
+    if (!active || reported != generation || now_micros < deadline) {
+      return false;
+    }
+    active = false;
+    return true;
+  }
+
+private:
+  // Owned by the owner task
+  uint32_t generation = 0;
+  int64_t deadline = 0;
+  bool active = false;
+  // Generation the dispatcher reports (0 while disarmed)
+  std::atomic<uint32_t> armed{0};
+  // Last reported generation, 0 once taken
+  std::atomic<uint32_t> expired{0};
+};
@@ -0,0 +1,97 @@
+#include "TraceRecorder.h"
+
+#include <algorithm>
+
+void TraceRecorder::Pause() {
+  paused = true;
+  dump_end = written.load(std::memory_order_acquire);
+  dump_first = dump_end;
+  if (events) {
+    // The oldest slot may be getting overwritten by a Record call that
+    // started before the pause, so a full buffer is dumped without it
+    dump_first = dump_end - std::min(dump_end, capacity - 1);
+  }
+}
+
+static void PutLittleEndian(uint8_t *out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = value >> (8 * i);
+  }
+}
+
+static uint64_t GetLittleEndian(const uint8_t *data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= uint64_t(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+size_t TraceRecorder::ReadDump(size_t offset, uint8_t *out,
+                               size_t size) const {
+  size_t copied = 0;
+  // The dump is generated piece by piece - the header, then every record
+  auto copy = [&](const uint8_t *piece, size_t piece_offset,
+                  size_t piece_size) {
+    size_t begin = std::max(offset, piece_offset);
+    size_t end = std::min(offset + size, piece_offset + piece_size);
+    if (begin < end) {
+      memcpy(out + (begin - offset), piece + (begin - piece_offset),
+             end - begin);
+      copied += end - begin;
+    }
+  };
+  uint8_t header[kDumpHeaderSize];
+  header[0] = kFormatVersion;
+  header[1] = sizeof(TraceEvent);
+  PutLittleEndian(header + 2, dump_end, 4);
+  PutLittleEndian(header + 6, dump_end - dump_first, 4);
+  copy(header, 0, sizeof(header));
+
+  size_t first_record = offset > kDumpHeaderSize
+                            ? (offset - kDumpHeaderSize) / sizeof(TraceEvent)
+                            : 0;
+  if (first_record >= dump_end - dump_first) {
+    return copied;
+  }
+  for (uint32_t i = dump_first + first_record; i != dump_end; ++i) {
+    size_t record_offset =
+        kDumpHeaderSize + size_t(i - dump_first) * sizeof(TraceEvent);
+    if (record_offset >= offset + size) {
+      break;
+    }
+    const TraceEvent &event = events[i & (capacity - 1)];
+    uint8_t record[sizeof(TraceEvent)];
+    PutLittleEndian(record, event.time, 8);
+    record[8] = event.type;
+    record[9] = event.arg;
+    memcpy(record + 10, event.data, sizeof(event.data));
+    copy(record, record_offset, sizeof(record));
+  }
+  return copied;
+}
+
+bool TraceRecorder::ParseDump(const uint8_t *data, size_t size,
+                              std::vector<TraceEvent> &events,
+                              uint32_t &recorded) {
+  if (size < kDumpHeaderSize || data[0] != kFormatVersion ||
+      data[1] != sizeof(TraceEvent)) {
+    return false;
+  }
+  recorded = GetLittleEndian(data + 2, 4);
+  uint32_t count = GetLittleEndian(data + 6, 4);
+  if (size != kDumpHeaderSize + size_t(count) * sizeof(TraceEvent)) {
+    return false;
+  }
+  events.clear();
+  for (const uint8_t *record = data + kDumpHeaderSize; record < data + size;
+       record += sizeof(TraceEvent)) {
+    TraceEvent event;
+    event.time = GetLittleEndian(record, 8);
+    event.type = TraceEventType(record[8]);
+    event.arg = record[9];
+    memcpy(event.data, record + 10, sizeof(event.data));
+    events.push_back(event);
+  }
+  return true;
+}
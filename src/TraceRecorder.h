@@ -0,0 +1,107 @@
+// Circular trace of the keyer's input processing, for debugging the debouncer
+// and the engine without `kDebug` (printing makes the device laggy).
+//
+// Records the button edges seen by the GPIO interrupt, the debounced state
+// changes, the engine's decisions and the HID reports, each with its
+// esp_timer time. Recording is a few stores into the buffer (the firmware puts
+// it in PSRAM), so it's always on. Only the input task records events.
+//
+// A dump pauses the recording until it's read to the end. `host/trace_dump`
+// decodes it into a timeline, or into a button trace for `host/replay`.
+
+#pragma once
+
+#include "ChordEngine.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum TraceEventType : uint8_t {
+  TRACE_NONE,
+  // Edge from the GPIO interrupt (its time). `arg` = button.
+  TRACE_EDGE,
+  // Debounced state change. `arg` = button, `data[0]` = pressed.
+  TRACE_DEBOUNCED,
+  // `arg` = EngineDecision, `data` = action ID & buttons (uint16 each).
+  TRACE_DECISION,
+  // Report sent to the host (or buffered). `arg` = modifiers, `data` = keys.
+  TRACE_REPORT,
+};
+
+struct TraceEvent {
+  int64_t time;
+  TraceEventType type;
+  uint8_t arg;
+  uint8_t data[6];
+};
+static_assert(sizeof(TraceEvent) == 16);
+
+struct TraceRecorder {
+  constexpr static uint8_t kFormatVersion = 1;
+  // Version, record size, number of recorded events (uint32, including the
+  // overwritten ones) and number of records (uint32).
+  constexpr static size_t kDumpHeaderSize = 10;
+
+  TraceEvent *events = nullptr;
+  uint32_t capacity = 0; // power of two
+  // Events recorded since boot. The newest one is at `written - 1`.
+  std::atomic<uint32_t> written{0};
+  std::atomic<bool> paused{false};
+  // Records of the dump in progress
+  uint32_t dump_first = 0, dump_end = 0;
+
+  // `capacity` must be a power of two. Recording is off until this is called.
+  void Attach(TraceEvent *buffer, uint32_t capacity) {
+    this->capacity = capacity;
+    events = buffer;
+  }
+
+  void Record(const TraceEvent &event) {
+    if (events == nullptr || paused.load(std::memory_order_relaxed)) {
+      return;
+    }
+    uint32_t n = written.load(std::memory_order_relaxed);
+    events[n & (capacity - 1)] = event;
+    written.store(n + 1, std::memory_order_release);
+  }
+  void Edge(int64_t time, Button button) {
+    Record({time, TRACE_EDGE, button, {}});
+  }
+  void Debounced(int64_t time, Button button, bool pressed) {
+    Record({time, TRACE_DEBOUNCED, button, {pressed}});
+  }
+  void Decision(int64_t time, EngineDecision decision, ActionId id,
+                ButtonMask buttons) {
+    Record({time,
+            TRACE_DECISION,
+            decision,
+            {uint8_t(id), uint8_t(id >> 8), uint8_t(buttons),
+             uint8_t(buttons >> 8)}});
+  }
+  void Report(int64_t time, const KeyReport &report) {
+    TraceEvent event = {time, TRACE_REPORT, report.modifiers, {}};
+    memcpy(event.data, report.keys, sizeof(event.data));
+    Record(event);
+  }
+
+  // Stops the recording and takes the recorded events for a dump.
+  void Pause();
+  void Resume() { paused = false; }
+
+  // The dump is the header followed by the records, oldest first: time
+  // (int64), type, arg & data. Little-endian.
+  size_t DumpSize() const {
+    return kDumpHeaderSize + (dump_end - dump_first) * sizeof(TraceEvent);
+  }
+  // Copies up to `size` bytes of the dump, starting at `offset`. Returns the
+  // number of bytes copied (0 past the end).
+  size_t ReadDump(size_t offset, uint8_t *out, size_t size) const;
+
+  // Parses a dump. Returns false if it's malformed.
+  static bool ParseDump(const uint8_t *data, size_t size,
+                        std::vector<TraceEvent> &events,
+                        uint32_t &recorded);
+};